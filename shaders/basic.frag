@@ -3,28 +3,44 @@
 in vec3 fPosition;
 in vec3 fNormal;
 in vec2 fTexCoords;
-
-in vec4 fPosLight;
-uniform sampler2D shadowMap;
+// transformed by the vertex shader with the object's model and normal matrices
+in vec3 fWorldPosition;
+in vec3 fWorldNormal;
+in vec3 fEyePosition;
+in vec3 fEyeNormal;
+
+// cascaded shadow maps, one layer per cascade (ShadowData in UniformBuffers.hpp)
+layout(std140) uniform ShadowData {
+    mat4 cascadeMatrices[4];
+    // far end of each cascade, as a distance along the view axis
+    vec4 cascadeSplits;
+    // world size of one shadow map texel in each cascade
+    vec4 cascadeTexelSizes;
+    int cascadeCount;
+};
+uniform sampler2DArray shadowMap;
 
 out vec4 fColor;
 
-//matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat3 normalMatrix;
-
-//lighting
-uniform vec3 lightDir;
-uniform vec3 lightColor;
-uniform vec3 punctLight;
-uniform vec3 punctLightColor;
+// per-frame camera data, shared by every program (FrameData in UniformBuffers.hpp)
+layout(std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+};
+
+//lighting, with the fog and second light switches (LightData in UniformBuffers.hpp)
+layout(std140) uniform LightData {
+    vec3 lightDir;
+    int fog;
+    vec3 lightColor;
+    int secondLight;
+    vec3 punctLight;
+    vec3 punctLightColor;
+};
 
 // textures
 uniform sampler2D diffuseTexture;
 uniform sampler2D specularTexture;
-uniform int fog;
-uniform int secondLight;
 
 //components
 vec3 ambient;
@@ -41,17 +57,33 @@ float quadratic = 0.0075f;
 
 float shadow()
 {
-    vec3 normalizedCoords = fPosLight.xyz / fPosLight.w;
+    vec4 worldPosition = vec4(fWorldPosition, 1.0f);
+    float viewDistance = -fEyePosition.z;
+
+    // the first cascade reaching the fragment, no shadow beyond the last one
+    int cascade = 0;
+    while (cascade < cascadeCount && viewDistance > cascadeSplits[cascade]) {
+        cascade++;
+    }
+    if (cascade == cascadeCount) return 0.0f;
+
+    // against acne, move the lookup off the surface by about a texel of this cascade rather than biasing the depth
+    vec3 worldNormal = normalize(fWorldNormal);
+    worldPosition.xyz += worldNormal * cascadeTexelSizes[cascade] * 1.5f;
+
+    vec4 lightPosition = cascadeMatrices[cascade] * worldPosition;
+    vec3 normalizedCoords = lightPosition.xyz / lightPosition.w;
 
     normalizedCoords = normalizedCoords * 0.5 + 0.5;
 	
 	if (normalizedCoords.z > 1.0f) return 0.0f;
 
-	float closestDepth = texture(shadowMap, normalizedCoords.xy).r;
+	float closestDepth = texture(shadowMap, vec3(normalizedCoords.xy, float(cascade))).r;
 
 	float currentDepth = normalizedCoords.z;
 
-	float bias = max(0.05f * (1.0f - dot(fNormal,lightDir)), 0.05f);
+	// the depth of a cascade spans as many world units as its width, so one texel of depth is 1 / size
+	float bias = 1.5f / float(textureSize(shadowMap, 0).x);
 	float shadow = currentDepth - bias > closestDepth ? 1.0 : 0.0;	
 
 	return shadow;
@@ -60,7 +92,7 @@ float shadow()
 
 float computeFog()
 {
-     fPosEye = view * model * vec4(fPosition, 1.0f);
+     fPosEye = vec4(fEyePosition, 1.0f);
      float fogDensity = 0.007f;
      float fragmentDistance = length(fPosEye);
      float fogFactor = exp(-pow(fragmentDistance * fogDensity, 2));
@@ -71,8 +103,8 @@ float computeFog()
 void computeDirLight()
 {
     //compute eye space coordinates
-    fPosEye = view * model * vec4(fPosition, 1.0f);
-    vec3 normalEye = normalize(normalMatrix * fNormal);
+    fPosEye = vec4(fEyePosition, 1.0f);
+    vec3 normalEye = normalize(fEyeNormal);
 
     //normalize light direction
     vec3 lightDirN = vec3(normalize(view * vec4(lightDir, 0.0f)));
@@ -7,19 +7,59 @@ layout(location=2) in vec2 vTexCoords;
 out vec3 fPosition;
 out vec3 fNormal;
 out vec2 fTexCoords;
-out vec4 fPosLight;
+// the transforms the fragment shader needs, done once per vertex
+out vec3 fWorldPosition;
+out vec3 fWorldNormal;
+out vec3 fEyePosition;
+out vec3 fEyeNormal;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform	mat3 normalMatrix;
-uniform mat4 lightSpaceTrMatrix;
+// per-frame camera data, shared by every program (FrameData in UniformBuffers.hpp)
+layout(std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+};
+
+// per-object constants of the frame (ObjectBuffer.hpp): the model matrix's columns, then the normal matrix's
+uniform samplerBuffer objectConstants;
+uniform int objectIndex;
+mat4 model;
+mat3 normalMatrix;
+// quantized meshes store positions relative to their bounds, identity otherwise
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+// batched draws of the geometry arena (GeometryArena.hpp) take the object index and position decoding from
+// their draw record at drawBase + vDrawId instead of the uniforms above; drawBase is -1 for other draws
+layout(location=3) in int vDrawId;
+uniform samplerBuffer drawRecords;
+uniform int drawBase;
 
 void main() 
 {
-	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
-	fPosition = vPosition;
+	int object = objectIndex;
+	vec3 scale = positionScale;
+	vec3 offset = positionOffset;
+	if (drawBase >= 0) {
+		int record = (drawBase + vDrawId) * 2;
+		vec4 scaleAndObject = texelFetch(drawRecords, record);
+		object = int(scaleAndObject.w);
+		scale = scaleAndObject.xyz;
+		offset = texelFetch(drawRecords, record + 1).xyz;
+	}
+
+	int base = object * 7;
+	model = mat4(texelFetch(objectConstants, base), texelFetch(objectConstants, base + 1),
+	             texelFetch(objectConstants, base + 2), texelFetch(objectConstants, base + 3));
+	normalMatrix = mat3(texelFetch(objectConstants, base + 4).xyz, texelFetch(objectConstants, base + 5).xyz,
+	                    texelFetch(objectConstants, base + 6).xyz);
+	vec3 position = offset + vPosition * scale;
+	vec4 worldPosition = model * vec4(position, 1.0f);
+	vec4 eyePosition = view * worldPosition;
+	gl_Position = projection * eyePosition;
+	fPosition = position;
 	fNormal = vNormal;
 	fTexCoords = vTexCoords;
-	fPosLight = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
+	fWorldPosition = worldPosition.xyz;
+	fWorldNormal = mat3(model) * vNormal;
+	fEyePosition = eyePosition.xyz;
+	fEyeNormal = normalMatrix * vNormal;
 }
@@ -4,9 +4,13 @@ layout(location=0) in vec3 vPosition;
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
 
+// per-frame camera data, shared by every program (FrameData in UniformBuffers.hpp)
+layout(std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+};
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 void main() 
 {
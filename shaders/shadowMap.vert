@@ -2,11 +2,48 @@
 
 layout(location=0) in vec3 vPosition;
 
-uniform mat4 lightSpaceTrMatrix;
-uniform mat4 model;
+// the cascades' light matrices (ShadowData in UniformBuffers.hpp)
+layout(std140) uniform ShadowData {
+    mat4 cascadeMatrices[4];
+    // far end of each cascade, as a distance along the view axis
+    vec4 cascadeSplits;
+    // world size of one shadow map texel in each cascade
+    vec4 cascadeTexelSizes;
+    int cascadeCount;
+};
+
+// layer being drawn
+uniform int cascade;
+// per-object constants of the frame (ObjectBuffer.hpp): the model matrix's columns, then the normal matrix's
+uniform samplerBuffer objectConstants;
+uniform int objectIndex;
+mat4 model;
+// quantized meshes store positions relative to their bounds, identity otherwise
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+// batched draws of the geometry arena (GeometryArena.hpp) take the object index and position decoding from
+// their draw record at drawBase + vDrawId instead of the uniforms above; drawBase is -1 for other draws
+layout(location=3) in int vDrawId;
+uniform samplerBuffer drawRecords;
+uniform int drawBase;
 
 void main()
 {
- gl_Position = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
+ int object = objectIndex;
+ vec3 scale = positionScale;
+ vec3 offset = positionOffset;
+ if (drawBase >= 0) {
+  int record = (drawBase + vDrawId) * 2;
+  vec4 scaleAndObject = texelFetch(drawRecords, record);
+  object = int(scaleAndObject.w);
+  scale = scaleAndObject.xyz;
+  offset = texelFetch(drawRecords, record + 1).xyz;
+ }
+
+ int base = object * 7;
+ model = mat4(texelFetch(objectConstants, base), texelFetch(objectConstants, base + 1),
+              texelFetch(objectConstants, base + 2), texelFetch(objectConstants, base + 3));
+ vec3 position = offset + vPosition * scale;
+ gl_Position = cascadeMatrices[cascade] * model * vec4(position, 1.0f);
 }
 
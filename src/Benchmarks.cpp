@@ -0,0 +1,701 @@
+#include "Benchmarks.hpp"
+
+#include "FrustumCulling.hpp"
+#include "Model3D.hpp"
+#include "MeshCache.hpp"
+#include "MeshClusters.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshSimplifier.hpp"
+#include "OcclusionCulling.hpp"
+#include "RenderQueue.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+namespace gps {
+
+    static double ElapsedMs(std::chrono::steady_clock::time_point start) {
+
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    int RunLoadBenchmark(std::string fileName) {
+
+        std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
+
+        // cold path, exactly what Model3D::LoadModel does without a cache: text parsing and welding, then the
+        // optimizer, the LOD chains and the meshlets, timed one by one
+        LoadOptions parseOptions;
+        parseOptions.optimizeMeshes = false;
+        parseOptions.generateLods = false;
+        parseOptions.buildMeshlets = false;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        ModelData data;
+        Model3D::ReadOBJ(fileName, basePath, data, parseOptions);
+        double parseMs = ElapsedMs(start);
+
+        start = std::chrono::steady_clock::now();
+        Model3D::OptimizeMeshes(data);
+        double optimizeMs = ElapsedMs(start);
+
+        start = std::chrono::steady_clock::now();
+        Model3D::SimplifyMeshes(data);
+        double lodMs = ElapsedMs(start);
+
+        start = std::chrono::steady_clock::now();
+        Model3D::ClusterMeshes(data);
+        double meshletMs = ElapsedMs(start);
+
+        double coldMs = parseMs + optimizeMs + lodMs + meshletMs;
+
+        // a cache of its own, the viewer's may hold other load options (batchByMaterial) and must survive the run
+        uint64_t sourceHash = MeshCache::ComputeSourceHash(fileName, basePath);
+        std::string cacheFileName = MeshCache::GetCacheFileName(fileName + ".bench");
+        if (!MeshCache::Write(cacheFileName, sourceHash, 0, data)) {
+
+            std::cerr << "ERROR: could not write " << cacheFileName << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        // cached path: source hashing, mapping and copying every blob out, best of several runs
+        const int runs = 5;
+        double cachedMs = 0.0;
+        size_t checksum = 0;
+
+        for (int run = 0; run < runs; run++) {
+
+            start = std::chrono::steady_clock::now();
+
+            MeshCache cache;
+            if (!cache.Open(cacheFileName, MeshCache::ComputeSourceHash(fileName, basePath), 0)) {
+
+                std::cerr << "ERROR: could not open " << cacheFileName << std::endl;
+                remove(cacheFileName.c_str());
+                return EXIT_FAILURE;
+            }
+
+            for (size_t i = 0; i < cache.getMeshCount(); i++) {
+
+                MeshView mesh = cache.getMesh(i);
+                std::vector<Vertex> vertices(mesh.vertices, mesh.vertices + mesh.vertexCount);
+                std::vector<GLuint> indices(mesh.indices, mesh.indices + mesh.indexCount);
+                checksum += vertices.size() + indices.size();
+            }
+
+            double runMs = ElapsedMs(start);
+            if (run == 0 || runMs < cachedMs) {
+                cachedMs = runMs;
+            }
+        }
+
+        remove(cacheFileName.c_str());
+
+        double speedup = coldMs / (cachedMs > 0.0 ? cachedMs : 1e-3);
+
+        std::cout << "Meshes         : " << data.meshes.size() << " (" << checksum / runs << " vertices + indices)" << std::endl;
+        std::cout << "Parse .obj     : " << parseMs << " ms" << std::endl;
+        std::cout << "Optimize       : " << optimizeMs << " ms" << std::endl;
+        std::cout << "LOD chains     : " << lodMs << " ms" << std::endl;
+        std::cout << "Meshlets       : " << meshletMs << " ms" << std::endl;
+        std::cout << "Cold load      : " << coldMs << " ms" << std::endl;
+        std::cout << "Mesh cache     : " << cachedMs << " ms" << std::endl;
+        std::cout << "Speedup        : " << speedup << "x (target 10x)" << std::endl;
+
+        return speedup >= 10.0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    int RunOptimizeBenchmark(std::string fileName) {
+
+        std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
+
+        LoadOptions options;
+        options.optimizeMeshes = false;
+        options.generateLods = false;
+        options.buildMeshlets = false;
+        ModelData data;
+        Model3D::ReadOBJ(fileName, basePath, data, options);
+
+        size_t triangles = 0;
+        size_t vertices = 0;
+        size_t missesBefore = 0;
+        size_t missesAfter = 0;
+        double optimizeMs = 0.0;
+
+        std::cout << "mesh  triangles      ACMR before/after      ATVR before/after" << std::endl;
+
+        for (size_t i = 0; i < data.meshes.size(); i++) {
+
+            MeshData& mesh = data.meshes[i];
+            VertexCacheStats before = AnalyzeVertexCache(mesh.indices, mesh.vertices.size());
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            OptimizeMesh(mesh);
+            optimizeMs += ElapsedMs(start);
+
+            VertexCacheStats after = AnalyzeVertexCache(mesh.indices, mesh.vertices.size());
+
+            printf("%4zu %10zu %10.3f %8.3f %12.3f %8.3f\n", i, before.triangles, before.acmr, after.acmr, before.atvr, after.atvr);
+
+            triangles += before.triangles;
+            vertices += before.vertices;
+            missesBefore += before.misses;
+            missesAfter += after.misses;
+        }
+
+        if (triangles == 0) {
+
+            std::cerr << "ERROR: " << fileName << " has no triangles" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        float acmrBefore = (float)missesBefore / triangles;
+        float acmrAfter = (float)missesAfter / triangles;
+
+        std::cout << "Total ACMR     : " << acmrBefore << " -> " << acmrAfter << std::endl;
+        std::cout << "Total ATVR     : " << (float)missesBefore / vertices << " -> " << (float)missesAfter / vertices << std::endl;
+        std::cout << "Optimization   : " << optimizeMs << " ms for " << triangles << " triangles" << std::endl;
+
+        // the overdraw reordering may give back a little of the cache efficiency, but no more than its budget
+        return acmrAfter <= acmrBefore * OVERDRAW_THRESHOLD ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    int RunLodBenchmark(std::string fileName) {
+
+        std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
+
+        LoadOptions options;
+        options.generateLods = false;
+        options.buildMeshlets = false;
+        ModelData data;
+        Model3D::ReadOBJ(fileName, basePath, data, options);
+
+        if (data.meshes.empty()) {
+
+            std::cerr << "ERROR: " << fileName << " has no meshes" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < data.meshes.size(); i++) {
+            GenerateLods(data.meshes[i]);
+        }
+        double simplifyMs = ElapsedMs(start);
+
+        // per level totals, meshes with shorter chains count with their coarsest level
+        std::vector<size_t> levelTriangles(LOD_MAX_LEVELS + 1, 0);
+        std::vector<float> levelErrors(LOD_MAX_LEVELS + 1, 0.0f);
+        std::vector<glm::vec3> centers(data.meshes.size());
+        std::vector<float> radii(data.meshes.size());
+        glm::vec3 modelMinimum(FLT_MAX);
+        glm::vec3 modelMaximum(-FLT_MAX);
+        bool valid = true;
+
+        for (size_t i = 0; i < data.meshes.size(); i++) {
+
+            const MeshData& mesh = data.meshes[i];
+            size_t previous = mesh.indices.size();
+
+            for (size_t level = 0; level <= LOD_MAX_LEVELS; level++) {
+
+                size_t lod = std::min(level, mesh.lods.size());
+                levelTriangles[level] += (lod == 0 ? mesh.indices.size() : mesh.lods[lod - 1].indexCount) / 3;
+                levelErrors[level] = std::max(levelErrors[level], lod == 0 ? 0.0f : mesh.lods[lod - 1].error);
+            }
+
+            for (size_t l = 0; l < mesh.lods.size(); l++) {
+
+                valid = valid && mesh.lods[l].indexCount < previous && mesh.lods[l].indexCount % 3 == 0;
+                previous = mesh.lods[l].indexCount;
+            }
+
+            glm::vec3 minimum(FLT_MAX);
+            glm::vec3 maximum(-FLT_MAX);
+            for (size_t v = 0; v < mesh.vertices.size(); v++) {
+
+                minimum = glm::min(minimum, mesh.vertices[v].Position);
+                maximum = glm::max(maximum, mesh.vertices[v].Position);
+            }
+            centers[i] = (minimum + maximum) * 0.5f;
+            radii[i] = glm::length(maximum - minimum) * 0.5f;
+            modelMinimum = glm::min(modelMinimum, minimum);
+            modelMaximum = glm::max(modelMaximum, maximum);
+        }
+
+        std::cout << "level  triangles   max error" << std::endl;
+        for (size_t level = 0; level <= LOD_MAX_LEVELS; level++) {
+            printf("%5zu %10zu %11.4g\n", level, levelTriangles[level], levelErrors[level]);
+        }
+
+        // same projection as the scene, camera backing away from the model along +z
+        glm::vec3 modelCenter = (modelMinimum + modelMaximum) * 0.5f;
+        float modelRadius = glm::length(modelMaximum - modelMinimum) * 0.5f;
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+
+        std::cout << "distance  triangles drawn" << std::endl;
+        for (float distance = 1.0f; distance <= 64.0f; distance *= 4.0f) {
+
+            glm::vec3 eye = modelCenter + glm::vec3(0.0f, 0.0f, modelRadius * distance);
+            glm::mat4 view = glm::lookAt(eye, modelCenter, glm::vec3(0.0f, 1.0f, 0.0f));
+            DrawContext context = MakeDrawContext(glm::mat4(1.0f), view, projection, 1920, 1080);
+
+            size_t triangles = 0;
+            for (size_t i = 0; i < data.meshes.size(); i++) {
+
+                const MeshData& mesh = data.meshes[i];
+                size_t lod = 0;
+                while (lod < mesh.lods.size() && GetScreenError(mesh.lods[lod].error, centers[i], radii[i], context) <= context.maxScreenError) {
+                    lod++;
+                }
+                triangles += (lod == 0 ? mesh.indices.size() : mesh.lods[lod - 1].indexCount) / 3;
+            }
+
+            printf("%7.0fx %16zu (%.1f%%)\n", distance, triangles, 100.0 * triangles / std::max(levelTriangles[0], (size_t)1));
+        }
+
+        std::cout << "Simplification : " << simplifyMs << " ms for " << levelTriangles[0] << " triangles" << std::endl;
+
+        return valid ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // True if the triangle has a corner inside the frustum, faces the camera and, without multisampling, its screen box
+    // covers a pixel center, i.e. no culling test may remove it
+    static bool IsTriangleVisible(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, const DrawContext& context) {
+
+        glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        if (glm::dot(normal, context.cameraPosition - p0) <= 0.0f) {
+            return false;
+        }
+
+        glm::vec3 corners[3] = { p0, p1, p2 };
+        glm::vec2 low(FLT_MAX);
+        glm::vec2 high(-FLT_MAX);
+        bool cornerInside = false;
+
+        for (int k = 0; k < 3; k++) {
+
+            glm::vec4 clip = context.viewProjection * glm::vec4(corners[k], 1.0f);
+            if (clip.w <= 0.0f) {
+                return false;
+            }
+
+            bool inside = true;
+            for (int p = 0; p < 6; p++) {
+                inside = inside && glm::dot(glm::vec3(context.frustumPlanes[p]), corners[k]) + context.frustumPlanes[p].w >= 0.0f;
+            }
+            cornerInside = cornerInside || inside;
+
+            glm::vec2 pixel = (glm::vec2(clip.x, clip.y) / clip.w * 0.5f + 0.5f) * context.viewportSize;
+            low = glm::min(low, pixel);
+            high = glm::max(high, pixel);
+        }
+
+        // multisampled pixels hold samples off their centers, anything inside the viewport may cover one
+        if (context.sampleCount > 1) {
+            return cornerInside;
+        }
+
+        glm::vec2 first = glm::max(glm::vec2(ceilf(low.x - 0.5f), ceilf(low.y - 0.5f)), glm::vec2(0.0f));
+        glm::vec2 last = glm::min(glm::vec2(floorf(high.x - 0.5f), floorf(high.y - 0.5f)), context.viewportSize - 1.0f);
+        return cornerInside && first.x <= last.x && first.y <= last.y;
+    }
+
+    // Culls the meshlets of every mesh from eight views around the model and prints what each test removed.
+    // Returns the triangles of culled meshlets that could have produced a sample.
+    static size_t CullClustersAroundModel(const ModelData& data, glm::vec3 center, float radius, glm::mat4 projection, int samples) {
+
+        ClusterCullStats total = {};
+        size_t wronglyCulled = 0;
+        double cullMs = 0.0;
+        std::vector<GLuint> visible;
+
+        std::cout << "view  meshlets visible  frustum backface    small  triangles drawn" << std::endl;
+
+        for (int view = 0; view < 8; view++) {
+
+            float angle = glm::radians(45.0f * view);
+            glm::vec3 eye = center + radius * glm::vec3(1.2f * cosf(angle), 0.3f, 1.2f * sinf(angle));
+            DrawContext context = MakeDrawContext(glm::mat4(1.0f), glm::lookAt(eye, center, glm::vec3(0.0f, 1.0f, 0.0f)), projection, 1920, 1080);
+            context.sampleCount = samples;
+
+            ClusterCullStats stats = {};
+            for (size_t i = 0; i < data.meshes.size(); i++) {
+
+                const MeshData& mesh = data.meshes[i];
+                visible.clear();
+
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                CullMeshlets(mesh.meshlets, context, visible, stats);
+                cullMs += ElapsedMs(start);
+
+                // no triangle of a culled meshlet may have been able to produce a sample
+                size_t next = 0;
+                for (size_t m = 0; m < mesh.meshlets.size(); m++) {
+
+                    if (next < visible.size() && visible[next] == m) {
+
+                        next++;
+                        continue;
+                    }
+
+                    const Meshlet& meshlet = mesh.meshlets[m];
+                    for (size_t t = meshlet.indexOffset; t < meshlet.indexOffset + meshlet.indexCount; t += 3) {
+
+                        if (IsTriangleVisible(mesh.vertices[mesh.indices[t]].Position, mesh.vertices[mesh.indices[t + 1]].Position,
+                                              mesh.vertices[mesh.indices[t + 2]].Position, context)) {
+                            wronglyCulled++;
+                        }
+                    }
+                }
+            }
+
+            printf("%4d %9zu %7zu %8zu %8zu %8zu %10zu (%.1f%%)\n", view, stats.meshlets, stats.meshlets - stats.frustumCulled - stats.backfaceCulled - stats.smallCulled,
+                stats.frustumCulled, stats.backfaceCulled, stats.smallCulled, stats.visibleTriangles, 100.0 * stats.visibleTriangles / stats.triangles);
+
+            total.meshlets += stats.meshlets;
+            total.triangles += stats.triangles;
+            total.visibleTriangles += stats.visibleTriangles;
+        }
+
+        std::cout << "Culled         : " << 100.0 * (total.triangles - total.visibleTriangles) / total.triangles << "% of the triangles" << std::endl;
+        std::cout << "Culling        : " << cullMs * 1e6 / total.meshlets << " ns per meshlet" << std::endl;
+
+        return wronglyCulled;
+    }
+
+    int RunClusterBenchmark(std::string fileName) {
+
+        std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
+
+        LoadOptions options;
+        options.generateLods = false;
+        ModelData data;
+        Model3D::ReadOBJ(fileName, basePath, data, options);
+
+        glm::vec3 minimum(FLT_MAX);
+        glm::vec3 maximum(-FLT_MAX);
+        size_t meshlets = 0;
+        size_t triangles = 0;
+        for (size_t i = 0; i < data.meshes.size(); i++) {
+
+            for (size_t v = 0; v < data.meshes[i].vertices.size(); v++) {
+
+                minimum = glm::min(minimum, data.meshes[i].vertices[v].Position);
+                maximum = glm::max(maximum, data.meshes[i].vertices[v].Position);
+            }
+            meshlets += data.meshes[i].meshlets.size();
+            triangles += data.meshes[i].indices.size() / 3;
+        }
+
+        if (meshlets == 0) {
+
+            std::cerr << "ERROR: " << fileName << " has no triangles" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        // the views orbit the model from slightly above, same projection as the scene
+        glm::vec3 center = (minimum + maximum) * 0.5f;
+        float radius = glm::length(maximum - minimum) * 0.5f;
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+
+        std::cout << "Meshlets       : " << meshlets << " (" << (float)triangles / meshlets << " triangles each)" << std::endl;
+
+        // the pixel grid test only runs without multisampling, the viewer draws with 4 samples per pixel
+        size_t wronglyCulled = 0;
+        for (int samples = 1; samples <= 4; samples *= 4) {
+
+            std::cout << samples << " sample(s) per pixel" << std::endl;
+            wronglyCulled += CullClustersAroundModel(data, center, radius, projection, samples);
+        }
+
+        std::cout << "Wrongly culled : " << wronglyCulled << " triangles" << std::endl;
+
+        return wronglyCulled == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    int RunCullingBenchmark() {
+
+        // a fixed seed so runs are comparable, boxes of up to 4 units scattered over 400
+        const size_t boxCount = 16384;
+        const int repetitions = 200;
+        std::mt19937 random(1234);
+        std::uniform_real_distribution<float> position(-200.0f, 200.0f);
+        std::uniform_real_distribution<float> size(0.1f, 4.0f);
+
+        BoundingBoxes boxes;
+        for (size_t i = 0; i < boxCount; i++) {
+
+            glm::vec3 minimum(position(random), position(random), position(random));
+            boxes.add(minimum, minimum + glm::vec3(size(random), size(random), size(random)));
+        }
+
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+        std::vector<GLuint> visibility;
+        std::vector<GLuint> reference;
+        size_t mismatches = 0;
+        size_t visible = 0;
+        double simdMs = 0.0;
+        double scalarMs = 0.0;
+
+        for (int view = 0; view < 8; view++) {
+
+            float angle = glm::radians(45.0f * view);
+            glm::vec3 direction(cosf(angle), 0.2f, sinf(angle));
+            DrawContext context = MakeDrawContext(glm::mat4(1.0f), glm::lookAt(glm::vec3(0.0f), direction, glm::vec3(0.0f, 1.0f, 0.0f)), projection, 1920, 1080);
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (int r = 0; r < repetitions; r++) {
+                CullBoxes(boxes, context.frustumPlanes, visibility);
+            }
+            simdMs += ElapsedMs(start);
+
+            start = std::chrono::steady_clock::now();
+            for (int r = 0; r < repetitions; r++) {
+                CullBoxesScalar(boxes, context.frustumPlanes, reference);
+            }
+            scalarMs += ElapsedMs(start);
+
+            for (size_t i = 0; i < boxCount; i++) {
+
+                mismatches += IsBoxVisible(visibility, i) != IsBoxVisible(reference, i);
+                visible += IsBoxVisible(reference, i);
+            }
+        }
+
+        double tested = (double)boxCount * repetitions * 8;
+        std::cout << "Boxes          : " << boxCount << ", " << 100.0 * visible / (boxCount * 8) << "% visible over 8 views" << std::endl;
+        std::cout << "SIMD           : " << tested / (simdMs * 1000.0) << " meshes per us" << std::endl;
+        std::cout << "Scalar         : " << tested / (scalarMs * 1000.0) << " meshes per us" << std::endl;
+        std::cout << "Mismatches     : " << mismatches << std::endl;
+
+        return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Twelve triangles of a box, wound counter-clockwise from outside
+    static void AddBoxTriangles(glm::vec3 minimum, glm::vec3 maximum, std::vector<glm::vec3>& corners) {
+
+        static const int faces[6][4] = { { 0, 2, 6, 4 }, { 1, 5, 7, 3 }, { 0, 4, 5, 1 }, { 2, 3, 7, 6 }, { 0, 1, 3, 2 }, { 4, 6, 7, 5 } };
+        glm::vec3 corner[8];
+        for (int i = 0; i < 8; i++) {
+            corner[i] = glm::vec3(i & 1 ? maximum.x : minimum.x, i & 2 ? maximum.y : minimum.y, i & 4 ? maximum.z : minimum.z);
+        }
+
+        for (int f = 0; f < 6; f++) {
+
+            const int* face = faces[f];
+            corners.push_back(corner[face[0]]);
+            corners.push_back(corner[face[1]]);
+            corners.push_back(corner[face[2]]);
+            corners.push_back(corner[face[0]]);
+            corners.push_back(corner[face[2]]);
+            corners.push_back(corner[face[3]]);
+        }
+    }
+
+    int RunOcclusionBenchmark() {
+
+        // a fixed seed so runs are comparable: a 6 x 5 grid of houses 30 units apart with streets in between,
+        // and small props scattered everywhere, some of them inside the houses
+        const size_t propCount = 5000;
+        const int repetitions = 50;
+        std::mt19937 random(1234);
+        std::uniform_real_distribution<float> houseSize(12.0f, 18.0f);
+        std::uniform_real_distribution<float> houseHeight(4.0f, 12.0f);
+        std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+        std::uniform_real_distribution<float> propSize(0.2f, 1.5f);
+
+        std::vector<glm::vec3> occluders;
+        occluders.push_back(glm::vec3(-100.0f, 0.0f, -100.0f));
+        occluders.push_back(glm::vec3(-100.0f, 0.0f, 100.0f));
+        occluders.push_back(glm::vec3(100.0f, 0.0f, 100.0f));
+        occluders.push_back(glm::vec3(-100.0f, 0.0f, -100.0f));
+        occluders.push_back(glm::vec3(100.0f, 0.0f, 100.0f));
+        occluders.push_back(glm::vec3(100.0f, 0.0f, -100.0f));
+
+        for (int i = 0; i < 6; i++) {
+            for (int j = 0; j < 5; j++) {
+
+                glm::vec3 center(-75.0f + 30.0f * i, 0.0f, -60.0f + 30.0f * j);
+                glm::vec3 half(houseSize(random) * 0.5f, 0.0f, houseSize(random) * 0.5f);
+                AddBoxTriangles(center - half, center + half + glm::vec3(0.0f, houseHeight(random), 0.0f), occluders);
+            }
+        }
+
+        BoundingBoxes props;
+        std::vector<glm::vec3> propMinimum;
+        std::vector<glm::vec3> propMaximum;
+        for (size_t i = 0; i < propCount; i++) {
+
+            glm::vec3 minimum(position(random), 0.01f, position(random));
+            propMinimum.push_back(minimum);
+            propMaximum.push_back(minimum + glm::vec3(propSize(random), propSize(random), propSize(random)));
+            props.add(propMinimum.back(), propMaximum.back());
+        }
+
+        // rays towards the culled props must hit an occluder first
+        Bvh occluderBvh;
+        occluderBvh.buildTriangles(occluders);
+
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+        OcclusionBuffer buffer;
+        std::vector<GLuint> visibility;
+        size_t inFrustum = 0;
+        size_t occluded = 0;
+        size_t wrongCulls = 0;
+        double rasterizeMs = 0.0;
+        double testMs = 0.0;
+        size_t tests = 0;
+
+        for (int view = 0; view < 8; view++) {
+
+            // at a street crossing, at eye height
+            glm::vec3 eye(-60.0f + 30.0f * (view % 4), 1.7f, -45.0f + 30.0f * (view / 4 * 2));
+            float angle = glm::radians(45.0f * view + 20.0f);
+            glm::mat4 viewMatrix = glm::lookAt(eye, eye + glm::vec3(cosf(angle), -0.05f, sinf(angle)), glm::vec3(0.0f, 1.0f, 0.0f));
+            glm::mat4 viewProjection = projection * viewMatrix;
+            DrawContext context = MakeDrawContext(glm::mat4(1.0f), viewMatrix, projection, 1920, 1080);
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (int r = 0; r < repetitions; r++) {
+
+                buffer.clear();
+                buffer.addOccluder(viewProjection, occluders);
+                buffer.rasterize();
+            }
+            rasterizeMs += ElapsedMs(start);
+
+            CullBoxes(props, context.frustumPlanes, visibility);
+            std::vector<bool> hidden(propCount, false);
+
+            start = std::chrono::steady_clock::now();
+            for (int r = 0; r < repetitions; r++) {
+                for (size_t i = 0; i < propCount; i++) {
+
+                    if (IsBoxVisible(visibility, i)) {
+
+                        hidden[i] = buffer.isBoxOccluded(viewProjection, propMinimum[i], propMaximum[i]);
+                        tests++;
+                    }
+                }
+            }
+            testMs += ElapsedMs(start);
+
+            for (size_t i = 0; i < propCount; i++) {
+
+                if (!IsBoxVisible(visibility, i)) {
+                    continue;
+                }
+
+                inFrustum++;
+                if (!hidden[i]) {
+                    continue;
+                }
+                occluded++;
+
+                // a 3 x 3 x 3 lattice over the box, the points on its surface that are on screen
+                bool reached = false;
+                for (int k = 0; k < 27 && !reached; k++) {
+
+                    glm::vec3 weight(k % 3 * 0.5f, k / 3 % 3 * 0.5f, k / 9 * 0.5f);
+                    if (k == 13) {
+                        continue;
+                    }
+
+                    glm::vec3 point = propMinimum[i] + (propMaximum[i] - propMinimum[i]) * weight;
+                    glm::vec4 clip = viewProjection * glm::vec4(point, 1.0f);
+                    if (clip.w <= 0.0f || fabsf(clip.x) > clip.w || fabsf(clip.y) > clip.w || fabsf(clip.z) > clip.w) {
+                        continue;
+                    }
+
+                    BvhHit hit;
+                    reached = !occluderBvh.raycast(eye, point - eye, 0.999f, hit);
+                }
+                wrongCulls += reached;
+            }
+        }
+
+        std::cout << "Occluders      : " << occluders.size() / 3 << " triangles, " << buffer.getWidth() << " x " << buffer.getHeight() << " depth buffer" << std::endl;
+        std::cout << "Rasterize      : " << rasterizeMs / (repetitions * 8) << " ms per frame" << std::endl;
+        std::cout << "Box test       : " << testMs * 1e6 / tests << " ns per box" << std::endl;
+        std::cout << "Props          : " << inFrustum / 8 << " in the frustum per view, " << 100.0 * occluded / std::max(inFrustum, (size_t)1) << "% occluded" << std::endl;
+        std::cout << "Wrong culls    : " << wrongCulls << std::endl;
+
+        return wrongCulls == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Average time a frame of 100k keys may take to sort, far more draws than a scene of this size issues
+    static const double SORT_BUDGET_MS = 5.0;
+
+    static bool CompareRenderKeys(const RenderKey& a, const RenderKey& b) {
+
+        return a.key < b.key;
+    }
+
+    int RunSortBenchmark() {
+
+        // a fixed seed so runs are comparable: a camera pass and four cascades, a few programs, a few thousand
+        // texture sets, a tenth of the meshes transparent
+        const size_t keyCount = 100000;
+        const int frames = 100;
+        std::mt19937 random(1234);
+        std::uniform_int_distribution<unsigned> pass(0, 4);
+        std::uniform_int_distribution<unsigned> shader(1, 8);
+        std::uniform_int_distribution<unsigned> material(0, 0xFFFFFF);
+        std::uniform_int_distribution<int> layer(0, 9);
+        std::uniform_real_distribution<float> depth(0.1f, 1000.0f);
+
+        std::vector<RenderKey> frameKeys(keyCount);
+        for (size_t i = 0; i < keyCount; i++) {
+
+            RENDER_LAYER keyLayer = layer(random) == 0 ? RENDER_TRANSPARENT : RENDER_OPAQUE;
+            frameKeys[i].key = MakeRenderKey(pass(random), keyLayer, shader(random), material(random), depth(random));
+            frameKeys[i].item = (uint32_t)i;
+        }
+
+        std::vector<RenderKey> keys;
+        std::vector<RenderKey> scratch;
+        double radixMs = 0.0;
+        double worstMs = 0.0;
+        for (int frame = 0; frame < frames; frame++) {
+
+            keys = frameKeys;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            RadixSortKeys(keys, scratch);
+            double frameMs = ElapsedMs(start);
+            radixMs += frameMs;
+            worstMs = std::max(worstMs, frameMs);
+        }
+
+        std::vector<RenderKey> reference;
+        double comparisonMs = 0.0;
+        for (int frame = 0; frame < frames; frame++) {
+
+            reference = frameKeys;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::sort(reference.begin(), reference.end(), CompareRenderKeys);
+            comparisonMs += ElapsedMs(start);
+        }
+
+        // equal keys must keep their submission order, like a stable sort
+        reference = frameKeys;
+        std::stable_sort(reference.begin(), reference.end(), CompareRenderKeys);
+        size_t mismatches = 0;
+        for (size_t i = 0; i < keyCount; i++) {
+            mismatches += keys[i].key != reference[i].key || keys[i].item != reference[i].item;
+        }
+
+        std::cout << "Keys           : " << keyCount << " per frame" << std::endl;
+        std::cout << "Radix sort     : " << radixMs / frames << " ms per frame, " << worstMs << " ms worst" << std::endl;
+        std::cout << "std::sort      : " << comparisonMs / frames << " ms per frame" << std::endl;
+        std::cout << "Mismatches     : " << mismatches << std::endl;
+
+        return mismatches == 0 && radixMs / frames <= SORT_BUDGET_MS ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+}
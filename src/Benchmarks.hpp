@@ -0,0 +1,41 @@
+#ifndef Benchmarks_hpp
+#define Benchmarks_hpp
+
+#include <string>
+
+namespace gps {
+
+    // CPU-only benchmarks, started from the command line before any window is created.
+    // Each returns EXIT_SUCCESS when the measured result meets its target.
+
+    // --bench-load <file.obj> : the cold load (tinyobj parse + welding, optimizer, LOD chains, meshlets, each
+    // timed on its own) versus the mapped mesh cache; fails below a 10x speedup
+    int RunLoadBenchmark(std::string fileName);
+
+    // --bench-optimize <file.obj> : per-mesh ACMR/ATVR before and after the mesh optimizer,
+    // fails if the overall ACMR gets worse by more than the overdraw reordering may trade
+    int RunOptimizeBenchmark(std::string fileName);
+
+    // --bench-lod <file.obj> : LOD chain build time, triangles and error per level, and the triangles
+    // drawn from a 1080p camera backing away from the model; fails if a level is not coarser than the one before
+    int RunLodBenchmark(std::string fileName);
+
+    // --bench-clusters <file.obj> : meshlets culled by the frustum, backface cone and pixel grid tests from
+    // eight views around the model, with 1 and 4 samples per pixel; fails if a culled meshlet held a triangle
+    // that could have been visible
+    int RunClusterBenchmark(std::string fileName);
+
+    // --bench-culling : meshes per microsecond through the SIMD frustum tester for a synthetic scene of
+    // random boxes seen from several directions; fails if its bitmask differs from the scalar reference
+    int RunCullingBenchmark();
+
+    // --bench-occlusion : occluder rasterization time, box test cost and the share of props hidden behind the
+    // houses of a synthetic town, seen from eight street corners; fails if a ray reaches a culled prop unobstructed
+    int RunOcclusionBenchmark();
+
+    // --bench-sort : radix sort time of 100k render keys per frame against std::sort; fails if the order differs
+    // from a stable comparison sort or a frame takes more than its budget
+    int RunSortBenchmark();
+}
+
+#endif /* Benchmarks_hpp */
@@ -0,0 +1,629 @@
+#include "Bvh.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <future>
+
+namespace gps {
+
+    typedef std::vector<BvhNode, AlignedAllocator<BvhNode, 64> > BvhNodeArray;
+
+    // Primitive boxes and centroids shared by every subtree build
+    struct BvhBuildInput {
+
+        const glm::vec3* minimum;
+        const glm::vec3* maximum;
+        std::vector<glm::vec3> centroids;
+    };
+
+    // A range left to a pool task by the top levels of the build
+    struct BvhSubtree {
+
+        size_t begin;
+        size_t end;
+        size_t node;
+        BvhNodeArray nodes;
+    };
+
+    static float SurfaceArea(glm::vec3 minimum, glm::vec3 maximum) {
+
+        glm::vec3 size = glm::max(maximum - minimum, glm::vec3(0.0f));
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    // Position in [begin, end) where the range is split in two, or end if it should stay a leaf.
+    // Primitives are partitioned around the returned position.
+    static size_t SplitRange(const BvhBuildInput& input, GLuint* primitives, size_t begin, size_t end, const BvhNode& node,
+                             glm::vec3 centroidMinimum, glm::vec3 centroidMaximum) {
+
+        size_t count = end - begin;
+        if (count <= 1) {
+            return end;
+        }
+
+        // one pass sorts every primitive into its bin on all three axes
+        glm::vec3 extent = centroidMaximum - centroidMinimum;
+        glm::vec3 scale;
+        for (int axis = 0; axis < 3; axis++) {
+            scale[axis] = extent[axis] > 0.0f ? BVH_SAH_BINS / extent[axis] : 0.0f;
+        }
+
+        size_t binCount[3][BVH_SAH_BINS] = {};
+        glm::vec3 binMinimum[3][BVH_SAH_BINS];
+        glm::vec3 binMaximum[3][BVH_SAH_BINS];
+        for (int axis = 0; axis < 3; axis++) {
+            for (int b = 0; b < BVH_SAH_BINS; b++) {
+
+                binMinimum[axis][b] = glm::vec3(FLT_MAX);
+                binMaximum[axis][b] = glm::vec3(-FLT_MAX);
+            }
+        }
+
+        for (size_t i = begin; i < end; i++) {
+
+            GLuint primitive = primitives[i];
+            glm::vec3 minimum = input.minimum[primitive];
+            glm::vec3 maximum = input.maximum[primitive];
+            glm::vec3 centroid = input.centroids[primitive];
+            for (int axis = 0; axis < 3; axis++) {
+
+                int bin = std::min((int)((centroid[axis] - centroidMinimum[axis]) * scale[axis]), BVH_SAH_BINS - 1);
+                binCount[axis][bin]++;
+                binMinimum[axis][bin] = glm::min(binMinimum[axis][bin], minimum);
+                binMaximum[axis][bin] = glm::max(binMaximum[axis][bin], maximum);
+            }
+        }
+
+        // cost of a leaf and of a split relative to one primitive test, traversing a node costs as much as a test
+        float parentArea = SurfaceArea(node.minimum, node.maximum);
+        float bestCost = FLT_MAX;
+        int bestAxis = -1;
+        int bestBin = 0;
+
+        for (int axis = 0; axis < 3; axis++) {
+
+            if (extent[axis] <= 0.0f) {
+                continue;
+            }
+
+            // areas and counts left of each plane in one sweep, right of it in a second
+            float leftArea[BVH_SAH_BINS - 1];
+            size_t leftCount[BVH_SAH_BINS - 1];
+            glm::vec3 minimum(FLT_MAX);
+            glm::vec3 maximum(-FLT_MAX);
+            size_t sum = 0;
+            for (int b = 0; b < BVH_SAH_BINS - 1; b++) {
+
+                minimum = glm::min(minimum, binMinimum[axis][b]);
+                maximum = glm::max(maximum, binMaximum[axis][b]);
+                sum += binCount[axis][b];
+                leftArea[b] = SurfaceArea(minimum, maximum);
+                leftCount[b] = sum;
+            }
+
+            minimum = glm::vec3(FLT_MAX);
+            maximum = glm::vec3(-FLT_MAX);
+            sum = 0;
+            for (int b = BVH_SAH_BINS - 1; b > 0; b--) {
+
+                minimum = glm::min(minimum, binMinimum[axis][b]);
+                maximum = glm::max(maximum, binMaximum[axis][b]);
+                sum += binCount[axis][b];
+                if (leftCount[b - 1] == 0 || sum == 0) {
+                    continue;
+                }
+
+                float cost = 1.0f + (leftArea[b - 1] * leftCount[b - 1] + SurfaceArea(minimum, maximum) * sum) / std::max(parentArea, FLT_MIN);
+                if (cost < bestCost) {
+
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+
+        if (count <= BVH_MAX_LEAF_PRIMITIVES && bestCost >= (float)count) {
+            return end;
+        }
+
+        if (bestAxis < 0) {
+
+            // every centroid coincides, only an arbitrary split keeps large leaves down
+            return count <= BVH_MAX_LEAF_PRIMITIVES ? end : begin + count / 2;
+        }
+
+        float low = centroidMinimum[bestAxis];
+        float axisScale = scale[bestAxis];
+        GLuint* middle = std::partition(primitives + begin, primitives + end, [&](GLuint primitive) {
+            return std::min((int)((input.centroids[primitive][bestAxis] - low) * axisScale), BVH_SAH_BINS - 1) < bestBin;
+        });
+
+        return middle - primitives;
+    }
+
+    // Builds the subtree over primitives [begin, end) into nodes[nodeIndex], appending child pairs to nodes.
+    // With subtrees set, ranges of at most parallelSize primitives are left to the caller instead.
+    static void BuildNode(const BvhBuildInput& input, GLuint* primitives, size_t begin, size_t end, BvhNodeArray& nodes, size_t nodeIndex,
+                          std::vector<BvhSubtree>* subtrees, size_t parallelSize) {
+
+        BvhNode node;
+        node.minimum = glm::vec3(FLT_MAX);
+        node.maximum = glm::vec3(-FLT_MAX);
+        glm::vec3 centroidMinimum(FLT_MAX);
+        glm::vec3 centroidMaximum(-FLT_MAX);
+        for (size_t i = begin; i < end; i++) {
+
+            node.minimum = glm::min(node.minimum, input.minimum[primitives[i]]);
+            node.maximum = glm::max(node.maximum, input.maximum[primitives[i]]);
+            centroidMinimum = glm::min(centroidMinimum, input.centroids[primitives[i]]);
+            centroidMaximum = glm::max(centroidMaximum, input.centroids[primitives[i]]);
+        }
+        node.first = (GLuint)begin;
+        node.count = (GLuint)(end - begin);
+
+        if (subtrees != NULL && end - begin <= parallelSize) {
+
+            BvhSubtree subtree;
+            subtree.begin = begin;
+            subtree.end = end;
+            subtree.node = nodeIndex;
+            subtrees->push_back(std::move(subtree));
+            nodes[nodeIndex] = node;
+            return;
+        }
+
+        size_t middle = SplitRange(input, primitives, begin, end, node, centroidMinimum, centroidMaximum);
+        if (middle == end) {
+
+            nodes[nodeIndex] = node;
+            return;
+        }
+
+        size_t left = nodes.size();
+        node.first = (GLuint)left;
+        node.count = 0;
+        nodes[nodeIndex] = node;
+        nodes.resize(left + 2);
+
+        BuildNode(input, primitives, begin, middle, nodes, left, subtrees, parallelSize);
+        BuildNode(input, primitives, middle, end, nodes, left + 1, subtrees, parallelSize);
+    }
+
+    void Bvh::build(const std::vector<Bounds>& bounds) {
+
+        this->triangles.clear();
+        this->primitiveMinimum.resize(bounds.size());
+        this->primitiveMaximum.resize(bounds.size());
+        for (size_t i = 0; i < bounds.size(); i++) {
+
+            this->primitiveMinimum[i] = bounds[i].minimum;
+            this->primitiveMaximum[i] = bounds[i].maximum;
+        }
+
+        buildNodes();
+    }
+
+    void Bvh::buildTriangles(const std::vector<glm::vec3>& corners) {
+
+        size_t triangleCount = corners.size() / 3;
+        this->triangles.assign(corners.begin(), corners.begin() + triangleCount * 3);
+        this->primitiveMinimum.resize(triangleCount);
+        this->primitiveMaximum.resize(triangleCount);
+        for (size_t i = 0; i < triangleCount; i++) {
+
+            this->primitiveMinimum[i] = glm::min(corners[i * 3], glm::min(corners[i * 3 + 1], corners[i * 3 + 2]));
+            this->primitiveMaximum[i] = glm::max(corners[i * 3], glm::max(corners[i * 3 + 1], corners[i * 3 + 2]));
+        }
+
+        buildNodes();
+    }
+
+    void Bvh::buildNodes() {
+
+        size_t count = this->primitiveMinimum.size();
+        this->nodes.clear();
+        this->primitives.resize(count);
+        if (count == 0) {
+            return;
+        }
+
+        BvhBuildInput input;
+        input.minimum = this->primitiveMinimum.data();
+        input.maximum = this->primitiveMaximum.data();
+        input.centroids.resize(count);
+        for (size_t i = 0; i < count; i++) {
+
+            input.centroids[i] = (this->primitiveMinimum[i] + this->primitiveMaximum[i]) * 0.5f;
+            this->primitives[i] = (GLuint)i;
+        }
+
+        // the root is followed by an unused node, so every pair of children starts on an even index
+        this->nodes.resize(2, BvhNode());
+
+        ThreadPool& pool = ThreadPool::GetShared();
+        if (count < BVH_PARALLEL_PRIMITIVES * 2 || pool.getThreadCount() < 2) {
+
+            BuildNode(input, this->primitives.data(), 0, count, this->nodes, 0, NULL, 0);
+            return;
+        }
+
+        // the top levels split the primitives into a few subtrees per worker, each then built on its own
+        std::vector<BvhSubtree> subtrees;
+        size_t parallelSize = std::max(BVH_PARALLEL_PRIMITIVES, count / (pool.getThreadCount() * 4));
+        BuildNode(input, this->primitives.data(), 0, count, this->nodes, 0, &subtrees, parallelSize);
+
+        std::vector<std::future<void> > pending;
+        for (size_t s = 0; s < subtrees.size(); s++) {
+
+            BvhSubtree* subtree = &subtrees[s];
+            GLuint* primitives = this->primitives.data();
+            const BvhBuildInput* shared = &input;
+            pending.push_back(pool.submit([subtree, primitives, shared]() {
+
+                subtree->nodes.resize(2, BvhNode());
+                BuildNode(*shared, primitives, subtree->begin, subtree->end, subtree->nodes, 0, NULL, 0);
+            }));
+        }
+
+        for (size_t s = 0; s < subtrees.size(); s++) {
+
+            pending[s].get();
+
+            // the subtree's root replaces its placeholder, its other nodes are appended past the padding node
+            BvhSubtree& subtree = subtrees[s];
+            size_t offset = this->nodes.size() - 2;
+            for (size_t i = 0; i < subtree.nodes.size(); i++) {
+
+                if (i == 1) {
+                    continue;
+                }
+
+                BvhNode node = subtree.nodes[i];
+                if (node.count == 0) {
+                    node.first += (GLuint)offset;
+                }
+
+                if (i == 0) {
+                    this->nodes[subtree.node] = node;
+                }
+                else {
+                    this->nodes.push_back(node);
+                }
+            }
+        }
+    }
+
+    void Bvh::updatePrimitive(GLuint primitive, const Bounds& bounds) {
+
+        this->primitiveMinimum[primitive] = bounds.minimum;
+        this->primitiveMaximum[primitive] = bounds.maximum;
+    }
+
+    void Bvh::refit() {
+
+        // children are always stored after their parent
+        for (size_t i = this->nodes.size(); i-- > 0; ) {
+
+            if (i == 1) {
+                continue;
+            }
+
+            BvhNode& node = this->nodes[i];
+            if (node.count > 0) {
+
+                node.minimum = glm::vec3(FLT_MAX);
+                node.maximum = glm::vec3(-FLT_MAX);
+                for (GLuint p = node.first; p < node.first + node.count; p++) {
+
+                    node.minimum = glm::min(node.minimum, this->primitiveMinimum[this->primitives[p]]);
+                    node.maximum = glm::max(node.maximum, this->primitiveMaximum[this->primitives[p]]);
+                }
+            }
+            else {
+
+                node.minimum = glm::min(this->nodes[node.first].minimum, this->nodes[node.first + 1].minimum);
+                node.maximum = glm::max(this->nodes[node.first].maximum, this->nodes[node.first + 1].maximum);
+            }
+        }
+    }
+
+    void Bvh::appendSubtree(GLuint node, std::vector<GLuint>& result) const {
+
+        const BvhNode& current = this->nodes[node];
+        if (current.count > 0) {
+
+            result.insert(result.end(), this->primitives.begin() + current.first, this->primitives.begin() + current.first + current.count);
+            return;
+        }
+
+        appendSubtree(current.first, result);
+        appendSubtree(current.first + 1, result);
+    }
+
+    // True if the box is entirely outside one of the planes in planeMask, otherwise clears the bits
+    // of the planes it is entirely inside of
+    static bool ClassifyBox(glm::vec3 minimum, glm::vec3 maximum, const glm::vec4 planes[6], int& planeMask) {
+
+        glm::vec3 center = (minimum + maximum) * 0.5f;
+        glm::vec3 extent = (maximum - minimum) * 0.5f;
+
+        for (int p = 0; p < 6; p++) {
+
+            if ((planeMask & (1 << p)) == 0) {
+                continue;
+            }
+
+            glm::vec3 normal = glm::vec3(planes[p]);
+            float distance = glm::dot(normal, center) + planes[p].w;
+            float radius = glm::dot(glm::abs(normal), extent);
+            if (distance + radius < 0.0f) {
+                return true;
+            }
+            if (distance - radius >= 0.0f) {
+                planeMask &= ~(1 << p);
+            }
+        }
+
+        return false;
+    }
+
+    void Bvh::queryFrustum(const glm::vec4 planes[6], std::vector<GLuint>& result) const {
+
+        if (this->nodes.empty()) {
+            return;
+        }
+
+        // each entry carries the planes its box still straddles, boxes inside all of them skip the tests below
+        std::vector<std::pair<GLuint, int> > stack;
+        stack.reserve(64);
+        stack.push_back(std::make_pair(0u, 0x3f));
+
+        while (!stack.empty()) {
+
+            GLuint index = stack.back().first;
+            int planeMask = stack.back().second;
+            stack.pop_back();
+
+            const BvhNode& node = this->nodes[index];
+            if (ClassifyBox(node.minimum, node.maximum, planes, planeMask)) {
+                continue;
+            }
+
+            if (planeMask == 0) {
+
+                appendSubtree(index, result);
+                continue;
+            }
+
+            if (node.count > 0) {
+
+                for (GLuint p = node.first; p < node.first + node.count; p++) {
+
+                    GLuint primitive = this->primitives[p];
+                    int primitiveMask = planeMask;
+                    if (!ClassifyBox(this->primitiveMinimum[primitive], this->primitiveMaximum[primitive], planes, primitiveMask)) {
+                        result.push_back(primitive);
+                    }
+                }
+                continue;
+            }
+
+            stack.push_back(std::make_pair(node.first, planeMask));
+            stack.push_back(std::make_pair(node.first + 1, planeMask));
+        }
+    }
+
+    // Distance at which the ray enters the box, false if it misses it before maxDistance
+    static bool IntersectBox(glm::vec3 minimum, glm::vec3 maximum, glm::vec3 origin, glm::vec3 inverseDirection, float maxDistance, float& entry) {
+
+        glm::vec3 t0 = (minimum - origin) * inverseDirection;
+        glm::vec3 t1 = (maximum - origin) * inverseDirection;
+        glm::vec3 entries = glm::min(t0, t1);
+        glm::vec3 exits = glm::max(t0, t1);
+
+        entry = std::max(std::max(entries.x, entries.y), std::max(entries.z, 0.0f));
+        float exit = std::min(std::min(exits.x, exits.y), std::min(exits.z, maxDistance));
+        return entry <= exit;
+    }
+
+    // Moller-Trumbore, false if the ray misses the triangle before maxDistance
+    static bool IntersectTriangle(const glm::vec3* corners, glm::vec3 origin, glm::vec3 direction, float maxDistance, float& distance) {
+
+        glm::vec3 edge1 = corners[1] - corners[0];
+        glm::vec3 edge2 = corners[2] - corners[0];
+        glm::vec3 p = glm::cross(direction, edge2);
+        float determinant = glm::dot(edge1, p);
+        if (fabsf(determinant) < 1e-12f) {
+            return false;
+        }
+
+        float inverse = 1.0f / determinant;
+        glm::vec3 toOrigin = origin - corners[0];
+        float u = glm::dot(toOrigin, p) * inverse;
+        if (u < 0.0f || u > 1.0f) {
+            return false;
+        }
+
+        glm::vec3 q = glm::cross(toOrigin, edge1);
+        float v = glm::dot(direction, q) * inverse;
+        if (v < 0.0f || u + v > 1.0f) {
+            return false;
+        }
+
+        distance = glm::dot(edge2, q) * inverse;
+        return distance >= 0.0f && distance <= maxDistance;
+    }
+
+    bool Bvh::raycast(glm::vec3 origin, glm::vec3 direction, float maxDistance, BvhHit& hit) const {
+
+        if (this->nodes.empty()) {
+            return false;
+        }
+
+        glm::vec3 inverseDirection = 1.0f / direction;
+        float closest = maxDistance;
+        bool found = false;
+
+        float entry;
+        if (!IntersectBox(this->nodes[0].minimum, this->nodes[0].maximum, origin, inverseDirection, closest, entry)) {
+            return false;
+        }
+
+        std::vector<std::pair<GLuint, float> > stack;
+        stack.reserve(64);
+        stack.push_back(std::make_pair(0u, entry));
+
+        while (!stack.empty()) {
+
+            GLuint index = stack.back().first;
+            float nodeEntry = stack.back().second;
+            stack.pop_back();
+
+            // a closer hit was found since the node was queued
+            if (nodeEntry > closest) {
+                continue;
+            }
+
+            const BvhNode& node = this->nodes[index];
+            if (node.count > 0) {
+
+                for (GLuint p = node.first; p < node.first + node.count; p++) {
+
+                    GLuint primitive = this->primitives[p];
+                    float distance;
+                    bool isHit = this->triangles.empty()
+                        ? IntersectBox(this->primitiveMinimum[primitive], this->primitiveMaximum[primitive], origin, inverseDirection, closest, distance)
+                        : IntersectTriangle(&this->triangles[primitive * 3], origin, direction, closest, distance);
+
+                    if (isHit && distance <= closest) {
+
+                        closest = distance;
+                        hit.distance = distance;
+                        hit.primitive = primitive;
+                        found = true;
+                    }
+                }
+                continue;
+            }
+
+            // the nearer child goes on top of the stack
+            float leftEntry, rightEntry;
+            bool hitsLeft = IntersectBox(this->nodes[node.first].minimum, this->nodes[node.first].maximum, origin, inverseDirection, closest, leftEntry);
+            bool hitsRight = IntersectBox(this->nodes[node.first + 1].minimum, this->nodes[node.first + 1].maximum, origin, inverseDirection, closest, rightEntry);
+
+            if (hitsLeft && hitsRight) {
+
+                if (leftEntry < rightEntry) {
+
+                    stack.push_back(std::make_pair(node.first + 1, rightEntry));
+                    stack.push_back(std::make_pair(node.first, leftEntry));
+                }
+                else {
+
+                    stack.push_back(std::make_pair(node.first, leftEntry));
+                    stack.push_back(std::make_pair(node.first + 1, rightEntry));
+                }
+            }
+            else if (hitsLeft) {
+                stack.push_back(std::make_pair(node.first, leftEntry));
+            }
+            else if (hitsRight) {
+                stack.push_back(std::make_pair(node.first + 1, rightEntry));
+            }
+        }
+
+        return found;
+    }
+
+    void Bvh::querySphere(glm::vec3 center, float radius, std::vector<GLuint>& result) const {
+
+        if (this->nodes.empty()) {
+            return;
+        }
+
+        std::vector<GLuint> stack(1, 0);
+        while (!stack.empty()) {
+
+            GLuint index = stack.back();
+            stack.pop_back();
+
+            const BvhNode& node = this->nodes[index];
+            glm::vec3 closest = glm::clamp(center, node.minimum, node.maximum);
+            if (glm::dot(closest - center, closest - center) > radius * radius) {
+                continue;
+            }
+
+            if (node.count > 0) {
+
+                for (GLuint p = node.first; p < node.first + node.count; p++) {
+
+                    GLuint primitive = this->primitives[p];
+                    closest = glm::clamp(center, this->primitiveMinimum[primitive], this->primitiveMaximum[primitive]);
+                    if (glm::dot(closest - center, closest - center) <= radius * radius) {
+                        result.push_back(primitive);
+                    }
+                }
+                continue;
+            }
+
+            stack.push_back(node.first);
+            stack.push_back(node.first + 1);
+        }
+    }
+
+    static bool BoxesOverlap(glm::vec3 minimum, glm::vec3 maximum, glm::vec3 otherMinimum, glm::vec3 otherMaximum) {
+
+        return minimum.x <= otherMaximum.x && minimum.y <= otherMaximum.y && minimum.z <= otherMaximum.z &&
+               otherMinimum.x <= maximum.x && otherMinimum.y <= maximum.y && otherMinimum.z <= maximum.z;
+    }
+
+    void Bvh::queryBox(glm::vec3 minimum, glm::vec3 maximum, std::vector<GLuint>& result) const {
+
+        if (this->nodes.empty()) {
+            return;
+        }
+
+        std::vector<GLuint> stack(1, 0);
+        while (!stack.empty()) {
+
+            GLuint index = stack.back();
+            stack.pop_back();
+
+            const BvhNode& node = this->nodes[index];
+            if (!BoxesOverlap(minimum, maximum, node.minimum, node.maximum)) {
+                continue;
+            }
+
+            if (node.count > 0) {
+
+                for (GLuint p = node.first; p < node.first + node.count; p++) {
+
+                    GLuint primitive = this->primitives[p];
+                    if (BoxesOverlap(minimum, maximum, this->primitiveMinimum[primitive], this->primitiveMaximum[primitive])) {
+                        result.push_back(primitive);
+                    }
+                }
+                continue;
+            }
+
+            stack.push_back(node.first);
+            stack.push_back(node.first + 1);
+        }
+    }
+
+    bool Bvh::empty() const {
+        return this->nodes.empty();
+    }
+
+    size_t Bvh::getNodeCount() const {
+        // without the padding node after the root
+        return this->nodes.empty() ? 0 : this->nodes.size() - 1;
+    }
+
+    size_t Bvh::getPrimitiveCount() const {
+        return this->primitiveMinimum.size();
+    }
+}
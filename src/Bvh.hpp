@@ -0,0 +1,129 @@
+#ifndef Bvh_hpp
+#define Bvh_hpp
+
+#include "Mesh.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+namespace gps {
+
+    // 32 bytes, the two children of a node sit next to each other in one 64 byte cache line
+    struct alignas(32) BvhNode {
+
+        glm::vec3 minimum;
+        // leaf: first entry of its primitives in the primitive list, inner node: index of the left child,
+        // the right child follows it
+        GLuint first;
+        glm::vec3 maximum;
+        // primitives in a leaf, 0 for inner nodes
+        GLuint count;
+    };
+
+    struct BvhHit {
+
+        // along the ray, in units of its direction
+        float distance;
+        GLuint primitive;
+    };
+
+    // Leaves hold at most this many primitives, unless their centroids all coincide
+    static const size_t BVH_MAX_LEAF_PRIMITIVES = 4;
+    // Candidate split planes per axis for the surface area heuristic
+    static const int BVH_SAH_BINS = 12;
+    // Subtrees over fewer primitives are built on the thread that reaches them
+    static const size_t BVH_PARALLEL_PRIMITIVES = 4096;
+
+    // Hands out storage aligned to Alignment bytes, for element types the default allocator does not align before C++17
+    template <typename T, size_t Alignment>
+    class AlignedAllocator {
+
+    public:
+        typedef T value_type;
+
+        template <typename U>
+        struct rebind {
+            typedef AlignedAllocator<U, Alignment> other;
+        };
+
+        AlignedAllocator() {}
+
+        template <typename U>
+        AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+        T* allocate(size_t count) {
+
+            // the block returned by operator new is kept just before the aligned pointer
+            char* block = (char*)::operator new(count * sizeof(T) + Alignment + sizeof(void*));
+            uintptr_t aligned = ((uintptr_t)(block + sizeof(void*)) + Alignment - 1) & ~(uintptr_t)(Alignment - 1);
+            ((void**)aligned)[-1] = block;
+            return (T*)aligned;
+        }
+
+        void deallocate(T* pointer, size_t) {
+
+            ::operator delete(((void**)pointer)[-1]);
+        }
+
+        template <typename U>
+        bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+
+        template <typename U>
+        bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+    };
+
+    // Bounding volume hierarchy over boxes (meshes, objects) or triangles, stored depth first in one flat
+    // node array. Built with the binned surface area heuristic; the subtrees below the top levels are built
+    // in parallel on the shared ThreadPool, so build must not be called from a pool task.
+    class Bvh {
+
+    public:
+        // One primitive per box, queries return indices into bounds
+        void build(const std::vector<Bounds>& bounds);
+
+        // One primitive per three corners, ray casts then hit the triangles instead of their boxes
+        void buildTriangles(const std::vector<glm::vec3>& corners);
+
+        // Moves a primitive of a BVH made by build, call refit once every moved primitive is updated
+        void updatePrimitive(GLuint primitive, const Bounds& bounds);
+
+        // Recomputes the node boxes bottom up in one pass over the nodes, keeping the tree as built.
+        // Queries stay exact, but they slow down as primitives move far from where they were at build time.
+        void refit();
+
+        // Appends the primitives whose boxes are not entirely outside one of the planes (normals pointing inside)
+        void queryFrustum(const glm::vec4 planes[6], std::vector<GLuint>& result) const;
+
+        // Closest primitive hit within maxDistance, returns false if there is none
+        bool raycast(glm::vec3 origin, glm::vec3 direction, float maxDistance, BvhHit& hit) const;
+
+        // Appends the primitives whose boxes overlap the sphere or box
+        void querySphere(glm::vec3 center, float radius, std::vector<GLuint>& result) const;
+        void queryBox(glm::vec3 minimum, glm::vec3 maximum, std::vector<GLuint>& result) const;
+
+        bool empty() const;
+
+        size_t getNodeCount() const;
+
+        size_t getPrimitiveCount() const;
+
+    private:
+        std::vector<BvhNode, AlignedAllocator<BvhNode, 64> > nodes;
+        // primitive indices in leaf order
+        std::vector<GLuint> primitives;
+        std::vector<glm::vec3> primitiveMinimum;
+        std::vector<glm::vec3> primitiveMaximum;
+        // three corners per primitive, only for buildTriangles
+        std::vector<glm::vec3> triangles;
+
+        // Builds the nodes over primitiveMinimum/primitiveMaximum
+        void buildNodes();
+
+        // Appends every primitive below a node
+        void appendSubtree(GLuint node, std::vector<GLuint>& result) const;
+    };
+}
+
+#endif /* Bvh_hpp */
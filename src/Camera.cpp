@@ -17,6 +17,14 @@ namespace gps {
         return glm::lookAt(cameraPosition, cameraTarget, this->cameraUpDirection);
     }
 
+    glm::vec3 Camera::getPosition() {
+        return this->cameraPosition;
+    }
+
+    glm::vec3 Camera::getFrontDirection() {
+        return this->cameraFrontDirection;
+    }
+
     //update the camera internal parameters following a camera move event
     void Camera::move(MOVE_DIRECTION direction, float speed) 
     {
@@ -0,0 +1,192 @@
+#include "FrustumCulling.hpp"
+
+#include <cmath>
+
+#if defined (__AVX__)
+    #include <immintrin.h>
+    #define FRUSTUM_CULLING_AVX
+#elif defined (__SSE__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 1)
+    #include <xmmintrin.h>
+    #define FRUSTUM_CULLING_SSE
+#endif
+
+namespace gps {
+
+    void BoundingBoxes::add(glm::vec3 minimum, glm::vec3 maximum) {
+
+        glm::vec3 center = (minimum + maximum) * 0.5f;
+        glm::vec3 extent = (maximum - minimum) * 0.5f;
+
+        centerX.push_back(center.x);
+        centerY.push_back(center.y);
+        centerZ.push_back(center.z);
+        extentX.push_back(extent.x);
+        extentY.push_back(extent.y);
+        extentZ.push_back(extent.z);
+    }
+
+    void BoundingBoxes::clear() {
+
+        centerX.clear();
+        centerY.clear();
+        centerZ.clear();
+        extentX.clear();
+        extentY.clear();
+        extentZ.clear();
+    }
+
+    size_t BoundingBoxes::size() const {
+
+        return centerX.size();
+    }
+
+    void TransformPlanes(const glm::vec4 planes[6], glm::mat4 model, glm::vec4 result[6]) {
+
+        // a point p is in front of plane n when dot(n, model * p) >= 0, that is dot(transpose(model) * n, p) >= 0
+        glm::mat4 transposed = glm::transpose(model);
+        for (int i = 0; i < 6; i++) {
+            result[i] = transposed * planes[i];
+        }
+    }
+
+    // A box is outside a plane when even its corner furthest along the normal is behind it,
+    // that corner is center + sign(normal) * extent
+    static bool IsBoxOutside(const BoundingBoxes& boxes, size_t i, const glm::vec4 planes[6]) {
+
+        for (int p = 0; p < 6; p++) {
+
+            // summed in the same order as the SSE and AVX paths, so every path yields the same mask bit for bit
+            float distance = (planes[p].x * boxes.centerX[i] + planes[p].y * boxes.centerY[i]) + (planes[p].z * boxes.centerZ[i] + planes[p].w);
+            float radius = fabsf(planes[p].x) * boxes.extentX[i] + fabsf(planes[p].y) * boxes.extentY[i] + fabsf(planes[p].z) * boxes.extentZ[i];
+            if (distance + radius < 0.0f) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    static void CullBoxesRange(const BoundingBoxes& boxes, size_t begin, const glm::vec4 planes[6], std::vector<GLuint>& visibility) {
+
+        for (size_t i = begin; i < boxes.size(); i++) {
+
+            if (!IsBoxOutside(boxes, i, planes)) {
+                visibility[i / 32] |= 1u << (i % 32);
+            }
+        }
+    }
+
+    static void ResetVisibility(const BoundingBoxes& boxes, std::vector<GLuint>& visibility) {
+
+        visibility.assign((boxes.size() + 31) / 32, 0);
+    }
+
+    void CullBoxesScalar(const BoundingBoxes& boxes, const glm::vec4 planes[6], std::vector<GLuint>& visibility) {
+
+        ResetVisibility(boxes, visibility);
+        CullBoxesRange(boxes, 0, planes, visibility);
+    }
+
+#if defined (FRUSTUM_CULLING_AVX)
+
+    void CullBoxes(const BoundingBoxes& boxes, const glm::vec4 planes[6], std::vector<GLuint>& visibility) {
+
+        ResetVisibility(boxes, visibility);
+
+        // the plane coefficients broadcast once, the boxes vary across lanes
+        __m256 normalX[6], normalY[6], normalZ[6], normalW[6];
+        __m256 absX[6], absY[6], absZ[6];
+        for (int p = 0; p < 6; p++) {
+
+            normalX[p] = _mm256_set1_ps(planes[p].x);
+            normalY[p] = _mm256_set1_ps(planes[p].y);
+            normalZ[p] = _mm256_set1_ps(planes[p].z);
+            normalW[p] = _mm256_set1_ps(planes[p].w);
+            absX[p] = _mm256_set1_ps(fabsf(planes[p].x));
+            absY[p] = _mm256_set1_ps(fabsf(planes[p].y));
+            absZ[p] = _mm256_set1_ps(fabsf(planes[p].z));
+        }
+
+        size_t i = 0;
+        for (; i + 8 <= boxes.size(); i += 8) {
+
+            __m256 cx = _mm256_loadu_ps(&boxes.centerX[i]);
+            __m256 cy = _mm256_loadu_ps(&boxes.centerY[i]);
+            __m256 cz = _mm256_loadu_ps(&boxes.centerZ[i]);
+            __m256 ex = _mm256_loadu_ps(&boxes.extentX[i]);
+            __m256 ey = _mm256_loadu_ps(&boxes.extentY[i]);
+            __m256 ez = _mm256_loadu_ps(&boxes.extentZ[i]);
+
+            __m256 outside = _mm256_setzero_ps();
+            for (int p = 0; p < 6; p++) {
+
+                __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(normalX[p], cx), _mm256_mul_ps(normalY[p], cy)),
+                                                _mm256_add_ps(_mm256_mul_ps(normalZ[p], cz), normalW[p]));
+                __m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(absX[p], ex), _mm256_mul_ps(absY[p], ey)), _mm256_mul_ps(absZ[p], ez));
+                outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_LT_OQ));
+            }
+
+            // i is a multiple of 8, the 8 bits never straddle two words
+            GLuint mask = (GLuint)(~_mm256_movemask_ps(outside) & 0xff);
+            visibility[i / 32] |= mask << (i % 32);
+        }
+
+        CullBoxesRange(boxes, i, planes, visibility);
+    }
+
+#elif defined (FRUSTUM_CULLING_SSE)
+
+    void CullBoxes(const BoundingBoxes& boxes, const glm::vec4 planes[6], std::vector<GLuint>& visibility) {
+
+        ResetVisibility(boxes, visibility);
+
+        // the plane coefficients broadcast once, the boxes vary across lanes
+        __m128 normalX[6], normalY[6], normalZ[6], normalW[6];
+        __m128 absX[6], absY[6], absZ[6];
+        for (int p = 0; p < 6; p++) {
+
+            normalX[p] = _mm_set1_ps(planes[p].x);
+            normalY[p] = _mm_set1_ps(planes[p].y);
+            normalZ[p] = _mm_set1_ps(planes[p].z);
+            normalW[p] = _mm_set1_ps(planes[p].w);
+            absX[p] = _mm_set1_ps(fabsf(planes[p].x));
+            absY[p] = _mm_set1_ps(fabsf(planes[p].y));
+            absZ[p] = _mm_set1_ps(fabsf(planes[p].z));
+        }
+
+        size_t i = 0;
+        for (; i + 4 <= boxes.size(); i += 4) {
+
+            __m128 cx = _mm_loadu_ps(&boxes.centerX[i]);
+            __m128 cy = _mm_loadu_ps(&boxes.centerY[i]);
+            __m128 cz = _mm_loadu_ps(&boxes.centerZ[i]);
+            __m128 ex = _mm_loadu_ps(&boxes.extentX[i]);
+            __m128 ey = _mm_loadu_ps(&boxes.extentY[i]);
+            __m128 ez = _mm_loadu_ps(&boxes.extentZ[i]);
+
+            __m128 outside = _mm_setzero_ps();
+            for (int p = 0; p < 6; p++) {
+
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(normalX[p], cx), _mm_mul_ps(normalY[p], cy)),
+                                             _mm_add_ps(_mm_mul_ps(normalZ[p], cz), normalW[p]));
+                __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absX[p], ex), _mm_mul_ps(absY[p], ey)), _mm_mul_ps(absZ[p], ez));
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+            }
+
+            // i is a multiple of 4, the 4 bits never straddle two words
+            GLuint mask = (GLuint)(~_mm_movemask_ps(outside) & 0xf);
+            visibility[i / 32] |= mask << (i % 32);
+        }
+
+        CullBoxesRange(boxes, i, planes, visibility);
+    }
+
+#else
+
+    void CullBoxes(const BoundingBoxes& boxes, const glm::vec4 planes[6], std::vector<GLuint>& visibility) {
+
+        CullBoxesScalar(boxes, planes, visibility);
+    }
+
+#endif
+}
@@ -0,0 +1,46 @@
+#ifndef FrustumCulling_hpp
+#define FrustumCulling_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace gps {
+
+    // Axis aligned boxes as center and half extent, one array per component so
+    // CullBoxes can test 4 (SSE) or 8 (AVX) boxes per instruction
+    struct BoundingBoxes {
+
+        std::vector<float> centerX, centerY, centerZ;
+        std::vector<float> extentX, extentY, extentZ;
+
+        void add(glm::vec3 minimum, glm::vec3 maximum);
+        void clear();
+        size_t size() const;
+    };
+
+    // Moves world space planes into the space of a model matrix, so boxes can be tested without transforming them
+    void TransformPlanes(const glm::vec4 planes[6], glm::mat4 model, glm::vec4 result[6]);
+
+    // Sets bit i % 32 of visibility[i / 32] for every box that is not entirely outside one of the planes,
+    // using the widest instruction set the build targets
+    void CullBoxes(const BoundingBoxes& boxes, const glm::vec4 planes[6], std::vector<GLuint>& visibility);
+
+    // One box at a time, the reference for CullBoxes and its fallback on other CPUs
+    void CullBoxesScalar(const BoundingBoxes& boxes, const glm::vec4 planes[6], std::vector<GLuint>& visibility);
+
+    inline bool IsBoxVisible(const std::vector<GLuint>& visibility, size_t index) {
+
+        return (visibility[index / 32] >> (index % 32) & 1u) != 0;
+    }
+}
+
+#endif /* FrustumCulling_hpp */
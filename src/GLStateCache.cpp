@@ -0,0 +1,250 @@
+#include "GLStateCache.hpp"
+
+namespace gps {
+
+    // Never a valid name, so the first bind of each kind is issued
+    static const GLuint UNKNOWN = 0xFFFFFFFFu;
+
+    GLStateCache& GLStateCache::GetShared() {
+
+        static GLStateCache sharedCache;
+        return sharedCache;
+    }
+
+    GLStateCache::GLStateCache() {
+
+        invalidate();
+        resetCounters();
+    }
+
+    template <typename Value>
+    bool GLStateCache::change(Value& current, Value value) {
+
+        if (current == value) {
+            this->elided++;
+            return false;
+        }
+        current = value;
+        this->issued++;
+        return true;
+    }
+
+    void GLStateCache::useProgram(GLuint program) {
+
+        if (change(this->program, program)) {
+            glUseProgram(program);
+        }
+    }
+
+    void GLStateCache::bindVertexArray(GLuint vertexArray) {
+
+        if (change(this->vertexArray, vertexArray)) {
+            glBindVertexArray(vertexArray);
+        }
+    }
+
+    void GLStateCache::bindTexture(GLuint unit, GLenum target, GLuint texture) {
+
+        if (unit >= GL_STATE_TEXTURE_UNITS) {
+
+            this->activeUnit = unit;
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glBindTexture(target, texture);
+            this->issued += 2;
+            return;
+        }
+
+        if (this->textures[unit] == texture && this->textureTargets[unit] == target) {
+            this->elided++;
+            return;
+        }
+
+        if (change(this->activeUnit, unit)) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+        }
+        // a unit has one binding per target, the cache keeps the last one
+        this->textureTargets[unit] = target;
+        this->textures[unit] = texture;
+        this->issued++;
+        glBindTexture(target, texture);
+    }
+
+    void GLStateCache::bindTexture(GLenum target, GLuint texture) {
+
+        if (this->activeUnit == UNKNOWN) {
+            bindTexture(0, target, texture);
+            return;
+        }
+        bindTexture(this->activeUnit, target, texture);
+    }
+
+    void GLStateCache::bindFramebuffer(GLenum target, GLuint framebuffer) {
+
+        if (target == GL_FRAMEBUFFER) {
+
+            if (this->drawFramebuffer == framebuffer && this->readFramebuffer == framebuffer) {
+                this->elided++;
+                return;
+            }
+            this->drawFramebuffer = framebuffer;
+            this->readFramebuffer = framebuffer;
+            this->issued++;
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+            return;
+        }
+
+        if (change(target == GL_DRAW_FRAMEBUFFER ? this->drawFramebuffer : this->readFramebuffer, framebuffer)) {
+            glBindFramebuffer(target, framebuffer);
+        }
+    }
+
+    void GLStateCache::viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+
+        if (this->viewportBox[0] == x && this->viewportBox[1] == y && this->viewportBox[2] == width && this->viewportBox[3] == height) {
+            this->elided++;
+            return;
+        }
+        this->viewportBox[0] = x;
+        this->viewportBox[1] = y;
+        this->viewportBox[2] = width;
+        this->viewportBox[3] = height;
+        this->issued++;
+        glViewport(x, y, width, height);
+    }
+
+    void GLStateCache::setEnabled(GLenum capability, bool enabled) {
+
+        int* current = NULL;
+        switch (capability) {
+        case GL_DEPTH_TEST: current = &this->depthTest; break;
+        case GL_CULL_FACE: current = &this->cullFaceEnabled; break;
+        case GL_DEPTH_CLAMP: current = &this->depthClamp; break;
+        case GL_BLEND: current = &this->blend; break;
+        case GL_FRAMEBUFFER_SRGB: current = &this->framebufferSrgb; break;
+        default: break;
+        }
+
+        if (current != NULL && !change(*current, enabled ? 1 : 0)) {
+            return;
+        }
+        if (current == NULL) {
+            this->issued++;
+        }
+
+        if (enabled) {
+            glEnable(capability);
+        }
+        else {
+            glDisable(capability);
+        }
+    }
+
+    void GLStateCache::depthFunc(GLenum function) {
+
+        if (change(this->depthFunction, function)) {
+            glDepthFunc(function);
+        }
+    }
+
+    void GLStateCache::depthMask(GLboolean write) {
+
+        if (change(this->depthWrite, write ? 1 : 0)) {
+            glDepthMask(write);
+        }
+    }
+
+    void GLStateCache::cullFace(GLenum face) {
+
+        if (change(this->cullFaceMode, face)) {
+            glCullFace(face);
+        }
+    }
+
+    void GLStateCache::blendFunc(GLenum source, GLenum destination) {
+
+        if (this->blendSource == source && this->blendDestination == destination) {
+            this->elided++;
+            return;
+        }
+        this->blendSource = source;
+        this->blendDestination = destination;
+        this->issued++;
+        glBlendFunc(source, destination);
+    }
+
+    void GLStateCache::deleteTextures(GLsizei count, const GLuint* textures) {
+
+        // OpenGL binds 0 wherever a deleted texture was bound
+        for (GLsizei i = 0; i < count; i++) {
+            for (GLuint unit = 0; unit < GL_STATE_TEXTURE_UNITS; unit++) {
+                if (this->textures[unit] == textures[i]) {
+                    this->textures[unit] = 0;
+                }
+            }
+        }
+        glDeleteTextures(count, textures);
+    }
+
+    void GLStateCache::deleteVertexArrays(GLsizei count, const GLuint* vertexArrays) {
+
+        for (GLsizei i = 0; i < count; i++) {
+            if (this->vertexArray == vertexArrays[i]) {
+                this->vertexArray = 0;
+            }
+        }
+        glDeleteVertexArrays(count, vertexArrays);
+    }
+
+    void GLStateCache::deleteFramebuffers(GLsizei count, const GLuint* framebuffers) {
+
+        for (GLsizei i = 0; i < count; i++) {
+            if (this->drawFramebuffer == framebuffers[i]) {
+                this->drawFramebuffer = 0;
+            }
+            if (this->readFramebuffer == framebuffers[i]) {
+                this->readFramebuffer = 0;
+            }
+        }
+        glDeleteFramebuffers(count, framebuffers);
+    }
+
+    void GLStateCache::invalidate() {
+
+        this->program = UNKNOWN;
+        this->vertexArray = UNKNOWN;
+        this->activeUnit = UNKNOWN;
+        for (GLuint unit = 0; unit < GL_STATE_TEXTURE_UNITS; unit++) {
+            this->textureTargets[unit] = UNKNOWN;
+            this->textures[unit] = UNKNOWN;
+        }
+        this->drawFramebuffer = UNKNOWN;
+        this->readFramebuffer = UNKNOWN;
+        this->viewportBox[0] = this->viewportBox[1] = this->viewportBox[2] = this->viewportBox[3] = -1;
+        this->depthTest = -1;
+        this->cullFaceEnabled = -1;
+        this->depthClamp = -1;
+        this->blend = -1;
+        this->framebufferSrgb = -1;
+        this->depthFunction = UNKNOWN;
+        this->depthWrite = -1;
+        this->cullFaceMode = UNKNOWN;
+        this->blendSource = UNKNOWN;
+        this->blendDestination = UNKNOWN;
+    }
+
+    size_t GLStateCache::getIssuedCount() const {
+
+        return this->issued;
+    }
+
+    size_t GLStateCache::getElidedCount() const {
+
+        return this->elided;
+    }
+
+    void GLStateCache::resetCounters() {
+
+        this->issued = 0;
+        this->elided = 0;
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef GLStateCache_hpp
+#define GLStateCache_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <cstddef>
+
+namespace gps {
+
+    // Texture units the cache tracks; units above it are always bound
+    static const GLuint GL_STATE_TEXTURE_UNITS = 16;
+
+    // Remembers the OpenGL state set through it and drops calls that would set it to what it already is.
+    // Everything that binds programs, vertex arrays, textures or framebuffers, sets the viewport or toggles
+    // the tracked capabilities must go through here, as must deleting those objects, since OpenGL unbinds
+    // deleted names and may hand them out again. State starts unknown, so the first call of each kind is issued.
+    class GLStateCache {
+
+    public:
+        // The cache of the one OpenGL context, used only from the thread that owns it
+        static GLStateCache& GetShared();
+
+        void useProgram(GLuint program);
+        void bindVertexArray(GLuint vertexArray);
+
+        // Binds to a unit, switching the active unit only when needed
+        void bindTexture(GLuint unit, GLenum target, GLuint texture);
+        // Binds to whichever unit is active, for uploads
+        void bindTexture(GLenum target, GLuint texture);
+
+        // GL_FRAMEBUFFER sets both the draw and the read framebuffer
+        void bindFramebuffer(GLenum target, GLuint framebuffer);
+
+        void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+        // GL_DEPTH_TEST, GL_CULL_FACE, GL_DEPTH_CLAMP, GL_BLEND, GL_FRAMEBUFFER_SRGB
+        void setEnabled(GLenum capability, bool enabled);
+
+        void depthFunc(GLenum function);
+        void depthMask(GLboolean write);
+        void cullFace(GLenum face);
+        void blendFunc(GLenum source, GLenum destination);
+
+        void deleteTextures(GLsizei count, const GLuint* textures);
+        void deleteVertexArrays(GLsizei count, const GLuint* vertexArrays);
+        void deleteFramebuffers(GLsizei count, const GLuint* framebuffers);
+
+        // Forgets everything, after code that changed state behind the cache's back
+        void invalidate();
+
+        // Calls passed on to OpenGL, and the ones dropped as redundant
+        size_t getIssuedCount() const;
+        size_t getElidedCount() const;
+        void resetCounters();
+
+    private:
+        GLStateCache();
+
+        // Counts the call and returns true if it changes current
+        template <typename Value>
+        bool change(Value& current, Value value);
+
+        GLuint program;
+        GLuint vertexArray;
+        GLuint activeUnit;
+        GLenum textureTargets[GL_STATE_TEXTURE_UNITS];
+        GLuint textures[GL_STATE_TEXTURE_UNITS];
+        GLuint drawFramebuffer;
+        GLuint readFramebuffer;
+        GLint viewportBox[4];
+        // -1 unknown, 0 disabled, 1 enabled
+        int depthTest;
+        int cullFaceEnabled;
+        int depthClamp;
+        int blend;
+        int framebufferSrgb;
+        GLenum depthFunction;
+        // -1 unknown
+        int depthWrite;
+        GLenum cullFaceMode;
+        GLenum blendSource;
+        GLenum blendDestination;
+        size_t issued;
+        size_t elided;
+    };
+}
+
+#endif /* GLStateCache_hpp */
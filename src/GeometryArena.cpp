@@ -0,0 +1,354 @@
+#include "GeometryArena.hpp"
+#include "GLStateCache.hpp"
+
+#include <algorithm>
+
+namespace gps {
+
+    // Smallest pool buffers, in vertices and indices, and draw id buffer
+    static const size_t ARENA_MIN_VERTICES = 1 << 16;
+    static const size_t ARENA_MIN_INDICES = 3 << 16;
+    static const size_t ARENA_MIN_DRAW_IDS = 1 << 12;
+
+    GeometryArena& GeometryArena::GetShared() {
+
+        // never destroyed: models give their meshes back from their destructors, at exit
+        static GeometryArena* sharedArena = new GeometryArena();
+        return *sharedArena;
+    }
+
+    GeometryArena::GeometryArena() {
+
+        this->multiDrawIndirect = -1;
+        this->drawIdBuffer = 0;
+        this->drawIdCapacity = 0;
+        this->recordBuffer = 0;
+        this->recordTexture = 0;
+        this->commandBuffer = 0;
+    }
+
+    size_t GeometryArena::AllocateRange(std::vector<FreeRange>& freeRanges, size_t& end, size_t count) {
+
+        for (size_t i = 0; i < freeRanges.size(); i++) {
+
+            FreeRange& range = freeRanges[i];
+            if (range.count < count) {
+                continue;
+            }
+
+            size_t first = range.first;
+            range.first += count;
+            range.count -= count;
+            if (range.count == 0) {
+                freeRanges.erase(freeRanges.begin() + i);
+            }
+            return first;
+        }
+
+        size_t first = end;
+        end += count;
+        return first;
+    }
+
+    void GeometryArena::ReleaseRange(std::vector<FreeRange>& freeRanges, size_t& end, size_t first, size_t count) {
+
+        // kept sorted by first
+        size_t i = 0;
+        while (i < freeRanges.size() && freeRanges[i].first < first) {
+            i++;
+        }
+
+        FreeRange range = { first, count };
+        if (i > 0 && freeRanges[i - 1].first + freeRanges[i - 1].count == first) {
+
+            i--;
+            range.first = freeRanges[i].first;
+            range.count += freeRanges[i].count;
+            freeRanges.erase(freeRanges.begin() + i);
+        }
+        if (i < freeRanges.size() && range.first + range.count == freeRanges[i].first) {
+
+            range.count += freeRanges[i].count;
+            freeRanges.erase(freeRanges.begin() + i);
+        }
+
+        if (range.first + range.count == end) {
+            end = range.first;
+            return;
+        }
+        freeRanges.insert(freeRanges.begin() + i, range);
+    }
+
+    int GeometryArena::findPool(VERTEX_FORMAT format, GLenum indexType) {
+
+        for (size_t i = 0; i < this->pools.size(); i++) {
+            if (this->pools[i].format == format && this->pools[i].indexType == indexType) {
+                return (int)i;
+            }
+        }
+
+        Pool pool;
+        pool.format = format;
+        pool.indexType = indexType;
+        pool.VAO = 0;
+        pool.VBO = 0;
+        pool.EBO = 0;
+        pool.vertexSize = format == VERTEX_QUANTIZED ? sizeof(PackedVertex) : sizeof(Vertex);
+        pool.indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+        pool.vertexEnd = 0;
+        pool.vertexCapacity = 0;
+        pool.indexEnd = 0;
+        pool.indexCapacity = 0;
+        pool.usedVertices = 0;
+        pool.usedIndices = 0;
+        this->pools.push_back(pool);
+        return (int)this->pools.size() - 1;
+    }
+
+    GLuint GeometryArena::growBuffer(GLuint buffer, size_t size, size_t capacity) {
+
+        // the copy bindings leave the element array binding of whatever vertex array is bound alone
+        GLuint grown;
+        glGenBuffers(1, &grown);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+        glBufferData(GL_COPY_WRITE_BUFFER, capacity, NULL, GL_STATIC_DRAW);
+
+        if (buffer != 0) {
+
+            glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glDeleteBuffers(1, &buffer);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return grown;
+    }
+
+    void GeometryArena::reserveDrawIds(size_t count) {
+
+        if (this->drawIdBuffer != 0 && count <= this->drawIdCapacity) {
+            return;
+        }
+
+        size_t capacity = std::max(std::max(this->drawIdCapacity * 2, ARENA_MIN_DRAW_IDS), count);
+        std::vector<GLint> drawIds(capacity);
+        for (size_t i = 0; i < capacity; i++) {
+            drawIds[i] = (GLint)i;
+        }
+
+        // respecified in place, the pools' vertex arrays keep pointing at it
+        if (this->drawIdBuffer == 0) {
+            glGenBuffers(1, &this->drawIdBuffer);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, this->drawIdBuffer);
+        glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(GLint), drawIds.data(), GL_STATIC_DRAW);
+        this->drawIdCapacity = capacity;
+    }
+
+    void GeometryArena::setupPoolArray(Pool& pool) {
+
+        GLStateCache& state = GLStateCache::GetShared();
+        reserveDrawIds(ARENA_MIN_DRAW_IDS);
+
+        if (pool.VAO == 0) {
+            glGenVertexArrays(1, &pool.VAO);
+        }
+        state.bindVertexArray(pool.VAO);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.EBO);
+        glBindBuffer(GL_ARRAY_BUFFER, pool.VBO);
+        SetupVertexAttributes(pool.format);
+
+        // one value per instance: element baseInstance for the first and only instance of a command
+        glBindBuffer(GL_ARRAY_BUFFER, this->drawIdBuffer);
+        glEnableVertexAttribArray(ARENA_DRAW_ID_ATTRIBUTE);
+        glVertexAttribIPointer(ARENA_DRAW_ID_ATTRIBUTE, 1, GL_INT, sizeof(GLint), (GLvoid*)0);
+        glVertexAttribDivisor(ARENA_DRAW_ID_ATTRIBUTE, 1);
+
+        // unbound so no later element buffer bind lands in the pool's array
+        state.bindVertexArray(0);
+    }
+
+    ArenaAllocation GeometryArena::allocate(VERTEX_FORMAT format, GLenum indexType, const GLvoid* vertexData, size_t vertexCount, const GLvoid* indexData, size_t indexCount) {
+
+        ArenaAllocation allocation = { -1, 0, 0, 0, 0 };
+        if (vertexCount == 0 || indexCount == 0) {
+            return allocation;
+        }
+
+        allocation.pool = findPool(format, indexType);
+        Pool& pool = this->pools[allocation.pool];
+
+        allocation.firstVertex = AllocateRange(pool.freeVertices, pool.vertexEnd, vertexCount);
+        allocation.vertexCount = vertexCount;
+        allocation.firstIndex = AllocateRange(pool.freeIndices, pool.indexEnd, indexCount);
+        allocation.indexCount = indexCount;
+        pool.usedVertices += vertexCount;
+        pool.usedIndices += indexCount;
+
+        bool grown = pool.VAO == 0;
+        if (pool.vertexEnd > pool.vertexCapacity) {
+
+            size_t capacity = std::max(std::max(pool.vertexCapacity * 2, ARENA_MIN_VERTICES), pool.vertexEnd);
+            pool.VBO = growBuffer(pool.VBO, pool.vertexCapacity * pool.vertexSize, capacity * pool.vertexSize);
+            pool.vertexCapacity = capacity;
+            grown = true;
+        }
+        if (pool.indexEnd > pool.indexCapacity) {
+
+            size_t capacity = std::max(std::max(pool.indexCapacity * 2, ARENA_MIN_INDICES), pool.indexEnd);
+            pool.EBO = growBuffer(pool.EBO, pool.indexCapacity * pool.indexSize, capacity * pool.indexSize);
+            pool.indexCapacity = capacity;
+            grown = true;
+        }
+        if (grown) {
+            setupPoolArray(pool);
+        }
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, pool.VBO);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.firstVertex * pool.vertexSize, vertexCount * pool.vertexSize, vertexData);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, pool.EBO);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.firstIndex * pool.indexSize, indexCount * pool.indexSize, indexData);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        return allocation;
+    }
+
+    void GeometryArena::release(const ArenaAllocation& allocation) {
+
+        // after destroy there is nothing left to give back to
+        if (allocation.pool < 0 || allocation.pool >= (int)this->pools.size()) {
+            return;
+        }
+
+        Pool& pool = this->pools[allocation.pool];
+        ReleaseRange(pool.freeVertices, pool.vertexEnd, allocation.firstVertex, allocation.vertexCount);
+        ReleaseRange(pool.freeIndices, pool.indexEnd, allocation.firstIndex, allocation.indexCount);
+        pool.usedVertices -= allocation.vertexCount;
+        pool.usedIndices -= allocation.indexCount;
+    }
+
+    GLuint GeometryArena::getVertexArray(int pool) const {
+
+        return this->pools[pool].VAO;
+    }
+
+    bool GeometryArena::hasMultiDrawIndirect() {
+
+        if (this->multiDrawIndirect < 0) {
+#if defined (__APPLE__)
+            this->multiDrawIndirect = 0;
+#else
+            // indirect commands only honor baseInstance from OpenGL 4.2 or ARB_base_instance on
+            this->multiDrawIndirect = GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance) ? 1 : 0;
+#endif
+        }
+        return this->multiDrawIndirect == 1;
+    }
+
+    void GeometryArena::createDrawBuffers() {
+
+        glGenBuffers(1, &this->recordBuffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, this->recordBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(DrawRecord), NULL, GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        glGenBuffers(1, &this->commandBuffer);
+    }
+
+    void GeometryArena::uploadDraws(const std::vector<DrawRecord>& records, const std::vector<DrawElementsCommand>& commands) {
+
+        if (records.empty()) {
+            return;
+        }
+        if (this->recordBuffer == 0) {
+            createDrawBuffers();
+        }
+        reserveDrawIds(records.size());
+
+        // respecified on every upload, so a pass never waits for the GPU to finish reading the previous one's
+        glBindBuffer(GL_TEXTURE_BUFFER, this->recordBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, records.size() * sizeof(DrawRecord), records.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        // left bound for drawIndirect, nothing else uses this binding
+        if (hasMultiDrawIndirect() && !commands.empty()) {
+
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->commandBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsCommand), commands.data(), GL_STREAM_DRAW);
+        }
+    }
+
+    void GeometryArena::bindRecordTexture(GLuint unit) {
+
+        if (this->recordBuffer == 0) {
+            createDrawBuffers();
+        }
+
+        GLStateCache& state = GLStateCache::GetShared();
+        if (this->recordTexture != 0) {
+            state.bindTexture(unit, GL_TEXTURE_BUFFER, this->recordTexture);
+            return;
+        }
+
+        glGenTextures(1, &this->recordTexture);
+        state.bindTexture(unit, GL_TEXTURE_BUFFER, this->recordTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, this->recordBuffer);
+    }
+
+    void GeometryArena::drawIndirect(GLenum indexType, size_t firstCommand, size_t commandCount) {
+
+#if !defined (__APPLE__)
+        glMultiDrawElementsIndirect(GL_TRIANGLES, indexType, (const GLvoid*)(firstCommand * sizeof(DrawElementsCommand)), (GLsizei)commandCount, 0);
+#endif
+    }
+
+    size_t GeometryArena::getUsedBytes() const {
+
+        size_t bytes = 0;
+        for (size_t i = 0; i < this->pools.size(); i++) {
+            bytes += this->pools[i].usedVertices * this->pools[i].vertexSize + this->pools[i].usedIndices * this->pools[i].indexSize;
+        }
+        return bytes;
+    }
+
+    size_t GeometryArena::getCapacityBytes() const {
+
+        size_t bytes = 0;
+        for (size_t i = 0; i < this->pools.size(); i++) {
+            bytes += this->pools[i].vertexCapacity * this->pools[i].vertexSize + this->pools[i].indexCapacity * this->pools[i].indexSize;
+        }
+        return bytes;
+    }
+
+    void GeometryArena::destroy() {
+
+        GLStateCache& state = GLStateCache::GetShared();
+        for (size_t i = 0; i < this->pools.size(); i++) {
+
+            glDeleteBuffers(1, &this->pools[i].VBO);
+            glDeleteBuffers(1, &this->pools[i].EBO);
+            state.deleteVertexArrays(1, &this->pools[i].VAO);
+        }
+        this->pools.clear();
+
+        if (this->recordBuffer != 0) {
+
+            glDeleteBuffers(1, &this->recordBuffer);
+            glDeleteBuffers(1, &this->commandBuffer);
+            this->recordBuffer = 0;
+            this->commandBuffer = 0;
+        }
+        if (this->recordTexture != 0) {
+
+            state.deleteTextures(1, &this->recordTexture);
+            this->recordTexture = 0;
+        }
+        if (this->drawIdBuffer != 0) {
+
+            glDeleteBuffers(1, &this->drawIdBuffer);
+            this->drawIdBuffer = 0;
+            this->drawIdCapacity = 0;
+        }
+    }
+}
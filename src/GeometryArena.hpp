@@ -0,0 +1,135 @@
+#ifndef GeometryArena_hpp
+#define GeometryArena_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Mesh.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // Attribute the draw record index of a batched draw arrives in, one value per instance
+    static const GLuint ARENA_DRAW_ID_ATTRIBUTE = 3;
+
+    // Per-draw data of a batched draw, two texels of the draw record buffer. Shaders read it at
+    // drawBase + the draw id attribute instead of their objectIndex, positionScale and positionOffset uniforms.
+    struct DrawRecord {
+
+        // xyz: positionScale, w: objectIndex
+        glm::vec4 positionScale;
+        // xyz: positionOffset
+        glm::vec4 positionOffset;
+    };
+
+    // Layout glMultiDrawElementsIndirect reads from GL_DRAW_INDIRECT_BUFFER
+    struct DrawElementsCommand {
+
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        // the draw record, it reaches the shader through the draw id attribute
+        GLuint baseInstance;
+    };
+
+    // Large shared vertex and index buffers the meshes of every model are suballocated from, one pool and
+    // vertex array per vertex format and index type. Draws of meshes in the same pool only differ in their
+    // ranges, so a whole batch of them goes out with one glMultiDrawElementsIndirect where OpenGL 4.3 (or
+    // ARB_multi_draw_indirect with ARB_base_instance) is available. Pools grow by copying into buffers twice
+    // as large; released space is reused by later meshes.
+    class GeometryArena {
+
+    public:
+        // The arena of the one OpenGL context, used only from the thread that owns it
+        static GeometryArena& GetShared();
+
+        // Copies a mesh's vertices and indices into the pool of its format and index type.
+        // pool is -1 in the result if the mesh is empty.
+        ArenaAllocation allocate(VERTEX_FORMAT format, GLenum indexType, const GLvoid* vertexData, size_t vertexCount, const GLvoid* indexData, size_t indexCount);
+        void release(const ArenaAllocation& allocation);
+
+        GLuint getVertexArray(int pool) const;
+
+        // Checked once a context exists, false on macOS where OpenGL stops at 4.1
+        bool hasMultiDrawIndirect();
+
+        // Replaces the draw records and commands of the previous upload
+        void uploadDraws(const std::vector<DrawRecord>& records, const std::vector<DrawElementsCommand>& commands);
+
+        // Binds the buffer texture of the uploaded draw records (RGBA32F) to unit, creating it on first use.
+        // No other unit is touched, the texture stays where the caller puts it.
+        void bindRecordTexture(GLuint unit);
+
+        // Issues uploaded commands with glMultiDrawElementsIndirect, the pool's vertex array must be bound
+        void drawIndirect(GLenum indexType, size_t firstCommand, size_t commandCount);
+
+        // Bytes in use over bytes allocated, across all pools
+        size_t getUsedBytes() const;
+        size_t getCapacityBytes() const;
+
+        void destroy();
+
+    private:
+        // Free run of vertices or indices in a pool
+        struct FreeRange {
+
+            size_t first;
+            size_t count;
+        };
+
+        struct Pool {
+
+            VERTEX_FORMAT format;
+            GLenum indexType;
+            GLuint VAO;
+            GLuint VBO;
+            GLuint EBO;
+            size_t vertexSize;
+            size_t indexSize;
+            // high water marks and sizes of the buffers, in vertices and indices
+            size_t vertexEnd;
+            size_t vertexCapacity;
+            size_t indexEnd;
+            size_t indexCapacity;
+            std::vector<FreeRange> freeVertices;
+            std::vector<FreeRange> freeIndices;
+            size_t usedVertices;
+            size_t usedIndices;
+        };
+
+        GeometryArena();
+
+        // First fit from the free ranges, else from end, which moves past the new range
+        static size_t AllocateRange(std::vector<FreeRange>& freeRanges, size_t& end, size_t count);
+        // Merges the range with its free neighbours, or moves end back if it was the last one
+        static void ReleaseRange(std::vector<FreeRange>& freeRanges, size_t& end, size_t first, size_t count);
+
+        int findPool(VERTEX_FORMAT format, GLenum indexType);
+        // Points the pool's vertex array at its current buffers and the draw ids
+        void setupPoolArray(Pool& pool);
+        // Moves a buffer's first size bytes into a new one of capacity bytes
+        GLuint growBuffer(GLuint buffer, size_t size, size_t capacity);
+        void reserveDrawIds(size_t count);
+        void createDrawBuffers();
+
+        std::vector<Pool> pools;
+        int multiDrawIndirect;
+        // 0, 1, 2... read once per instance, so a command's baseInstance picks its draw record
+        GLuint drawIdBuffer;
+        size_t drawIdCapacity;
+        GLuint recordBuffer;
+        GLuint recordTexture;
+        GLuint commandBuffer;
+    };
+}
+
+#endif /* GeometryArena_hpp */
@@ -0,0 +1,137 @@
+#include "MappedFile.hpp"
+
+#if defined (_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace gps {
+
+#if defined (_WIN32)
+
+    MappedFile::MappedFile() : data(NULL), size(0), fileHandle(INVALID_HANDLE_VALUE), mappingHandle(NULL) {
+    }
+
+    bool MappedFile::open(std::string fileName) {
+
+        close();
+
+        HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+            CloseHandle(file);
+            return false;
+        }
+
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL) {
+            CloseHandle(file);
+            return false;
+        }
+
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (view == NULL) {
+            CloseHandle(mapping);
+            CloseHandle(file);
+            return false;
+        }
+
+        this->fileHandle = file;
+        this->mappingHandle = mapping;
+        this->data = (const unsigned char*)view;
+        this->size = (size_t)fileSize.QuadPart;
+        return true;
+    }
+
+    void MappedFile::close() {
+
+        if (this->data) {
+            UnmapViewOfFile(this->data);
+        }
+        if (this->mappingHandle) {
+            CloseHandle((HANDLE)this->mappingHandle);
+        }
+        if (this->fileHandle != INVALID_HANDLE_VALUE) {
+            CloseHandle((HANDLE)this->fileHandle);
+        }
+
+        this->data = NULL;
+        this->size = 0;
+        this->fileHandle = INVALID_HANDLE_VALUE;
+        this->mappingHandle = NULL;
+    }
+
+#else
+
+    MappedFile::MappedFile() : data(NULL), size(0), fileDescriptor(-1) {
+    }
+
+    bool MappedFile::open(std::string fileName) {
+
+        close();
+
+        int fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat fileInfo;
+        if (fstat(fd, &fileInfo) != 0 || fileInfo.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+
+        void* view = mmap(NULL, (size_t)fileInfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view == MAP_FAILED) {
+            ::close(fd);
+            return false;
+        }
+
+        this->fileDescriptor = fd;
+        this->data = (const unsigned char*)view;
+        this->size = (size_t)fileInfo.st_size;
+        return true;
+    }
+
+    void MappedFile::close() {
+
+        if (this->data) {
+            munmap((void*)this->data, this->size);
+        }
+        if (this->fileDescriptor >= 0) {
+            ::close(this->fileDescriptor);
+        }
+
+        this->data = NULL;
+        this->size = 0;
+        this->fileDescriptor = -1;
+    }
+
+#endif
+
+    MappedFile::~MappedFile() {
+        close();
+    }
+
+    bool MappedFile::isOpen() const {
+        return this->data != NULL;
+    }
+
+    const unsigned char* MappedFile::getData() const {
+        return this->data;
+    }
+
+    size_t MappedFile::getSize() const {
+        return this->size;
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef MappedFile_hpp
+#define MappedFile_hpp
+
+#include <cstddef>
+#include <string>
+
+namespace gps {
+
+    // Read-only memory mapping of a whole file
+    class MappedFile {
+
+    public:
+        MappedFile();
+        ~MappedFile();
+
+        // Maps the file into memory, returns false if it does not exist or is empty
+        bool open(std::string fileName);
+        void close();
+
+        bool isOpen() const;
+        const unsigned char* getData() const;
+        size_t getSize() const;
+
+    private:
+        const unsigned char* data;
+        size_t size;
+
+#if defined (_WIN32)
+        void* fileHandle;
+        void* mappingHandle;
+#else
+        int fileDescriptor;
+#endif
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+    };
+}
+
+#endif /* MappedFile_hpp */
@@ -1,72 +1,610 @@
 #include "Mesh.hpp"
+#include "MeshClusters.hpp"
+#include "GLStateCache.hpp"
+#include "GeometryArena.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
 namespace gps {
 
+	// IEEE 754 half float, rounded to nearest, overflow clamped to the largest finite value
+	static GLushort FloatToHalf(float value) {
+
+		GLuint bits;
+		memcpy(&bits, &value, sizeof(bits));
+
+		GLuint sign = (bits >> 16) & 0x8000;
+		float magnitude = std::min(fabsf(value), 65504.0f);
+		memcpy(&bits, &magnitude, sizeof(bits));
+
+		// below the smallest normal half, 2^-14, the result is denormal
+		if (magnitude < 6.103515625e-05f) {
+			return (GLushort)(sign | (GLuint)(magnitude * 16777216.0f + 0.5f));
+		}
+
+		// rebias the exponent and round the mantissa, a carry correctly bumps the exponent
+		GLuint half = ((bits - (112u << 23)) + 0x1000) >> 13;
+		return (GLushort)(sign | half);
+	}
+
+	static float HalfToFloat(GLushort half) {
+
+		float sign = (half & 0x8000) ? -1.0f : 1.0f;
+		int exponent = (half >> 10) & 0x1F;
+		int mantissa = half & 0x3FF;
+
+		if (exponent == 0) {
+			return sign * mantissa / 16777216.0f;
+		}
+		return sign * ldexpf(1.0f + mantissa / 1024.0f, exponent - 15);
+	}
+
+	// GL_INT_2_10_10_10_REV, each component a 10 bit snorm
+	static GLuint PackNormal(glm::vec3 normal, glm::vec3& decoded) {
+
+		GLuint packed = 0;
+		for (int c = 0; c < 3; c++) {
+
+			int value = (int)floorf(std::max(-1.0f, std::min(1.0f, normal[c])) * 511.0f + 0.5f);
+			decoded[c] = value / 511.0f;
+			packed |= ((GLuint)value & 0x3FF) << (10 * c);
+		}
+		return packed;
+	}
+
+	// Appends 16 bit indices to shortIndices, split into ranges that each address at most 65536 vertices
+	// from their base vertex. Returns false if the split would take too many draw calls.
+	static bool AppendShortIndices(const GLuint* indices, size_t indexCount, size_t vertexCount, std::vector<GLushort>& shortIndices, std::vector<IndexRange>& ranges) {
+
+		const size_t maxRangeVertices = 65536;
+
+		size_t levelStart = shortIndices.size();
+		size_t rangeStart = 0;
+		GLuint rangeMin = 0;
+		GLuint rangeMax = 0;
+
+		for (size_t i = 0; i + 2 < indexCount; i += 3) {
+
+			GLuint triangleMin = std::min(indices[i], std::min(indices[i + 1], indices[i + 2]));
+			GLuint triangleMax = std::max(indices[i], std::max(indices[i + 1], indices[i + 2]));
+			if (triangleMax - triangleMin >= maxRangeVertices) {
+				return false;
+			}
+
+			if (i > rangeStart && std::max(rangeMax, triangleMax) - std::min(rangeMin, triangleMin) >= maxRangeVertices) {
+
+				IndexRange range = {(GLsizei)(i - rangeStart), (levelStart + rangeStart) * sizeof(GLushort), (GLint)rangeMin};
+				ranges.push_back(range);
+				rangeStart = i;
+			}
+
+			if (i == rangeStart) {
+
+				rangeMin = triangleMin;
+				rangeMax = triangleMax;
+			}
+			rangeMin = std::min(rangeMin, triangleMin);
+			rangeMax = std::max(rangeMax, triangleMax);
+		}
+
+		if (indexCount > rangeStart) {
+
+			IndexRange range = {(GLsizei)(indexCount - rangeStart), (levelStart + rangeStart) * sizeof(GLushort), (GLint)rangeMin};
+			ranges.push_back(range);
+		}
+
+		// after OptimizeVertexFetch triangles walk the vertices in order and the split is close to
+		// the minimum, an unoptimized order can jump across the whole buffer and need a draw per few triangles
+		size_t minimumRanges = (vertexCount + maxRangeVertices - 1) / maxRangeVertices;
+		if (ranges.size() > 2 * minimumRanges) {
+			return false;
+		}
+
+		shortIndices.resize(levelStart + indexCount);
+		for (size_t r = 0; r < ranges.size(); r++) {
+
+			size_t first = ranges[r].offset / sizeof(GLushort) - levelStart;
+			for (size_t i = first; i < first + ranges[r].count; i++) {
+				shortIndices[levelStart + i] = (GLushort)(indices[i] - ranges[r].baseVertex);
+			}
+		}
+
+		return true;
+	}
+
+	DrawContext MakeDrawContext(glm::mat4 model, glm::mat4 view, glm::mat4 projection, int viewportWidth, int viewportHeight, float maxScreenError) {
+
+		DrawContext context;
+		context.model = model;
+		context.viewProjection = projection * view;
+		context.cameraPosition = glm::vec3(glm::inverse(view)[3]);
+		context.viewportSize = glm::vec2((float)viewportWidth, (float)viewportHeight);
+		context.sampleCount = 1;
+		context.projectionScale = projection[1][1] * viewportHeight * 0.5f;
+		// perspective matrices copy -z into w
+		context.orthographic = projection[2][3] == 0.0f;
+		context.maxScreenError = maxScreenError;
+		context.cullMeshes = true;
+		context.cullClusters = true;
+		context.occlusion = NULL;
+		context.stats = NULL;
+		ExtractFrustumPlanes(context.viewProjection, context.frustumPlanes);
+		return context;
+	}
+
+	void ExtractFrustumPlanes(glm::mat4 viewProjection, glm::vec4 planes[6]) {
+
+		// Gribb-Hartmann: left, right, bottom, top, near, far from the rows of the matrix
+		glm::mat4 matrix = glm::transpose(viewProjection);
+		for (int i = 0; i < 6; i++) {
+
+			glm::vec4 plane = matrix[3] + (i % 2 == 0 ? 1.0f : -1.0f) * matrix[i / 2];
+			planes[i] = plane / glm::length(glm::vec3(plane));
+		}
+	}
+
+	float GetScreenError(float error, glm::vec3 center, float radius, const DrawContext& context) {
+
+		glm::vec3 worldCenter = glm::vec3(context.model * glm::vec4(center, 1.0f));
+		float scale = std::max(glm::length(glm::vec3(context.model[0])), std::max(glm::length(glm::vec3(context.model[1])), glm::length(glm::vec3(context.model[2]))));
+		if (context.orthographic) {
+			return error * scale * context.projectionScale;
+		}
+
+		float distance = glm::length(worldCenter - context.cameraPosition) - radius * scale;
+		if (distance <= 0.0f) {
+			return FLT_MAX;
+		}
+
+		return error * scale * context.projectionScale / distance;
+	}
+
+	Bounds ComputeBounds(const Vertex* vertices, size_t vertexCount) {
+
+		Bounds bounds;
+		bounds.minimum = glm::vec3(0.0f);
+		bounds.maximum = glm::vec3(0.0f);
+		for (size_t i = 0; i < vertexCount; i++) {
+
+			bounds.minimum = i == 0 ? vertices[i].Position : glm::min(bounds.minimum, vertices[i].Position);
+			bounds.maximum = i == 0 ? vertices[i].Position : glm::max(bounds.maximum, vertices[i].Position);
+		}
+
+		bounds.center = (bounds.minimum + bounds.maximum) * 0.5f;
+		bounds.radius = 0.0f;
+		for (size_t i = 0; i < vertexCount; i++) {
+			bounds.radius = std::max(bounds.radius, glm::length(vertices[i].Position - bounds.center));
+		}
+		return bounds;
+	}
+
+	void SetupVertexAttributes(VERTEX_FORMAT format) {
+
+		if (format == VERTEX_QUANTIZED) {
+
+			// Vertex Positions, normalized to the mesh bounds
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, Position));
+			// Vertex Normals
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, Normal));
+			// Vertex Texture Coords
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, TexCoords));
+			return;
+		}
+
+		// Vertex Positions
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
+		// Vertex Normals
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
+		// Vertex Texture Coords
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+	}
+
+	// Moves ranges to a mesh's place in shared buffers
+	static void OffsetRanges(std::vector<IndexRange>& ranges, size_t offset, GLint baseVertex) {
+
+		for (size_t i = 0; i < ranges.size(); i++) {
+
+			ranges[i].offset += offset;
+			ranges[i].baseVertex += baseVertex;
+		}
+	}
+
 	/* Mesh Constructor */
-	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures) {
+	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures, VERTEX_FORMAT format) {
 
 		this->vertices = vertices;
 		this->indices = indices;
 		this->textures = textures;
+		this->format = format;
 
 		this->setupMesh();
 	}
 
+	/* Mesh Constructor - from raw arrays, e.g. a memory mapped mesh cache */
+	Mesh::Mesh(const Vertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount, std::vector<Texture> textures, VERTEX_FORMAT format,
+	           const GLuint* lodIndices, const LodLevel* lods, size_t lodCount, const Meshlet* meshlets, size_t meshletCount,
+	           bool useArena) {
+
+		this->vertices.assign(vertices, vertices + vertexCount);
+		this->indices.assign(indices, indices + indexCount);
+		this->textures = textures;
+		this->format = format;
+
+		size_t lodIndexCount = 0;
+		for (size_t i = 0; i < lodCount; i++) {
+			lodIndexCount = std::max(lodIndexCount, (size_t)(lods[i].indexOffset + lods[i].indexCount));
+		}
+		this->lods.assign(lods, lods + lodCount);
+		this->lodIndices.assign(lodIndices, lodIndices + lodIndexCount);
+		this->meshlets.assign(meshlets, meshlets + meshletCount);
+
+		this->setupMesh(useArena);
+	}
+
 	Buffers Mesh::getBuffers() {
 	    return this->buffers;
 	}
 
+	bool Mesh::isInArena() {
+	    return this->arenaAllocation.pool >= 0;
+	}
+
+	void Mesh::releaseBuffers() {
+
+		if (isInArena()) {
+
+			GeometryArena::GetShared().release(this->arenaAllocation);
+			this->arenaAllocation.pool = -1;
+		}
+		else {
+
+			glDeleteBuffers(1, &this->buffers.VBO);
+			glDeleteBuffers(1, &this->buffers.EBO);
+			GLStateCache::GetShared().deleteVertexArrays(1, &this->buffers.VAO);
+		}
+		this->buffers.VAO = this->buffers.VBO = this->buffers.EBO = 0;
+	}
+
+	QuantizationError Mesh::getQuantizationError() {
+	    return this->quantizationError;
+	}
+
+	Bounds Mesh::getBounds() {
+	    return this->bounds;
+	}
+
+	GLenum Mesh::getIndexType() {
+	    return this->indexType;
+	}
+
+	glm::vec3 Mesh::getPositionScale() {
+	    return this->positionScale;
+	}
+
+	glm::vec3 Mesh::getPositionOffset() {
+	    return this->positionOffset;
+	}
+
+	size_t Mesh::selectLod(const DrawContext& context) {
+
+		size_t lod = 0;
+		for (size_t i = 0; i < this->lods.size(); i++) {
+
+			if (GetScreenError(this->lods[i].error, this->bounds.center, this->bounds.radius, context) > context.maxScreenError) {
+				break;
+			}
+			lod = i + 1;
+		}
+		return lod;
+	}
+
+	size_t Mesh::getTriangleCount(size_t lod) {
+
+		return (lod == 0 ? this->indices.size() : this->lods[lod - 1].indexCount) / 3;
+	}
+
 	/* Mesh drawing function - also applies associated textures */
-	void Mesh::Draw(gps::Shader shader)	{
+	void Mesh::Draw(gps::Shader& shader)	{
 
-		shader.useShaderProgram();
+		drawRanges(shader, this->lodRanges[0].data(), this->lodRanges[0].size());
+	}
+
+	size_t Mesh::Draw(gps::Shader& shader, const DrawContext& context) {
+
+		const IndexRange* ranges;
+		size_t rangeCount;
+		size_t triangles = selectRanges(context, ranges, rangeCount);
+
+		drawRanges(shader, ranges, rangeCount);
+		return triangles;
+	}
+
+	size_t Mesh::getDrawRanges(const DrawContext& context, std::vector<IndexRange>& ranges) {
+
+		const IndexRange* selected;
+		size_t selectedCount;
+		size_t triangles = selectRanges(context, selected, selectedCount);
+
+		ranges.insert(ranges.end(), selected, selected + selectedCount);
+		return triangles;
+	}
+
+	size_t Mesh::selectRanges(const DrawContext& context, const IndexRange*& ranges, size_t& rangeCount) {
+
+		size_t lod = selectLod(context);
+		if (lod > 0 || !context.cullClusters || this->meshlets.empty()) {
+
+			ranges = this->lodRanges[lod].data();
+			rangeCount = this->lodRanges[lod].size();
+			return getTriangleCount(lod);
+		}
+
+		ClusterCullStats stats = {};
+		this->visibleMeshlets.clear();
+		CullMeshlets(this->meshlets, context, this->visibleMeshlets, stats);
+
+		this->visibleRanges.clear();
+		for (size_t i = 0; i < this->visibleMeshlets.size(); i++) {
+
+			GLuint meshlet = this->visibleMeshlets[i];
+			this->visibleRanges.insert(this->visibleRanges.end(), this->meshletRanges.begin() + this->meshletRangeStarts[meshlet],
+				this->meshletRanges.begin() + this->meshletRangeStarts[meshlet + 1]);
+		}
+
+		ranges = this->visibleRanges.data();
+		rangeCount = this->visibleRanges.size();
+		return stats.visibleTriangles;
+	}
+
+	void Mesh::bindTextures(gps::Shader& shader) {
 
-		//set textures
+		GLStateCache& state = GLStateCache::GetShared();
+
+		//set textures, left bound afterwards: the next mesh usually shares them
+		bool provided[UNIFORM_KNOWN_COUNT + 1] = {};
 		for (GLuint i = 0; i < textures.size(); i++) {
 
-			glActiveTexture(GL_TEXTURE0 + i);
-			glUniform1i(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()), i);
-			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
+			shader.setUniform(shader.getKnownUniformId(this->textureUniforms[i]), (GLint)i);
+			state.bindTexture(i, GL_TEXTURE_2D, this->textures[i].id);
+			provided[this->textureUniforms[i]] = true;
+		}
+
+		// material samplers without a texture read texture 0 from the unit past the mesh's own, as they did when
+		// every draw unbound its textures, instead of whatever the previous mesh left bound
+		static const SHADER_UNIFORM materialSamplers[] = { UNIFORM_AMBIENT_TEXTURE, UNIFORM_DIFFUSE_TEXTURE, UNIFORM_SPECULAR_TEXTURE };
+		GLuint emptyUnit = (GLuint)this->textures.size();
+		for (size_t i = 0; i < sizeof(materialSamplers) / sizeof(materialSamplers[0]); i++) {
+
+			int samplerId = shader.getKnownUniformId(materialSamplers[i]);
+			if (!provided[materialSamplers[i]] && samplerId != -1) {
+
+				shader.setUniform(samplerId, (GLint)emptyUnit);
+				state.bindTexture(emptyUnit, GL_TEXTURE_2D, 0);
+			}
+		}
+	}
+
+	void Mesh::drawRanges(gps::Shader& shader, const IndexRange* ranges, size_t rangeCount) {
+
+		if (rangeCount == 0) {
+			return;
+		}
+
+		shader.useShaderProgram();
+
+		// identity for float vertices, the shaders always apply it
+		shader.setUniform(shader.getKnownUniformId(UNIFORM_POSITION_SCALE), this->positionScale);
+		shader.setUniform(shader.getKnownUniformId(UNIFORM_POSITION_OFFSET), this->positionOffset);
+		// the uniforms above, not a draw record of the arena
+		shader.setUniform(shader.getKnownUniformId(UNIFORM_DRAW_BASE), -1);
+
+		bindTextures(shader);
+
+		this->drawCounts.resize(rangeCount);
+		this->drawOffsets.resize(rangeCount);
+		this->drawBaseVertices.resize(rangeCount);
+		for (size_t i = 0; i < rangeCount; i++) {
+
+			this->drawCounts[i] = ranges[i].count;
+			this->drawOffsets[i] = (const GLvoid*)ranges[i].offset;
+			this->drawBaseVertices[i] = ranges[i].baseVertex;
+		}
+
+		GLStateCache::GetShared().bindVertexArray(this->buffers.VAO);
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, this->drawCounts.data(), this->indexType, this->drawOffsets.data(), (GLsizei)rangeCount, this->drawBaseVertices.data());
+	}
+
+	// Splits every meshlet along the draw ranges of the full-detail level
+	void Mesh::setupMeshletRanges() {
+
+		size_t indexSize = this->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		const std::vector<IndexRange>& levelRanges = this->lodRanges[0];
+
+		this->meshletRanges.clear();
+		this->meshletRangeStarts.assign(1, 0);
+
+		size_t r = 0;
+		for (size_t i = 0; i < this->meshlets.size(); i++) {
+
+			size_t first = this->meshlets[i].indexOffset;
+			size_t last = first + this->meshlets[i].indexCount;
+
+			while (r < levelRanges.size() && levelRanges[r].offset / indexSize + levelRanges[r].count <= first) {
+				r++;
+			}
+
+			// ranges break on triangles, so a meshlet rarely straddles more than two
+			for (size_t k = r; k < levelRanges.size() && levelRanges[k].offset / indexSize < last; k++) {
+
+				size_t rangeFirst = levelRanges[k].offset / indexSize;
+				size_t pieceFirst = std::max(first, rangeFirst);
+				size_t pieceLast = std::min(last, rangeFirst + levelRanges[k].count);
+
+				IndexRange piece = {(GLsizei)(pieceLast - pieceFirst), levelRanges[k].offset + (pieceFirst - rangeFirst) * indexSize, levelRanges[k].baseVertex};
+				this->meshletRanges.push_back(piece);
+			}
+
+			this->meshletRangeStarts.push_back(this->meshletRanges.size());
 		}
+	}
+
+	// Packs the vertices for VERTEX_QUANTIZED and measures the error
+	std::vector<PackedVertex> Mesh::quantizeVertices() {
+
+		glm::vec3 minimum = this->bounds.minimum;
 
-		glBindVertexArray(this->buffers.VAO);
-		glDrawElements(GL_TRIANGLES, (GLsizei)this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+		this->positionOffset = minimum;
+		this->positionScale = this->bounds.maximum - minimum;
 
-        for(GLuint i = 0; i < this->textures.size(); i++) {
+		std::vector<PackedVertex> packed(this->vertices.size());
+		for (size_t i = 0; i < this->vertices.size(); i++) {
 
-            glActiveTexture(GL_TEXTURE0 + i);
-            glBindTexture(GL_TEXTURE_2D, 0);
-        }
+			const Vertex& vertex = this->vertices[i];
+			PackedVertex& target = packed[i];
 
-    }
+			glm::vec3 decodedPosition;
+			for (int c = 0; c < 3; c++) {
+
+				float extent = this->positionScale[c];
+				float normalized = extent > 0.0f ? (vertex.Position[c] - minimum[c]) / extent : 0.0f;
+				target.Position[c] = (GLushort)(std::max(0.0f, std::min(1.0f, normalized)) * 65535.0f + 0.5f);
+				decodedPosition[c] = minimum[c] + target.Position[c] / 65535.0f * extent;
+			}
+			target.Position[3] = 0;
+
+			glm::vec3 decodedNormal;
+			target.Normal = PackNormal(vertex.Normal, decodedNormal);
+
+			glm::vec2 decodedTexCoords;
+			for (int c = 0; c < 2; c++) {
+
+				target.TexCoords[c] = FloatToHalf(vertex.TexCoords[c]);
+				decodedTexCoords[c] = HalfToFloat(target.TexCoords[c]);
+			}
+
+			QuantizationError& error = this->quantizationError;
+			error.position = std::max(error.position, glm::length(decodedPosition - vertex.Position));
+			error.texCoords = std::max(error.texCoords, std::max(fabsf(decodedTexCoords.x - vertex.TexCoords.x), fabsf(decodedTexCoords.y - vertex.TexCoords.y)));
+
+			float normalLength = glm::length(vertex.Normal) * glm::length(decodedNormal);
+			if (normalLength > 0.0f) {
+
+				float cosine = std::max(-1.0f, std::min(1.0f, glm::dot(vertex.Normal, decodedNormal) / normalLength));
+				error.normal = std::max(error.normal, glm::degrees(acosf(cosine)));
+			}
+		}
+
+		return packed;
+	}
 
 	// Initializes all the buffer objects/arrays
-	void Mesh::setupMesh() {
+	void Mesh::setupMesh(bool useArena) {
+
+		this->positionScale = glm::vec3(1.0f);
+		this->positionOffset = glm::vec3(0.0f);
+		this->quantizationError = QuantizationError();
+		this->arenaAllocation.pool = -1;
+
+		this->textureUniforms.clear();
+		for (size_t i = 0; i < this->textures.size(); i++) {
+			this->textureUniforms.push_back(GetTextureUniform(this->textures[i].type));
+		}
+
+		// for culling, the LOD selection and the position quantization
+		this->bounds = ComputeBounds(this->vertices.data(), this->vertices.size());
+
+		// all levels share the EBO, the full mesh first
+		std::vector<const GLuint*> levelIndices(1, this->indices.data());
+		std::vector<size_t> levelCounts(1, this->indices.size());
+		for (size_t i = 0; i < this->lods.size(); i++) {
+
+			levelIndices.push_back(this->lodIndices.data() + this->lods[i].indexOffset);
+			levelCounts.push_back(this->lods[i].indexCount);
+		}
+
+		this->lodRanges.assign(levelIndices.size(), std::vector<IndexRange>());
+
+		std::vector<GLushort> shortIndices;
+		bool useShortIndices = true;
+		for (size_t i = 0; i < levelIndices.size() && useShortIndices; i++) {
+			useShortIndices = AppendShortIndices(levelIndices[i], levelCounts[i], this->vertices.size(), shortIndices, this->lodRanges[i]);
+		}
+
+		std::vector<GLuint> allIndices;
+		if (!useShortIndices) {
+
+			for (size_t i = 0; i < levelIndices.size(); i++) {
+
+				IndexRange range = {(GLsizei)levelCounts[i], allIndices.size() * sizeof(GLuint), 0};
+				this->lodRanges[i].assign(1, range);
+				allIndices.insert(allIndices.end(), levelIndices[i], levelIndices[i] + levelCounts[i]);
+			}
+		}
+
+		this->indexType = useShortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		size_t indexSize = useShortIndices ? sizeof(GLushort) : sizeof(GLuint);
+		size_t indexCount = useShortIndices ? shortIndices.size() : allIndices.size();
+		const GLvoid* indexData = useShortIndices ? (const GLvoid*)shortIndices.data() : (const GLvoid*)allIndices.data();
+
+		setupMeshletRanges();
+
+		std::vector<PackedVertex> packed;
+		if (this->format == VERTEX_QUANTIZED) {
+			packed = quantizeVertices();
+		}
+		size_t vertexSize = this->format == VERTEX_QUANTIZED ? sizeof(PackedVertex) : sizeof(Vertex);
+		const GLvoid* vertexData = this->format == VERTEX_QUANTIZED ? (const GLvoid*)packed.data() : (const GLvoid*)this->vertices.data();
+
+		if (useArena) {
+
+			GeometryArena& arena = GeometryArena::GetShared();
+			this->arenaAllocation = arena.allocate(this->format, this->indexType, vertexData, this->vertices.size(), indexData, indexCount);
+			if (this->arenaAllocation.pool >= 0) {
+
+				// the ranges move to where the pool keeps the mesh
+				size_t offset = this->arenaAllocation.firstIndex * indexSize;
+				GLint baseVertex = (GLint)this->arenaAllocation.firstVertex;
+				for (size_t i = 0; i < this->lodRanges.size(); i++) {
+					OffsetRanges(this->lodRanges[i], offset, baseVertex);
+				}
+				OffsetRanges(this->meshletRanges, offset, baseVertex);
+
+				this->buffers.VAO = arena.getVertexArray(this->arenaAllocation.pool);
+				this->buffers.VBO = 0;
+				this->buffers.EBO = 0;
+				return;
+			}
+		}
 
 		// Create buffers/arrays
 		glGenVertexArrays(1, &this->buffers.VAO);
 		glGenBuffers(1, &this->buffers.VBO);
 		glGenBuffers(1, &this->buffers.EBO);
 
-		glBindVertexArray(this->buffers.VAO);
-		// Load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.VBO);
-		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
+		GLStateCache::GetShared().bindVertexArray(this->buffers.VAO);
 
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * indexSize, indexData, GL_STATIC_DRAW);
+
+		// Load data into vertex buffers
+		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.VBO);
+		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * vertexSize, vertexData, GL_STATIC_DRAW);
 
 		// Set the vertex attribute pointers
-		// Vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
-		// Vertex Normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
-		// Vertex Texture Coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+		SetupVertexAttributes(this->format);
 
-		glBindVertexArray(0);
+		// unbound so no later element buffer bind lands in this mesh's array
+		GLStateCache::GetShared().bindVertexArray(0);
 	}
 }
@@ -19,6 +19,8 @@
 
 namespace gps {
 
+    class OcclusionBuffer;
+
     struct Vertex {
 
         glm::vec3 Position;
@@ -26,6 +28,28 @@ namespace gps {
         glm::vec2 TexCoords;
     };
 
+    // Layout of the vertex buffer on the GPU. VERTEX_QUANTIZED packs a Vertex into 16 bytes:
+    // positions as 16 bit unorm relative to the mesh bounds, normals as 10:10:10:2 snorm and
+    // half float texture coordinates. Shaders decode positions with positionScale/positionOffset.
+    enum VERTEX_FORMAT {VERTEX_FLOAT, VERTEX_QUANTIZED};
+
+    struct PackedVertex {
+
+        GLushort Position[4];
+        GLuint Normal;
+        GLushort TexCoords[2];
+    };
+
+    // Largest differences between the float vertices and what the shaders decode from the packed ones
+    struct QuantizationError {
+
+        // in model units
+        float position;
+        // angle in degrees
+        float normal;
+        float texCoords;
+    };
+
     struct Texture {
 
         GLuint id;
@@ -41,31 +65,233 @@ namespace gps {
         glm::vec3 specular;
     };
 
+    // Material as read from the .mtl file, texture names are relative to the model folder
+    struct MaterialData {
+
+        Material colors;
+        std::string ambientTexture;
+        std::string diffuseTexture;
+        std::string specularTexture;
+    };
+
+    // One coarser level of detail, drawn from the same vertices as the full mesh
+    struct LodLevel {
+
+        // range in MeshData::lodIndices
+        GLuint indexOffset;
+        GLuint indexCount;
+        // largest deviation from the full-detail surface, in model units
+        float error;
+    };
+
+    // Run of consecutive triangles of the full-detail index buffer with the bounds the cluster culler tests
+    struct Meshlet {
+
+        // range in MeshData::indices
+        GLuint indexOffset;
+        GLuint indexCount;
+        // bounding sphere
+        glm::vec3 center;
+        float radius;
+        // every triangle faces away from cameras with dot(center - camera, coneAxis) >= coneCutoff * |center - camera| + radius
+        glm::vec3 coneAxis;
+        // sine of the normal cone's half angle, 1 if the triangles face too many ways to ever be culled
+        float coneCutoff;
+    };
+
+    // CPU-side geometry of one mesh, before it is uploaded to the GPU
+    struct MeshData {
+
+        std::vector<Vertex> vertices;
+        std::vector<GLuint> indices;
+        // index buffers of the levels of detail back to back, from fine to coarse
+        std::vector<GLuint> lodIndices;
+        std::vector<LodLevel> lods;
+        // clusters of the full-detail level, in index order
+        std::vector<Meshlet> meshlets;
+        // index into the material table, -1 if the mesh has no material
+        int materialId;
+    };
+
+    // Axis aligned box and the sphere around its center, in model space
+    struct Bounds {
+
+        glm::vec3 minimum;
+        glm::vec3 maximum;
+        glm::vec3 center;
+        float radius;
+    };
+
+    // Box around the positions and the sphere around the box center that holds them all
+    Bounds ComputeBounds(const Vertex* vertices, size_t vertexCount);
+
     struct Buffers {
         GLuint VAO;
         GLuint VBO;
         GLuint EBO;
     };
 
+    // Triangles drawn with one call: count indices starting at offset bytes into the EBO,
+    // each index relative to baseVertex
+    struct IndexRange {
+        GLsizei count;
+        size_t offset;
+        GLint baseVertex;
+    };
+
+    // Where the geometry of a mesh is in the GeometryArena, in vertices and indices of its pool
+    struct ArenaAllocation {
+        // -1 for meshes with buffers of their own
+        int pool;
+        size_t firstVertex;
+        size_t vertexCount;
+        size_t firstIndex;
+        size_t indexCount;
+    };
+
+    // Points attributes 0 to 2 of the bound vertex array at the bound GL_ARRAY_BUFFER, laid out as format
+    void SetupVertexAttributes(VERTEX_FORMAT format);
+
+    // Counters of one pass, filled by Model3D::Draw when DrawContext::stats points to them
+    struct DrawStats {
+
+        size_t meshes;
+        size_t frustumCulled;
+        size_t occlusionCulled;
+        size_t triangles;
+    };
+
+    // What the LOD selection and the mesh and cluster cullers need to know about the current view, see MakeDrawContext
+    struct DrawContext {
+
+        glm::mat4 model;
+        glm::mat4 viewProjection;
+        glm::vec3 cameraPosition;
+        // world space, normals point inside
+        glm::vec4 frustumPlanes[6];
+        glm::vec2 viewportSize;
+        // samples per pixel of the framebuffer drawn into, the meshlet pixel grid test only runs for 1
+        int sampleCount;
+        // pixels covered by one world unit at distance one, or at any distance for orthographic projections
+        float projectionScale;
+        bool orthographic;
+        // coarsest level whose error stays below this many pixels is drawn
+        float maxScreenError;
+        // skip meshes whose bounding box is outside the frustum planes, see FrustumCulling
+        bool cullMeshes;
+        // test the meshlets of full-detail meshes against the frustum, their facing and, without multisampling,
+        // the pixel grid; off for passes that do not render from this camera
+        bool cullClusters;
+        // skip meshes and meshlets hidden behind the occluders rasterized for this camera, NULL for none
+        const OcclusionBuffer* occlusion;
+        // accumulates what was culled and drawn, NULL to skip counting
+        DrawStats* stats;
+    };
+
+    DrawContext MakeDrawContext(glm::mat4 model, glm::mat4 view, glm::mat4 projection, int viewportWidth, int viewportHeight, float maxScreenError = 1.0f);
+
+    // World space planes of a view projection matrix, normals pointing inside: left, right, bottom, top, near, far
+    void ExtractFrustumPlanes(glm::mat4 viewProjection, glm::vec4 planes[6]);
+
+    // Projected size in pixels of a model space error on an object with the given bounding sphere,
+    // measured at the point of the sphere closest to the camera (anywhere for orthographic projections)
+    float GetScreenError(float error, glm::vec3 center, float radius, const DrawContext& context);
+
     class Mesh {
 
     public:
         std::vector<Vertex> vertices;
         std::vector<GLuint> indices;
         std::vector<Texture> textures;
+        std::vector<GLuint> lodIndices;
+        std::vector<LodLevel> lods;
+        std::vector<Meshlet> meshlets;
+
+	    Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures, VERTEX_FORMAT format = VERTEX_FLOAT);
 
-	    Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures);
+	    // useArena puts the vertices and indices in the shared GeometryArena instead of buffers of the mesh's own
+	    Mesh(const Vertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount, std::vector<Texture> textures, VERTEX_FORMAT format = VERTEX_FLOAT,
+	         const GLuint* lodIndices = NULL, const LodLevel* lods = NULL, size_t lodCount = 0, const Meshlet* meshlets = NULL, size_t meshletCount = 0,
+	         bool useArena = false);
 
+	    // VBO and EBO are 0 for meshes in the GeometryArena, VAO is their pool's
 	    Buffers getBuffers();
 
-	    void Draw(gps::Shader shader);
+	    bool isInArena();
+
+	    // Deletes the buffers, or gives the mesh's space in the arena back
+	    void releaseBuffers();
+
+	    QuantizationError getQuantizationError();
+
+	    Bounds getBounds();
+
+	    // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, as stored in the EBO
+	    GLenum getIndexType();
+
+	    // What the shaders' positionScale and positionOffset must be for this mesh
+	    glm::vec3 getPositionScale();
+	    glm::vec3 getPositionOffset();
+
+	    // Level 0 is the full mesh, levels 1 and up are the entries of lods
+	    size_t selectLod(const DrawContext& context);
+
+	    // Triangles drawn at a level of detail
+	    size_t getTriangleCount(size_t lod);
+
+	    void Draw(gps::Shader& shader);
+
+	    // Draws the level picked by selectLod, at full detail only the meshlets that pass the cluster culler.
+	    // Returns the number of triangles drawn.
+	    size_t Draw(gps::Shader& shader, const DrawContext& context);
+
+	    // Appends the ranges Draw would issue for the context instead of drawing them, for batching.
+	    // Returns the number of triangles in them.
+	    size_t getDrawRanges(const DrawContext& context, std::vector<IndexRange>& ranges);
+
+	    // Binds the textures to units 0 and up and points the shader's samplers at them
+	    void bindTextures(gps::Shader& shader);
 
     private:
         /*  Render data  */
         Buffers buffers;
+        ArenaAllocation arenaAllocation;
+        VERTEX_FORMAT format;
+        // decoded position = positionOffset + packed position * positionScale
+        glm::vec3 positionScale;
+        glm::vec3 positionOffset;
+        QuantizationError quantizationError;
+        GLenum indexType;
+        // draw ranges of every level, the full mesh first
+        std::vector<std::vector<IndexRange> > lodRanges;
+        // draw ranges of every meshlet, meshlet i owns entries meshletRangeStarts[i] until meshletRangeStarts[i + 1]
+        std::vector<IndexRange> meshletRanges;
+        std::vector<size_t> meshletRangeStarts;
+        // per frame scratch for the culler and glMultiDrawElementsBaseVertex
+        std::vector<GLuint> visibleMeshlets;
+        std::vector<IndexRange> visibleRanges;
+        // sampler of each texture, resolved from its type once
+        std::vector<SHADER_UNIFORM> textureUniforms;
+        std::vector<GLsizei> drawCounts;
+        std::vector<const GLvoid*> drawOffsets;
+        std::vector<GLint> drawBaseVertices;
+        Bounds bounds;
+
+	    // Packs the vertices for VERTEX_QUANTIZED and measures the error
+	    std::vector<PackedVertex> quantizeVertices();
+
+	    // Picks the level and, at full detail, the meshlets to draw for the context. Returns the number of
+	    // triangles; ranges points into lodRanges or visibleRanges.
+	    size_t selectRanges(const DrawContext& context, const IndexRange*& ranges, size_t& rangeCount);
+
+	    // Binds the textures and position decoding, then issues the draws
+	    void drawRanges(gps::Shader& shader, const IndexRange* ranges, size_t rangeCount);
+
+	    // Splits every meshlet along the draw ranges of the full-detail level
+	    void setupMeshletRanges();
 
 	    // Initializes all the buffer objects/arrays
-	    void setupMesh();
+	    void setupMesh(bool useArena = false);
 
     };
 
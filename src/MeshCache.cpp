@@ -0,0 +1,411 @@
+#include "MeshCache.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+namespace gps {
+
+    static const char CACHE_MAGIC[4] = { 'G', 'P', 'S', 'M' };
+    static const size_t BLOB_ALIGNMENT = 16;
+
+    struct CacheHeader {
+
+        char magic[4];
+        uint32_t version;
+        uint64_t sourceHash;
+        uint32_t flags;
+        uint32_t materialCount;
+        uint32_t meshCount;
+        uint32_t reserved;
+        uint64_t faceVertexCount;
+    };
+
+    struct CacheMeshEntry {
+
+        int32_t materialId;
+        uint32_t vertexCount;
+        uint32_t indexCount;
+        uint32_t lodCount;
+        uint32_t lodIndexCount;
+        uint32_t meshletCount;
+        uint64_t vertexOffset;
+        uint64_t indexOffset;
+        uint64_t lodOffset;
+        uint64_t lodIndexOffset;
+        uint64_t meshletOffset;
+    };
+
+    // Multiplicative hash over four independent 64-bit lanes, fast enough to be bound by memory bandwidth
+    static uint64_t HashBytes(const unsigned char* bytes, size_t size, uint64_t hash) {
+
+        const uint64_t multiplier = 0x9E3779B97F4A7C15ULL;
+        uint64_t lanes[4] = { hash, hash ^ 0x6A09E667F3BCC909ULL, hash ^ 0xBB67AE8584CAA73BULL, hash ^ 0x3C6EF372FE94F82BULL };
+
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32) {
+
+            uint64_t words[4];
+            memcpy(words, bytes + i, sizeof(words));
+            for (int lane = 0; lane < 4; lane++) {
+
+                lanes[lane] = (lanes[lane] ^ words[lane]) * multiplier;
+                lanes[lane] ^= lanes[lane] >> 29;
+            }
+        }
+
+        hash = lanes[0];
+        for (int lane = 1; lane < 4; lane++) {
+            hash = (hash ^ lanes[lane]) * multiplier;
+            hash ^= hash >> 29;
+        }
+
+        for (; i < size; i++) {
+
+            hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+        }
+
+        return hash ^ size;
+    }
+
+    // Collects the file names of every "mtllib" statement
+    static std::vector<std::string> FindMaterialLibraries(const unsigned char* bytes, size_t size) {
+
+        std::vector<std::string> libraries;
+        const char* begin = (const char*)bytes;
+        const char* end = begin + size;
+        const char* current = begin;
+
+        // 'm' is rare in .obj files, so jumping between its occurrences is cheap
+        while (current < end) {
+
+            current = (const char*)memchr(current, 'm', (size_t)(end - current));
+            if (!current) {
+                break;
+            }
+
+            bool lineStart = current == begin || current[-1] == '\n';
+            if (lineStart && end - current > 7 && memcmp(current, "mtllib", 6) == 0 && (current[6] == ' ' || current[6] == '\t')) {
+
+                const char* name = current + 7;
+                while (name < end && (*name == ' ' || *name == '\t')) {
+                    name++;
+                }
+                const char* nameEnd = name;
+                while (nameEnd < end && *nameEnd != ' ' && *nameEnd != '\t' && *nameEnd != '\r' && *nameEnd != '\n') {
+                    nameEnd++;
+                }
+                libraries.push_back(std::string(name, nameEnd));
+                current = nameEnd;
+            }
+            else {
+                current++;
+            }
+        }
+
+        return libraries;
+    }
+
+    static void AppendBytes(std::vector<unsigned char>& buffer, const void* bytes, size_t size) {
+
+        const unsigned char* source = (const unsigned char*)bytes;
+        buffer.insert(buffer.end(), source, source + size);
+    }
+
+    static void AppendString(std::vector<unsigned char>& buffer, const std::string& value) {
+
+        uint32_t length = (uint32_t)value.size();
+        AppendBytes(buffer, &length, sizeof(length));
+        AppendBytes(buffer, value.data(), value.size());
+        // keep the following fields 4 byte aligned
+        buffer.resize((buffer.size() + 3) & ~(size_t)3, 0);
+    }
+
+    static void AlignBuffer(std::vector<unsigned char>& buffer, size_t alignment) {
+
+        buffer.resize((buffer.size() + alignment - 1) & ~(alignment - 1), 0);
+    }
+
+    // Bounds-checked reader over the mapped cache file
+    struct CacheReader {
+
+        const unsigned char* data;
+        size_t size;
+        size_t offset;
+
+        bool Read(void* destination, size_t count) {
+
+            if (count > size - offset) {
+                return false;
+            }
+            memcpy(destination, data + offset, count);
+            offset += count;
+            return true;
+        }
+
+        bool ReadString(std::string& value) {
+
+            uint32_t length;
+            if (!Read(&length, sizeof(length)) || length > size - offset) {
+                return false;
+            }
+            value.assign((const char*)data + offset, length);
+            offset = (offset + length + 3) & ~(size_t)3;
+            return offset <= size;
+        }
+    };
+
+    uint64_t MeshCache::ComputeSourceHash(std::string fileName, std::string basePath) {
+
+        MappedFile objFile;
+        if (!objFile.open(fileName)) {
+            return 0;
+        }
+
+        uint64_t hash = HashBytes(objFile.getData(), objFile.getSize(), 0xCBF29CE484222325ULL);
+
+        std::vector<std::string> libraries = FindMaterialLibraries(objFile.getData(), objFile.getSize());
+        for (size_t i = 0; i < libraries.size(); i++) {
+
+            MappedFile mtlFile;
+            if (mtlFile.open(basePath + libraries[i])) {
+                hash = HashBytes(mtlFile.getData(), mtlFile.getSize(), hash);
+            }
+            else {
+                // a missing library is part of the state too
+                hash = HashBytes((const unsigned char*)libraries[i].data(), libraries[i].size(), hash);
+            }
+        }
+
+        return hash;
+    }
+
+    std::string MeshCache::GetCacheFileName(std::string fileName) {
+
+        return fileName + ".meshcache";
+    }
+
+    bool MeshCache::Write(std::string cacheFileName, uint64_t sourceHash, uint32_t flags, const ModelData& data) {
+
+        std::vector<unsigned char> buffer;
+
+        CacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+        header.version = VERSION;
+        header.sourceHash = sourceHash;
+        header.flags = flags;
+        header.materialCount = (uint32_t)data.materials.size();
+        header.meshCount = (uint32_t)data.meshes.size();
+        header.faceVertexCount = data.faceVertexCount;
+        AppendBytes(buffer, &header, sizeof(header));
+
+        for (size_t i = 0; i < data.materials.size(); i++) {
+
+            const MaterialData& material = data.materials[i];
+            AppendBytes(buffer, &material.colors, sizeof(Material));
+            AppendString(buffer, material.ambientTexture);
+            AppendString(buffer, material.diffuseTexture);
+            AppendString(buffer, material.specularTexture);
+        }
+
+        // the mesh table is patched with the blob offsets once they are known
+        AlignBuffer(buffer, 8);
+        size_t meshTableOffset = buffer.size();
+        buffer.resize(buffer.size() + data.meshes.size() * sizeof(CacheMeshEntry), 0);
+
+        std::vector<CacheMeshEntry> entries(data.meshes.size());
+        for (size_t i = 0; i < data.meshes.size(); i++) {
+
+            const MeshData& mesh = data.meshes[i];
+            CacheMeshEntry& entry = entries[i];
+            memset(&entry, 0, sizeof(entry));
+            entry.materialId = mesh.materialId;
+            entry.vertexCount = (uint32_t)mesh.vertices.size();
+            entry.indexCount = (uint32_t)mesh.indices.size();
+            entry.lodCount = (uint32_t)mesh.lods.size();
+            entry.lodIndexCount = (uint32_t)mesh.lodIndices.size();
+            entry.meshletCount = (uint32_t)mesh.meshlets.size();
+
+            AlignBuffer(buffer, BLOB_ALIGNMENT);
+            entry.vertexOffset = buffer.size();
+            AppendBytes(buffer, mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+
+            AlignBuffer(buffer, BLOB_ALIGNMENT);
+            entry.indexOffset = buffer.size();
+            AppendBytes(buffer, mesh.indices.data(), mesh.indices.size() * sizeof(GLuint));
+
+            AlignBuffer(buffer, BLOB_ALIGNMENT);
+            entry.lodOffset = buffer.size();
+            AppendBytes(buffer, mesh.lods.data(), mesh.lods.size() * sizeof(LodLevel));
+
+            AlignBuffer(buffer, BLOB_ALIGNMENT);
+            entry.lodIndexOffset = buffer.size();
+            AppendBytes(buffer, mesh.lodIndices.data(), mesh.lodIndices.size() * sizeof(GLuint));
+
+            AlignBuffer(buffer, BLOB_ALIGNMENT);
+            entry.meshletOffset = buffer.size();
+            AppendBytes(buffer, mesh.meshlets.data(), mesh.meshlets.size() * sizeof(Meshlet));
+        }
+
+        if (!entries.empty()) {
+            memcpy(&buffer[meshTableOffset], entries.data(), entries.size() * sizeof(CacheMeshEntry));
+        }
+
+        // write to a temporary file first so an interrupted write never leaves a damaged cache
+        std::string temporaryFileName = cacheFileName + ".tmp";
+        FILE* file = fopen(temporaryFileName.c_str(), "wb");
+        if (!file) {
+            return false;
+        }
+
+        bool written = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+        written = (fclose(file) == 0) && written;
+
+        if (!written) {
+            remove(temporaryFileName.c_str());
+            return false;
+        }
+
+        remove(cacheFileName.c_str());
+        return rename(temporaryFileName.c_str(), cacheFileName.c_str()) == 0;
+    }
+
+    bool MeshCache::Open(std::string cacheFileName, uint64_t sourceHash, uint32_t flags) {
+
+        Close();
+
+        if (!file.open(cacheFileName)) {
+            return false;
+        }
+
+        CacheReader reader = { file.getData(), file.getSize(), 0 };
+
+        CacheHeader header;
+        if (!reader.Read(&header, sizeof(header)) ||
+            memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != VERSION ||
+            header.sourceHash != sourceHash ||
+            header.flags != flags) {
+
+            Close();
+            return false;
+        }
+
+        materials.resize(header.materialCount);
+        for (size_t i = 0; i < materials.size(); i++) {
+
+            MaterialData& material = materials[i];
+            if (!reader.Read(&material.colors, sizeof(Material)) ||
+                !reader.ReadString(material.ambientTexture) ||
+                !reader.ReadString(material.diffuseTexture) ||
+                !reader.ReadString(material.specularTexture)) {
+
+                Close();
+                return false;
+            }
+        }
+
+        reader.offset = (reader.offset + 7) & ~(size_t)7;
+        meshes.resize(header.meshCount);
+        for (size_t i = 0; i < meshes.size(); i++) {
+
+            CacheMeshEntry entry;
+            if (!reader.Read(&entry, sizeof(entry))) {
+                Close();
+                return false;
+            }
+
+            size_t vertexBytes = (size_t)entry.vertexCount * sizeof(Vertex);
+            size_t indexBytes = (size_t)entry.indexCount * sizeof(GLuint);
+            size_t lodBytes = (size_t)entry.lodCount * sizeof(LodLevel);
+            size_t lodIndexBytes = (size_t)entry.lodIndexCount * sizeof(GLuint);
+            size_t meshletBytes = (size_t)entry.meshletCount * sizeof(Meshlet);
+            if (entry.vertexOffset > reader.size || vertexBytes > reader.size - entry.vertexOffset ||
+                entry.indexOffset > reader.size || indexBytes > reader.size - entry.indexOffset ||
+                entry.lodOffset > reader.size || lodBytes > reader.size - entry.lodOffset ||
+                entry.lodIndexOffset > reader.size || lodIndexBytes > reader.size - entry.lodIndexOffset ||
+                entry.meshletOffset > reader.size || meshletBytes > reader.size - entry.meshletOffset ||
+                entry.materialId >= (int32_t)header.materialCount) {
+
+                Close();
+                return false;
+            }
+
+            // every level and meshlet has to lie inside its index blob
+            const Meshlet* meshlets = (const Meshlet*)(file.getData() + entry.meshletOffset);
+            for (uint32_t m = 0; m < entry.meshletCount; m++) {
+
+                if (meshlets[m].indexOffset > entry.indexCount || meshlets[m].indexCount > entry.indexCount - meshlets[m].indexOffset) {
+
+                    Close();
+                    return false;
+                }
+            }
+
+            const LodLevel* lods = (const LodLevel*)(file.getData() + entry.lodOffset);
+            for (uint32_t l = 0; l < entry.lodCount; l++) {
+
+                if (lods[l].indexOffset > entry.lodIndexCount || lods[l].indexCount > entry.lodIndexCount - lods[l].indexOffset) {
+
+                    Close();
+                    return false;
+                }
+            }
+
+            MeshView& view = meshes[i];
+            view.vertices = (const Vertex*)(file.getData() + entry.vertexOffset);
+            view.vertexCount = entry.vertexCount;
+            view.indices = (const GLuint*)(file.getData() + entry.indexOffset);
+            view.indexCount = entry.indexCount;
+            view.lodIndices = (const GLuint*)(file.getData() + entry.lodIndexOffset);
+            view.lods = lods;
+            view.lodCount = entry.lodCount;
+            view.meshlets = meshlets;
+            view.meshletCount = entry.meshletCount;
+            view.materialId = entry.materialId;
+        }
+
+        faceVertexCount = (size_t)header.faceVertexCount;
+        return true;
+    }
+
+    void MeshCache::Close() {
+
+        file.close();
+        meshes.clear();
+        materials.clear();
+        faceVertexCount = 0;
+    }
+
+    size_t MeshCache::getMeshCount() const {
+        return meshes.size();
+    }
+
+    MeshView MeshCache::getMesh(size_t index) const {
+        return meshes[index];
+    }
+
+    const std::vector<MaterialData>& MeshCache::getMaterials() const {
+        return materials;
+    }
+
+    size_t MeshCache::getFaceVertexCount() const {
+        return faceVertexCount;
+    }
+
+    MeshView GetMeshView(const MeshData& mesh) {
+
+        MeshView view;
+        view.vertices = mesh.vertices.data();
+        view.vertexCount = mesh.vertices.size();
+        view.indices = mesh.indices.data();
+        view.indexCount = mesh.indices.size();
+        view.lodIndices = mesh.lodIndices.data();
+        view.lods = mesh.lods.data();
+        view.lodCount = mesh.lods.size();
+        view.meshlets = mesh.meshlets.data();
+        view.meshletCount = mesh.meshlets.size();
+        view.materialId = mesh.materialId;
+        return view;
+    }
+}
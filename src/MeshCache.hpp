@@ -0,0 +1,74 @@
+#ifndef MeshCache_hpp
+#define MeshCache_hpp
+
+#include "Mesh.hpp"
+#include "MappedFile.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Everything the loader extracts from an .obj/.mtl pair, independent of OpenGL
+    struct ModelData {
+
+        std::vector<MeshData> meshes;
+        std::vector<MaterialData> materials;
+        // face corners in the source file, kept for the welding statistics
+        size_t faceVertexCount;
+    };
+
+    // Read-only view of one mesh, either inside ModelData or inside a mapped cache file
+    struct MeshView {
+
+        const Vertex* vertices;
+        size_t vertexCount;
+        const GLuint* indices;
+        size_t indexCount;
+        const GLuint* lodIndices;
+        const LodLevel* lods;
+        size_t lodCount;
+        const Meshlet* meshlets;
+        size_t meshletCount;
+        int materialId;
+    };
+
+    // Binary cache of a parsed model, stored next to the .obj as <name>.obj.meshcache
+    //
+    // Layout: header, material table, mesh table, then the vertex and index blobs of every
+    // mesh (vertices, indices, LOD table, LOD indices, meshlets), 16 byte aligned so they can be used in place from the mapped file.
+    class MeshCache {
+
+    public:
+        // bump whenever the layout or the processing applied to the meshes changes
+        static const uint32_t VERSION = 4;
+
+        // Hash of the .obj contents and of every .mtl library it references
+        static uint64_t ComputeSourceHash(std::string fileName, std::string basePath);
+
+        static std::string GetCacheFileName(std::string fileName);
+
+        // Serializes the model, returns false if the file could not be written
+        static bool Write(std::string cacheFileName, uint64_t sourceHash, uint32_t flags, const ModelData& data);
+
+        // Maps the cache file, returns false if it is missing, stale or damaged
+        bool Open(std::string cacheFileName, uint64_t sourceHash, uint32_t flags);
+        void Close();
+
+        size_t getMeshCount() const;
+        MeshView getMesh(size_t index) const;
+        const std::vector<MaterialData>& getMaterials() const;
+        size_t getFaceVertexCount() const;
+
+    private:
+        MappedFile file;
+        std::vector<MeshView> meshes;
+        std::vector<MaterialData> materials;
+        size_t faceVertexCount = 0;
+    };
+
+    MeshView GetMeshView(const MeshData& mesh);
+}
+
+#endif /* MeshCache_hpp */
@@ -0,0 +1,195 @@
+#include "MeshClusters.hpp"
+#include "OcclusionCulling.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace gps {
+
+    static Meshlet ComputeMeshletBounds(const MeshData& mesh, size_t indexOffset, size_t indexCount) {
+
+        Meshlet meshlet;
+        meshlet.indexOffset = (GLuint)indexOffset;
+        meshlet.indexCount = (GLuint)indexCount;
+
+        glm::vec3 minimum = mesh.vertices[mesh.indices[indexOffset]].Position;
+        glm::vec3 maximum = minimum;
+        for (size_t i = indexOffset; i < indexOffset + indexCount; i++) {
+
+            minimum = glm::min(minimum, mesh.vertices[mesh.indices[i]].Position);
+            maximum = glm::max(maximum, mesh.vertices[mesh.indices[i]].Position);
+        }
+
+        meshlet.center = (minimum + maximum) * 0.5f;
+        meshlet.radius = 0.0f;
+        for (size_t i = indexOffset; i < indexOffset + indexCount; i++) {
+            meshlet.radius = std::max(meshlet.radius, glm::length(mesh.vertices[mesh.indices[i]].Position - meshlet.center));
+        }
+
+        // the cone axis is the average face normal, its opening the widest angle to any face
+        std::vector<glm::vec3> normals;
+        glm::vec3 axis(0.0f);
+        for (size_t i = indexOffset; i + 2 < indexOffset + indexCount; i += 3) {
+
+            glm::vec3 p0 = mesh.vertices[mesh.indices[i]].Position;
+            glm::vec3 normal = glm::cross(mesh.vertices[mesh.indices[i + 1]].Position - p0, mesh.vertices[mesh.indices[i + 2]].Position - p0);
+            float length = glm::length(normal);
+            if (length > 0.0f) {
+
+                normals.push_back(normal / length);
+                axis += normal / length;
+            }
+        }
+
+        meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+        meshlet.coneCutoff = 1.0f;
+
+        float axisLength = glm::length(axis);
+        if (normals.empty() || axisLength == 0.0f) {
+            return meshlet;
+        }
+        axis /= axisLength;
+
+        float minimumDot = 1.0f;
+        for (size_t i = 0; i < normals.size(); i++) {
+            minimumDot = std::min(minimumDot, glm::dot(normals[i], axis));
+        }
+
+        // some face is at least 90 degrees from the axis, the cluster can be seen from anywhere
+        if (minimumDot <= 0.0f) {
+            return meshlet;
+        }
+
+        meshlet.coneAxis = axis;
+        meshlet.coneCutoff = sqrtf(1.0f - minimumDot * minimumDot);
+        return meshlet;
+    }
+
+    void BuildMeshlets(MeshData& mesh) {
+
+        mesh.meshlets.clear();
+
+        // last meshlet each vertex was counted for
+        std::vector<size_t> seen(mesh.vertices.size(), (size_t)-1);
+        size_t meshletStart = 0;
+        size_t meshletVertices = 0;
+
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+
+            size_t meshletIndex = mesh.meshlets.size();
+            size_t newVertices = 0;
+            for (int k = 0; k < 3; k++) {
+
+                // the corners of a degenerate triangle can repeat, count each vertex once
+                GLuint vertex = mesh.indices[i + k];
+                bool repeated = (k > 0 && vertex == mesh.indices[i]) || (k > 1 && vertex == mesh.indices[i + 1]);
+                if (seen[vertex] != meshletIndex && !repeated) {
+                    newVertices++;
+                }
+            }
+
+            if (i > meshletStart && (meshletVertices + newVertices > MESHLET_MAX_VERTICES || (i - meshletStart) / 3 >= MESHLET_MAX_TRIANGLES)) {
+
+                mesh.meshlets.push_back(ComputeMeshletBounds(mesh, meshletStart, i - meshletStart));
+                meshletStart = i;
+                meshletVertices = 0;
+                meshletIndex++;
+            }
+
+            for (int k = 0; k < 3; k++) {
+
+                if (seen[mesh.indices[i + k]] != meshletIndex) {
+
+                    seen[mesh.indices[i + k]] = meshletIndex;
+                    meshletVertices++;
+                }
+            }
+        }
+
+        if (mesh.indices.size() >= meshletStart + 3) {
+            mesh.meshlets.push_back(ComputeMeshletBounds(mesh, meshletStart, mesh.indices.size() - meshletStart));
+        }
+    }
+
+    void CullMeshlets(const std::vector<Meshlet>& meshlets, const DrawContext& context, std::vector<GLuint>& visible, ClusterCullStats& stats) {
+
+        glm::mat3 rotation = glm::mat3(context.model);
+        float scale = std::max(glm::length(rotation[0]), std::max(glm::length(rotation[1]), glm::length(rotation[2])));
+
+        for (size_t i = 0; i < meshlets.size(); i++) {
+
+            const Meshlet& meshlet = meshlets[i];
+            size_t triangles = meshlet.indexCount / 3;
+            stats.meshlets++;
+            stats.triangles += triangles;
+
+            glm::vec3 center = glm::vec3(context.model * glm::vec4(meshlet.center, 1.0f));
+            float radius = meshlet.radius * scale;
+
+            bool outside = false;
+            for (int p = 0; p < 6 && !outside; p++) {
+                outside = glm::dot(glm::vec3(context.frustumPlanes[p]), center) + context.frustumPlanes[p].w < -radius;
+            }
+            if (outside) {
+
+                stats.frustumCulled++;
+                continue;
+            }
+
+            glm::vec3 toCenter = center - context.cameraPosition;
+            float distance = glm::length(toCenter);
+
+            if (meshlet.coneCutoff < 1.0f) {
+
+                glm::vec3 axis = glm::normalize(rotation * meshlet.coneAxis);
+                if (glm::dot(toCenter, axis) >= meshlet.coneCutoff * distance + radius) {
+
+                    stats.backfaceCulled++;
+                    continue;
+                }
+            }
+
+            // screen space box of the box around the sphere, the corners bound its projection as long as
+            // they all lie in front of the camera
+            glm::vec4 clip = context.viewProjection * glm::vec4(center, 1.0f);
+            glm::vec4 axes[3] = { context.viewProjection[0] * radius, context.viewProjection[1] * radius, context.viewProjection[2] * radius };
+
+            glm::vec2 low(FLT_MAX);
+            glm::vec2 high(-FLT_MAX);
+            bool inFront = true;
+            for (int corner = 0; corner < 8 && inFront; corner++) {
+
+                glm::vec4 p = clip + (corner & 1 ? axes[0] : -axes[0]) + (corner & 2 ? axes[1] : -axes[1]) + (corner & 4 ? axes[2] : -axes[2]);
+                inFront = p.w > 0.0f;
+                low = glm::min(low, glm::vec2(p.x, p.y) / p.w);
+                high = glm::max(high, glm::vec2(p.x, p.y) / p.w);
+            }
+
+            // with multisampling the samples lie off the pixel centers, a box between them may still cover some
+            if (inFront && context.sampleCount <= 1) {
+
+                low = (low * 0.5f + 0.5f) * context.viewportSize;
+                high = (high * 0.5f + 0.5f) * context.viewportSize;
+
+                // pixel centers sit at k + 0.5, a box between two of them on either axis is never sampled
+                bool missesX = floorf(high.x - 0.5f) < ceilf(low.x - 0.5f);
+                bool missesY = floorf(high.y - 0.5f) < ceilf(low.y - 0.5f);
+                if (missesX || missesY) {
+
+                    stats.smallCulled++;
+                    continue;
+                }
+            }
+
+            if (context.occlusion != NULL && context.occlusion->isBoxOccluded(context.viewProjection, center - radius, center + radius)) {
+
+                stats.occlusionCulled++;
+                continue;
+            }
+
+            visible.push_back((GLuint)i);
+            stats.visibleTriangles += triangles;
+        }
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef MeshClusters_hpp
+#define MeshClusters_hpp
+
+#include "Mesh.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // A meshlet ends when the next triangle would exceed either limit
+    static const size_t MESHLET_MAX_VERTICES = 64;
+    static const size_t MESHLET_MAX_TRIANGLES = 128;
+
+    // Splits the optimized full-detail index buffer into meshlets of consecutive triangles, so the
+    // vertex cache order is kept, and computes their bounding spheres and normal cones
+    void BuildMeshlets(MeshData& mesh);
+
+    struct ClusterCullStats {
+
+        size_t meshlets;
+        size_t frustumCulled;
+        size_t backfaceCulled;
+        // the projected bounds fall between pixel centers without multisampling, so no triangle could produce a sample
+        size_t smallCulled;
+        // behind the occluders of DrawContext::occlusion
+        size_t occlusionCulled;
+        size_t triangles;
+        size_t visibleTriangles;
+    };
+
+    // Appends the meshlets that may be visible from the context's camera to visible and adds to stats
+    void CullMeshlets(const std::vector<Meshlet>& meshlets, const DrawContext& context, std::vector<GLuint>& visible, ClusterCullStats& stats);
+}
+
+#endif /* MeshClusters_hpp */
@@ -0,0 +1,392 @@
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    // Forsyth's scoring parameters, tuned for an LRU cache of this size
+    static const int OPTIMIZE_CACHE_SIZE = 32;
+    static const float CACHE_DECAY_POWER = 1.5f;
+    static const float LAST_TRIANGLE_SCORE = 0.75f;
+    static const float VALENCE_BOOST_SCALE = 2.0f;
+    static const float VALENCE_BOOST_POWER = 0.5f;
+    static const int MAX_VALENCE_SCORED = 32;
+
+    struct VertexScoreTable {
+
+        float cache[OPTIMIZE_CACHE_SIZE + 3];
+        float valence[MAX_VALENCE_SCORED + 1];
+
+        VertexScoreTable() {
+
+            for (int position = 0; position < OPTIMIZE_CACHE_SIZE + 3; position++) {
+
+                if (position < 3) {
+                    // the last triangle's vertices get a fixed score so it is not simply repeated
+                    cache[position] = LAST_TRIANGLE_SCORE;
+                }
+                else if (position < OPTIMIZE_CACHE_SIZE) {
+                    cache[position] = powf(1.0f - (float)(position - 3) / (OPTIMIZE_CACHE_SIZE - 3), CACHE_DECAY_POWER);
+                }
+                else {
+                    cache[position] = 0.0f;
+                }
+            }
+
+            valence[0] = 0.0f;
+            for (int count = 1; count <= MAX_VALENCE_SCORED; count++) {
+                // vertices with few triangles left are finished off first
+                valence[count] = VALENCE_BOOST_SCALE * powf((float)count, -VALENCE_BOOST_POWER);
+            }
+        }
+
+        float score(int cachePosition, unsigned int activeTriangles) const {
+
+            if (activeTriangles == 0) {
+                return -1.0f;
+            }
+
+            float result = cachePosition >= 0 ? cache[cachePosition] : 0.0f;
+            return result + valence[std::min(activeTriangles, (unsigned int)MAX_VALENCE_SCORED)];
+        }
+    };
+
+    // FIFO cache of ANALYZE_CACHE_SIZE entries, a vertex is cached while its insertion stamp is recent enough
+    struct FifoCache {
+
+        std::vector<size_t> stamps;
+        size_t timestamp;
+
+        explicit FifoCache(size_t vertexCount) : stamps(vertexCount, 0), timestamp(ANALYZE_CACHE_SIZE + 1) {}
+
+        void reset() {
+            timestamp += ANALYZE_CACHE_SIZE + 1;
+        }
+
+        // Returns the number of vertices of the triangle that had to be transformed
+        unsigned int access(const GLuint* triangle) {
+
+            unsigned int misses = 0;
+            for (int corner = 0; corner < 3; corner++) {
+
+                if (timestamp - stamps[triangle[corner]] > ANALYZE_CACHE_SIZE) {
+
+                    stamps[triangle[corner]] = timestamp++;
+                    misses++;
+                }
+            }
+            return misses;
+        }
+    };
+
+    VertexCacheStats AnalyzeVertexCache(const std::vector<GLuint>& indices, size_t vertexCount) {
+
+        VertexCacheStats stats = {};
+        stats.triangles = indices.size() / 3;
+
+        FifoCache cache(vertexCount);
+        for (size_t t = 0; t < stats.triangles; t++) {
+            stats.misses += cache.access(&indices[t * 3]);
+        }
+
+        std::vector<bool> referenced(vertexCount, false);
+        for (size_t i = 0; i < stats.triangles * 3; i++) {
+
+            if (!referenced[indices[i]]) {
+                referenced[indices[i]] = true;
+                stats.vertices++;
+            }
+        }
+
+        stats.acmr = stats.triangles > 0 ? (float)stats.misses / stats.triangles : 0.0f;
+        stats.atvr = stats.vertices > 0 ? (float)stats.misses / stats.vertices : 0.0f;
+        return stats;
+    }
+
+    void OptimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount) {
+
+        static const VertexScoreTable table;
+
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0) {
+            return;
+        }
+
+        // triangles of each vertex, the active ones first
+        std::vector<unsigned int> activeTriangles(vertexCount, 0);
+        for (size_t i = 0; i < triangleCount * 3; i++) {
+            activeTriangles[indices[i]]++;
+        }
+
+        std::vector<unsigned int> adjacencyOffsets(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; v++) {
+            adjacencyOffsets[v + 1] = adjacencyOffsets[v] + activeTriangles[v];
+        }
+
+        std::vector<unsigned int> adjacency(triangleCount * 3);
+        std::vector<unsigned int> filled(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t t = 0; t < triangleCount; t++) {
+            for (int corner = 0; corner < 3; corner++) {
+                adjacency[filled[indices[t * 3 + corner]]++] = (unsigned int)t;
+            }
+        }
+
+        std::vector<int> cachePositions(vertexCount, -1);
+        std::vector<float> vertexScores(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++) {
+            vertexScores[v] = table.score(-1, activeTriangles[v]);
+        }
+
+        std::vector<bool> emitted(triangleCount, false);
+        int bestTriangle = -1;
+        float bestScore = -1.0f;
+
+        for (size_t t = 0; t < triangleCount; t++) {
+
+            float score = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+            if (score > bestScore) {
+                bestScore = score;
+                bestTriangle = (int)t;
+            }
+        }
+
+        std::vector<GLuint> result;
+        result.reserve(triangleCount * 3);
+
+        GLuint cache[OPTIMIZE_CACHE_SIZE + 3];
+        GLuint nextCache[OPTIMIZE_CACHE_SIZE + 3];
+        int cacheCount = 0;
+        size_t scanCursor = 0;
+
+        while (result.size() < triangleCount * 3) {
+
+            // no candidate around the cache: continue with the next triangle in the original order
+            if (bestTriangle < 0) {
+
+                while (emitted[scanCursor]) {
+                    scanCursor++;
+                }
+                bestTriangle = (int)scanCursor;
+            }
+
+            const GLuint* triangle = &indices[(size_t)bestTriangle * 3];
+            emitted[bestTriangle] = true;
+
+            for (int corner = 0; corner < 3; corner++) {
+
+                GLuint vertex = triangle[corner];
+                result.push_back(vertex);
+
+                // move the emitted triangle behind the still active ones
+                unsigned int* begin = &adjacency[adjacencyOffsets[vertex]];
+                unsigned int* end = begin + activeTriangles[vertex];
+                unsigned int* found = std::find(begin, end, (unsigned int)bestTriangle);
+                std::swap(*found, *(end - 1));
+                activeTriangles[vertex]--;
+            }
+
+            // LRU update: the triangle's vertices go to the front
+            int nextCount = 0;
+            for (int corner = 0; corner < 3; corner++) {
+                nextCache[nextCount++] = triangle[corner];
+            }
+            for (int i = 0; i < cacheCount; i++) {
+
+                GLuint vertex = cache[i];
+                if (vertex != triangle[0] && vertex != triangle[1] && vertex != triangle[2]) {
+                    nextCache[nextCount++] = vertex;
+                }
+            }
+
+            for (int i = 0; i < nextCount; i++) {
+
+                GLuint vertex = nextCache[i];
+                cachePositions[vertex] = i < OPTIMIZE_CACHE_SIZE ? i : -1;
+                vertexScores[vertex] = table.score(cachePositions[vertex], activeTriangles[vertex]);
+            }
+
+            // rescore the triangles around the cache, the best of them is emitted next
+            bestTriangle = -1;
+            bestScore = -1.0f;
+            for (int i = 0; i < nextCount; i++) {
+
+                GLuint vertex = nextCache[i];
+                for (unsigned int a = 0; a < activeTriangles[vertex]; a++) {
+
+                    unsigned int t = adjacency[adjacencyOffsets[vertex] + a];
+                    float score = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+
+                    if (score > bestScore) {
+                        bestScore = score;
+                        bestTriangle = (int)t;
+                    }
+                }
+            }
+
+            cacheCount = std::min(nextCount, OPTIMIZE_CACHE_SIZE);
+            std::copy(nextCache, nextCache + cacheCount, cache);
+        }
+
+        indices.swap(result);
+    }
+
+    void OptimizeOverdraw(std::vector<GLuint>& indices, const std::vector<Vertex>& vertices, float threshold) {
+
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount < 2) {
+            return;
+        }
+
+        FifoCache cache(vertices.size());
+
+        // hard boundaries: triangles whose three vertices all miss start over anyway
+        std::vector<size_t> hardClusters;
+        for (size_t t = 0; t < triangleCount; t++) {
+
+            if (cache.access(&indices[t * 3]) == 3 || t == 0) {
+                hardClusters.push_back(t);
+            }
+        }
+
+        // soft boundaries: inside a hard cluster, start a new cluster (with a cold cache) as soon as
+        // the current one is within threshold of the whole hard cluster's ACMR
+        std::vector<size_t> clusters;
+        for (size_t c = 0; c < hardClusters.size(); c++) {
+
+            size_t begin = hardClusters[c];
+            size_t end = c + 1 < hardClusters.size() ? hardClusters[c + 1] : triangleCount;
+
+            cache.reset();
+            size_t clusterMisses = 0;
+            for (size_t t = begin; t < end; t++) {
+                clusterMisses += cache.access(&indices[t * 3]);
+            }
+            float clusterThreshold = threshold * (float)clusterMisses / (float)(end - begin);
+
+            clusters.push_back(begin);
+            cache.reset();
+            size_t runningMisses = 0;
+            size_t runningTriangles = 0;
+
+            for (size_t t = begin; t < end; t++) {
+
+                runningMisses += cache.access(&indices[t * 3]);
+                runningTriangles++;
+
+                if (t + 1 < end && (float)runningMisses / (float)runningTriangles <= clusterThreshold) {
+
+                    clusters.push_back(t + 1);
+                    cache.reset();
+                    runningMisses = 0;
+                    runningTriangles = 0;
+                }
+            }
+        }
+
+        // sort clusters by how much their area-weighted normal points away from the mesh center
+        glm::vec3 meshCentroid(0.0f);
+        float meshArea = 0.0f;
+        std::vector<glm::vec3> clusterCentroids(clusters.size(), glm::vec3(0.0f));
+        std::vector<glm::vec3> clusterNormals(clusters.size(), glm::vec3(0.0f));
+
+        for (size_t c = 0; c < clusters.size(); c++) {
+
+            size_t begin = clusters[c];
+            size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+            float clusterArea = 0.0f;
+
+            for (size_t t = begin; t < end; t++) {
+
+                glm::vec3 p0 = vertices[indices[t * 3]].Position;
+                glm::vec3 p1 = vertices[indices[t * 3 + 1]].Position;
+                glm::vec3 p2 = vertices[indices[t * 3 + 2]].Position;
+                glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+                float area = glm::length(normal);
+
+                clusterCentroids[c] += (p0 + p1 + p2) * (area / 3.0f);
+                clusterNormals[c] += normal;
+                clusterArea += area;
+            }
+
+            meshCentroid += clusterCentroids[c];
+            meshArea += clusterArea;
+            clusterCentroids[c] = clusterArea > 0.0f ? clusterCentroids[c] / clusterArea : vertices[indices[begin * 3]].Position;
+        }
+
+        if (meshArea > 0.0f) {
+            meshCentroid /= meshArea;
+        }
+
+        std::vector<float> sortKeys(clusters.size());
+        std::vector<size_t> order(clusters.size());
+        for (size_t c = 0; c < clusters.size(); c++) {
+
+            float normalLength = glm::length(clusterNormals[c]);
+            glm::vec3 direction = normalLength > 0.0f ? clusterNormals[c] / normalLength : glm::vec3(0.0f);
+            sortKeys[c] = glm::dot(clusterCentroids[c] - meshCentroid, direction);
+            order[c] = c;
+        }
+
+        std::stable_sort(order.begin(), order.end(), [&sortKeys](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+
+        std::vector<GLuint> result;
+        result.reserve(indices.size());
+        for (size_t i = 0; i < order.size(); i++) {
+
+            size_t c = order[i];
+            size_t begin = clusters[c];
+            size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+            result.insert(result.end(), indices.begin() + begin * 3, indices.begin() + end * 3);
+        }
+
+        indices.swap(result);
+    }
+
+    void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices) {
+
+        const GLuint unused = ~0u;
+        std::vector<GLuint> remap(vertices.size(), unused);
+        std::vector<Vertex> result;
+        result.reserve(vertices.size());
+
+        for (size_t i = 0; i < indices.size(); i++) {
+
+            GLuint& target = remap[indices[i]];
+            if (target == unused) {
+
+                target = (GLuint)result.size();
+                result.push_back(vertices[indices[i]]);
+            }
+            indices[i] = target;
+        }
+
+        // vertices no triangle references are dropped
+        vertices.swap(result);
+    }
+
+    void OptimizeMesh(MeshData& mesh) {
+
+        size_t vertexCount = mesh.vertices.size();
+
+        // exporters sometimes already emit cache friendly strips, keep those
+        std::vector<GLuint> previous = mesh.indices;
+        size_t previousMisses = AnalyzeVertexCache(previous, vertexCount).misses;
+        OptimizeVertexCache(mesh.indices, vertexCount);
+
+        size_t misses = AnalyzeVertexCache(mesh.indices, vertexCount).misses;
+        if (misses > previousMisses) {
+            mesh.indices.swap(previous);
+            misses = previousMisses;
+        }
+
+        // cluster restarts can exceed the budget on small meshes, where there is little overdraw to save anyway
+        previous = mesh.indices;
+        OptimizeOverdraw(mesh.indices, mesh.vertices, OVERDRAW_THRESHOLD);
+        if (AnalyzeVertexCache(mesh.indices, vertexCount).misses > misses * OVERDRAW_THRESHOLD) {
+            mesh.indices.swap(previous);
+        }
+
+        OptimizeVertexFetch(mesh.vertices, mesh.indices);
+    }
+}
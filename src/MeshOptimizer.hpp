@@ -0,0 +1,45 @@
+#ifndef MeshOptimizer_hpp
+#define MeshOptimizer_hpp
+
+#include "Mesh.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // Post-transform vertex cache efficiency of an index buffer, simulated on the CPU with a
+    // FIFO cache of ANALYZE_CACHE_SIZE entries like the fixed-function caches of most GPUs
+    struct VertexCacheStats {
+
+        size_t triangles;
+        size_t vertices;
+        size_t misses;
+        // average cache miss ratio: transformed vertices per triangle, 0.5 is ideal, 3 is worst
+        float acmr;
+        // average transform to vertex ratio: transformed vertices per unique vertex, 1 is ideal
+        float atvr;
+    };
+
+    static const size_t ANALYZE_CACHE_SIZE = 16;
+
+    VertexCacheStats AnalyzeVertexCache(const std::vector<GLuint>& indices, size_t vertexCount);
+
+    // Reorders triangles for the post-transform vertex cache (Tom Forsyth's linear-speed algorithm)
+    void OptimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount);
+
+    // Splits the cache-optimized triangle order into clusters and draws outward-facing clusters first,
+    // so early-Z rejects more of the rest. Clusters only break where the ACMR stays within threshold
+    // times the original, e.g. 1.05 trades at most 5% of the cache efficiency.
+    void OptimizeOverdraw(std::vector<GLuint>& indices, const std::vector<Vertex>& vertices, float threshold);
+
+    // Stores vertices in order of first use so vertex fetches walk memory linearly
+    void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices);
+
+    // ACMR budget OptimizeMesh gives the overdraw reordering
+    static const float OVERDRAW_THRESHOLD = 1.05f;
+
+    // All of the above, in the order they build on each other
+    void OptimizeMesh(MeshData& mesh);
+}
+
+#endif /* MeshOptimizer_hpp */
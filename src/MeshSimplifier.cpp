@@ -0,0 +1,358 @@
+#include "MeshSimplifier.hpp"
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace gps {
+
+    // Sum of squared distances to a set of planes, weighted by triangle area
+    struct Quadric {
+
+        double a2, b2, c2, d2;
+        double ab, ac, ad;
+        double bc, bd, cd;
+        double weight;
+
+        void add(const Quadric& other) {
+
+            a2 += other.a2; b2 += other.b2; c2 += other.c2; d2 += other.d2;
+            ab += other.ab; ac += other.ac; ad += other.ad;
+            bc += other.bc; bd += other.bd; cd += other.cd;
+            weight += other.weight;
+        }
+
+        double evaluate(glm::vec3 p) const {
+
+            double x = p.x, y = p.y, z = p.z;
+            double result = a2 * x * x + b2 * y * y + c2 * z * z + d2 +
+                2.0 * (ab * x * y + ac * x * z + bc * y * z + ad * x + bd * y + cd * z);
+            return std::max(result, 0.0);
+        }
+    };
+
+    static Quadric GetPlaneQuadric(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2) {
+
+        Quadric quadric;
+        memset(&quadric, 0, sizeof(quadric));
+
+        glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        double length = glm::length(normal);
+        if (length == 0.0) {
+            return quadric;
+        }
+
+        double a = normal.x / length, b = normal.y / length, c = normal.z / length;
+        double d = -(a * p0.x + b * p0.y + c * p0.z);
+        double w = length * 0.5;
+
+        quadric.a2 = w * a * a; quadric.b2 = w * b * b; quadric.c2 = w * c * c; quadric.d2 = w * d * d;
+        quadric.ab = w * a * b; quadric.ac = w * a * c; quadric.ad = w * a * d;
+        quadric.bc = w * b * c; quadric.bd = w * b * d; quadric.cd = w * c * d;
+        quadric.weight = w;
+        return quadric;
+    }
+
+    struct PositionHash {
+
+        size_t operator()(const glm::vec3& position) const {
+
+            GLuint bits[3];
+            memcpy(bits, &position, sizeof(bits));
+            return (size_t)(bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u);
+        }
+    };
+
+    struct Collapse {
+
+        GLuint from;
+        GLuint to;
+        // negative while no candidate was found
+        double cost = -1.0;
+
+        bool operator<(const Collapse& other) const {
+            return cost < other.cost;
+        }
+    };
+
+    float SimplifyMesh(const std::vector<GLuint>& indices, const std::vector<Vertex>& vertices, size_t targetIndexCount, float targetError, std::vector<GLuint>& result) {
+
+        result = indices;
+        size_t vertexCount = vertices.size();
+
+        // vertices that only differ in normal or texture coordinates share one position
+        std::vector<GLuint> positionId(vertexCount);
+        std::vector<GLuint> wedges(vertexCount, 0);
+        std::unordered_map<glm::vec3, GLuint, PositionHash> positions;
+        for (size_t i = 0; i < vertexCount; i++) {
+            positionId[i] = positions.insert(std::make_pair(vertices[i].Position, (GLuint)i)).first->second;
+        }
+
+        std::vector<bool> referenced(vertexCount, false);
+        for (size_t i = 0; i < result.size(); i++) {
+
+            if (!referenced[result[i]]) {
+
+                referenced[result[i]] = true;
+                wedges[positionId[result[i]]]++;
+            }
+        }
+
+        // a position is locked if it lies on a seam or on an open or non-manifold edge
+        std::vector<bool> locked(vertexCount, false);
+        for (size_t i = 0; i < vertexCount; i++) {
+            locked[i] = wedges[positionId[i]] > 1;
+        }
+
+        std::unordered_map<unsigned long long, int> edges;
+        for (size_t i = 0; i < result.size(); i += 3) {
+            for (int k = 0; k < 3; k++) {
+
+                unsigned long long a = positionId[result[i + k]];
+                unsigned long long b = positionId[result[i + (k + 1) % 3]];
+                edges[a << 32 | b]++;
+            }
+        }
+        for (std::unordered_map<unsigned long long, int>::const_iterator edge = edges.begin(); edge != edges.end(); ++edge) {
+
+            GLuint a = (GLuint)(edge->first >> 32);
+            GLuint b = (GLuint)(edge->first & 0xFFFFFFFFu);
+            std::unordered_map<unsigned long long, int>::const_iterator reverse = edges.find((unsigned long long)b << 32 | a);
+
+            if (edge->second != 1 || reverse == edges.end() || reverse->second != 1) {
+
+                locked[a] = true;
+                locked[b] = true;
+            }
+        }
+        for (size_t i = 0; i < vertexCount; i++) {
+            locked[i] = locked[positionId[i]];
+        }
+
+        // quadrics live on the position ids
+        std::vector<Quadric> quadrics(vertexCount);
+        memset(quadrics.data(), 0, quadrics.size() * sizeof(Quadric));
+        for (size_t i = 0; i < result.size(); i += 3) {
+
+            Quadric plane = GetPlaneQuadric(vertices[result[i]].Position, vertices[result[i + 1]].Position, vertices[result[i + 2]].Position);
+            for (int k = 0; k < 3; k++) {
+                quadrics[positionId[result[i + k]]].add(plane);
+            }
+        }
+
+        double maxCost = (double)targetError * targetError;
+        double resultCost = 0.0;
+
+        std::vector<GLuint> triangleOffsets(vertexCount + 1);
+        std::vector<GLuint> adjacency;
+        std::vector<GLuint> collapseTarget(vertexCount);
+        std::vector<bool> touched(vertexCount);
+        std::vector<Collapse> bestCollapse;
+        std::vector<Collapse> collapses;
+
+        while (result.size() > targetIndexCount) {
+
+            // triangles around every position
+            std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+            for (size_t i = 0; i < result.size(); i++) {
+                triangleOffsets[positionId[result[i]] + 1]++;
+            }
+            for (size_t i = 0; i < vertexCount; i++) {
+                triangleOffsets[i + 1] += triangleOffsets[i];
+            }
+            adjacency.resize(result.size());
+            std::vector<GLuint> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+            for (size_t i = 0; i < result.size(); i++) {
+                adjacency[fill[positionId[result[i]]]++] = (GLuint)(i / 3);
+            }
+
+            // cheapest collapse of every unlocked position into one of its neighbours
+            bestCollapse.assign(vertexCount, Collapse());
+            for (size_t i = 0; i < result.size(); i += 3) {
+                for (int k = 0; k < 3; k++) {
+
+                    GLuint from = result[i + k];
+                    if (locked[from]) {
+                        continue;
+                    }
+
+                    for (int other = 1; other < 3; other++) {
+
+                        GLuint to = result[i + (k + other) % 3];
+                        const Quadric& q0 = quadrics[positionId[from]];
+                        const Quadric& q1 = quadrics[positionId[to]];
+                        double weight = q0.weight + q1.weight;
+                        double cost = weight > 0.0 ? (q0.evaluate(vertices[to].Position) + q1.evaluate(vertices[to].Position)) / weight : 0.0;
+
+                        Collapse& best = bestCollapse[positionId[from]];
+                        if (best.cost < 0.0 || cost < best.cost) {
+
+                            best.from = from;
+                            best.to = to;
+                            best.cost = cost;
+                        }
+                    }
+                }
+            }
+
+            collapses.clear();
+            for (size_t i = 0; i < vertexCount; i++) {
+
+                if (bestCollapse[i].cost >= 0.0) {
+                    collapses.push_back(bestCollapse[i]);
+                }
+            }
+
+            std::sort(collapses.begin(), collapses.end());
+
+            for (size_t i = 0; i < vertexCount; i++) {
+                collapseTarget[i] = (GLuint)i;
+            }
+            std::fill(touched.begin(), touched.end(), false);
+
+            size_t trianglesToRemove = (result.size() - targetIndexCount + 2) / 3;
+            size_t trianglesRemoved = 0;
+
+            for (size_t c = 0; c < collapses.size() && trianglesRemoved < trianglesToRemove; c++) {
+
+                const Collapse& collapse = collapses[c];
+                if (collapse.cost > maxCost) {
+                    break;
+                }
+
+                GLuint from = positionId[collapse.from];
+                GLuint to = positionId[collapse.to];
+                if (touched[from] || touched[to]) {
+                    continue;
+                }
+
+                glm::vec3 target = vertices[collapse.to].Position;
+                GLuint targetVertex = collapse.to;
+                size_t collapsedTriangles = 0;
+                bool valid = true;
+
+                for (GLuint a = triangleOffsets[from]; a < triangleOffsets[from + 1] && valid; a++) {
+
+                    const GLuint* triangle = &result[adjacency[a] * 3];
+                    int corner = positionId[triangle[0]] == from ? 0 : positionId[triangle[1]] == from ? 1 : 2;
+
+                    bool hasTarget = false;
+                    for (int k = 0; k < 3; k++) {
+
+                        if (positionId[triangle[k]] == to) {
+
+                            // the fan must reach the target through a single wedge
+                            valid = valid && triangle[k] == targetVertex;
+                            hasTarget = true;
+                        }
+                    }
+
+                    if (hasTarget) {
+
+                        collapsedTriangles++;
+                        continue;
+                    }
+
+                    // the remaining triangles must not flip
+                    glm::vec3 p1 = vertices[triangle[(corner + 1) % 3]].Position;
+                    glm::vec3 p2 = vertices[triangle[(corner + 2) % 3]].Position;
+                    glm::vec3 before = glm::cross(p1 - vertices[triangle[corner]].Position, p2 - vertices[triangle[corner]].Position);
+                    glm::vec3 after = glm::cross(p1 - target, p2 - target);
+                    valid = glm::dot(before, after) > 0.0f || before == glm::vec3(0.0f);
+                }
+
+                if (!valid) {
+                    continue;
+                }
+
+                collapseTarget[from] = targetVertex;
+                quadrics[to].add(quadrics[from]);
+                resultCost = std::max(resultCost, collapse.cost);
+                trianglesRemoved += collapsedTriangles;
+
+                // the fan changes, so nothing around it may collapse again in this pass
+                for (GLuint a = triangleOffsets[from]; a < triangleOffsets[from + 1]; a++) {
+                    for (int k = 0; k < 3; k++) {
+                        touched[positionId[result[adjacency[a] * 3 + k]]] = true;
+                    }
+                }
+            }
+
+            if (trianglesRemoved == 0) {
+                break;
+            }
+
+            // unlocked positions have a single wedge, so redirecting by position id is exact
+            for (size_t i = 0; i < result.size(); i++) {
+
+                GLuint position = positionId[result[i]];
+                if (collapseTarget[position] != position) {
+                    result[i] = collapseTarget[position];
+                }
+            }
+
+            size_t write = 0;
+            for (size_t i = 0; i < result.size(); i += 3) {
+
+                GLuint a = positionId[result[i]];
+                GLuint b = positionId[result[i + 1]];
+                GLuint c = positionId[result[i + 2]];
+                if (a == b || b == c || a == c) {
+                    continue;
+                }
+
+                result[write++] = result[i];
+                result[write++] = result[i + 1];
+                result[write++] = result[i + 2];
+            }
+            result.resize(write);
+        }
+
+        return (float)sqrt(resultCost);
+    }
+
+    void GenerateLods(MeshData& mesh) {
+
+        mesh.lodIndices.clear();
+        mesh.lods.clear();
+
+        if (mesh.vertices.empty()) {
+            return;
+        }
+
+        glm::vec3 minimum = mesh.vertices[0].Position;
+        glm::vec3 maximum = mesh.vertices[0].Position;
+        for (size_t i = 1; i < mesh.vertices.size(); i++) {
+
+            minimum = glm::min(minimum, mesh.vertices[i].Position);
+            maximum = glm::max(maximum, mesh.vertices[i].Position);
+        }
+        float maxError = LOD_MAX_RELATIVE_ERROR * 0.5f * glm::length(maximum - minimum);
+
+        std::vector<GLuint> previous = mesh.indices;
+        float error = 0.0f;
+
+        while (mesh.lods.size() < LOD_MAX_LEVELS && previous.size() >= LOD_MIN_TRIANGLES * 3) {
+
+            size_t target = (size_t)(previous.size() / 3 * LOD_REDUCTION) * 3;
+
+            std::vector<GLuint> level;
+            float levelError = SimplifyMesh(previous, mesh.vertices, target, maxError, level);
+            if (level.empty() || level.size() > previous.size() * LOD_MIN_REDUCTION) {
+                break;
+            }
+
+            // errors add up along the chain, the sum bounds the deviation from the full mesh
+            error += levelError;
+            OptimizeVertexCache(level, mesh.vertices.size());
+
+            LodLevel lod = {(GLuint)mesh.lodIndices.size(), (GLuint)level.size(), error};
+            mesh.lods.push_back(lod);
+            mesh.lodIndices.insert(mesh.lodIndices.end(), level.begin(), level.end());
+
+            previous.swap(level);
+        }
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef MeshSimplifier_hpp
+#define MeshSimplifier_hpp
+
+#include "Mesh.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // Collapses edges in order of their quadric error (Garland-Heckbert) until at most targetIndexCount
+    // indices are left or the next collapse would move the surface by more than targetError model units.
+    // Vertices are only removed, never moved, so every level shares the mesh's vertex buffer. Vertices on
+    // open borders and on attribute seams are kept, levels neither crack nor smear textures.
+    // Returns the largest error of the collapses performed.
+    float SimplifyMesh(const std::vector<GLuint>& indices, const std::vector<Vertex>& vertices, size_t targetIndexCount, float targetError, std::vector<GLuint>& result);
+
+    // Each level keeps at most this fraction of the triangles of the previous one
+    static const float LOD_REDUCTION = 0.5f;
+    static const size_t LOD_MAX_LEVELS = 6;
+    // Levels stop once the simplifier can not remove at least a fifth of the triangles
+    static const float LOD_MIN_REDUCTION = 0.8f;
+    // Largest error a single level may add, relative to the radius of the mesh bounds
+    static const float LOD_MAX_RELATIVE_ERROR = 0.05f;
+    static const size_t LOD_MIN_TRIANGLES = 16;
+
+    // Builds the LOD chain of an optimized mesh into lodIndices/lods, each level simplified from the
+    // previous one and reordered for the vertex cache
+    void GenerateLods(MeshData& mesh);
+}
+
+#endif /* MeshSimplifier_hpp */
@@ -1,36 +1,709 @@
 #include "Model3D.hpp"
+#include "GLStateCache.hpp"
+#include "MeshClusters.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshSimplifier.hpp"
+#include "ObjParser.hpp"
+#include "TextureManager.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 
 namespace gps {
 
-	void Model3D::LoadModel(std::string fileName) {
+	// Identifies a face corner by its (vertex, normal, texcoord) index triple
+	struct VertexKey {
+
+		int vertex;
+		int normal;
+		int texcoord;
+
+		bool operator==(const VertexKey& other) const {
+
+			return vertex == other.vertex && normal == other.normal && texcoord == other.texcoord;
+		}
+	};
+
+	struct VertexKeyHash {
+
+		size_t operator()(const VertexKey& key) const {
+
+			size_t h = (size_t)(unsigned int)key.vertex * 73856093u;
+			h ^= (size_t)(unsigned int)key.normal * 19349663u;
+			h ^= (size_t)(unsigned int)key.texcoord * 83492791u;
+			return h;
+		}
+	};
+
+	// Face corners welded into one mesh under construction
+	struct MeshBuilder {
+
+		MeshData mesh;
+		std::unordered_map<VertexKey, GLuint, VertexKeyHash> uniqueVertices;
+	};
+
+	// Appends one face corner, reusing the vertex of an earlier corner with the same index triple
+	static void AddFaceCorner(const tinyobj::attrib_t& attrib, tinyobj::index_t idx, MeshBuilder& builder) {
+
+		std::vector<gps::Vertex>& vertices = builder.mesh.vertices;
+		std::vector<GLuint>& indices = builder.mesh.indices;
+
+		VertexKey key = { idx.vertex_index, idx.normal_index, idx.texcoord_index };
+		auto found = builder.uniqueVertices.find(key);
+
+		if (found != builder.uniqueVertices.end()) {
+
+			//already emitted vertex
+			indices.push_back(found->second);
+			return;
+		}
+
+		float vx = attrib.vertices[3 * idx.vertex_index + 0];
+		float vy = attrib.vertices[3 * idx.vertex_index + 1];
+		float vz = attrib.vertices[3 * idx.vertex_index + 2];
+		float nx = 0.0f;
+		float ny = 0.0f;
+		float nz = 0.0f;
+		float tx = 0.0f;
+		float ty = 0.0f;
+
+		if (idx.normal_index != -1) {
+
+			nx = attrib.normals[3 * idx.normal_index + 0];
+			ny = attrib.normals[3 * idx.normal_index + 1];
+			nz = attrib.normals[3 * idx.normal_index + 2];
+		}
+
+		if (idx.texcoord_index != -1) {
+
+			tx = attrib.texcoords[2 * idx.texcoord_index + 0];
+			ty = attrib.texcoords[2 * idx.texcoord_index + 1];
+		}
+
+		glm::vec3 vertexPosition(vx, vy, vz);
+		glm::vec3 vertexNormal(nx, ny, nz);
+		glm::vec2 vertexTexCoords(tx, ty);
+
+		gps::Vertex currentVertex;
+		currentVertex.Position = vertexPosition;
+		currentVertex.Normal = vertexNormal;
+		currentVertex.TexCoords = vertexTexCoords;
+
+		GLuint newIndex = (GLuint)vertices.size();
+		builder.uniqueVertices[key] = newIndex;
+
+		vertices.push_back(currentVertex);
+
+		indices.push_back(newIndex);
+	}
+
+	// Load options that change the cached geometry, stored in the cache header
+	static uint32_t GetCacheFlags(const LoadOptions& options) {
+
+		return (options.batchByMaterial ? 1u : 0u) | (options.optimizeMeshes ? 0u : 2u) | (options.generateLods ? 0u : 4u) | (options.buildMeshlets ? 0u : 8u);
+	}
+
+	// Model geometry from the mesh cache or, failing that, from parsing the .obj
+	struct LoadedGeometry {
+
+		MeshCache cache;
+		ModelData data;
+		std::vector<MeshView> meshViews;
+		// points into either cache or data
+		const std::vector<MaterialData>* materials;
+		size_t faceVertexCount;
+		bool fromCache;
+	};
+
+	// State shared by the loader thread, the texture decoding tasks and Model3D::Update
+	struct AsyncLoad {
+
+		std::string fileName;
+		std::string basePath;
+		LoadOptions options;
+		std::chrono::steady_clock::time_point start;
+
+		// written by the loader thread before geometryReady is set, read-only afterwards
+		LoadedGeometry geometry;
+		size_t textureCount;
+
+		std::mutex mutex;
+		bool geometryReady;
+		std::vector<DecodedImage> decoded;
+
+		// built by the loader thread while the meshes are uploaded, set before bvhReady
+		ModelBvh bvh;
+		std::vector<glm::vec3> occluders;
+		bool bvhReady;
+
+		// already loaded textures referenced by the loader thread, handed to the model by Update
+		std::vector<std::pair<std::string, GLuint> > sharedTextures;
+
+		// progress of the GPU uploads, only touched on the OpenGL thread
+		size_t nextMesh;
+		size_t uploadedTextures;
+
+		~AsyncLoad() {
+
+			for (size_t i = 0; i < decoded.size(); i++) {
+				stbi_image_free(decoded[i].pixels);
+			}
+		}
+	};
+
+	static void ReadGeometry(std::string fileName, std::string basePath, const LoadOptions& options, LoadedGeometry& geometry) {
+
+		// Reuse the binary mesh cache when it was built from the same .obj/.mtl contents
+		uint64_t sourceHash = MeshCache::ComputeSourceHash(fileName, basePath);
+		std::string cacheFileName = MeshCache::GetCacheFileName(fileName);
+
+		if (sourceHash != 0 && geometry.cache.Open(cacheFileName, sourceHash, GetCacheFlags(options))) {
+
+			std::cout << "Loading : " << cacheFileName << std::endl;
+
+			for (size_t i = 0; i < geometry.cache.getMeshCount(); i++) {
+				geometry.meshViews.push_back(geometry.cache.getMesh(i));
+			}
+
+			geometry.materials = &geometry.cache.getMaterials();
+			geometry.faceVertexCount = geometry.cache.getFaceVertexCount();
+			geometry.fromCache = true;
+		}
+		else {
+
+			Model3D::ReadOBJ(fileName, basePath, geometry.data, options);
+
+			if (sourceHash != 0 && !MeshCache::Write(cacheFileName, sourceHash, GetCacheFlags(options), geometry.data)) {
+
+				std::cerr << "WARNING: could not write mesh cache " << cacheFileName << std::endl;
+			}
+
+			for (size_t i = 0; i < geometry.data.meshes.size(); i++) {
+				geometry.meshViews.push_back(GetMeshView(geometry.data.meshes[i]));
+			}
+
+			geometry.materials = &geometry.data.materials;
+			geometry.faceVertexCount = geometry.data.faceVertexCount;
+			geometry.fromCache = false;
+		}
+	}
+
+	// Builds the mesh BVH, and the triangle BVH if asked to, from the model space vertices.
+	// Waits on pool tasks, so it runs on the loading thread rather than in one.
+	static void BuildBvh(const std::vector<MeshView>& meshViews, bool triangles, ModelBvh& bvh) {
+
+		std::vector<Bounds> bounds(meshViews.size());
+		for (size_t i = 0; i < meshViews.size(); i++) {
+			bounds[i] = ComputeBounds(meshViews[i].vertices, meshViews[i].vertexCount);
+		}
+		bvh.meshes.build(bounds);
+
+		bvh.triangleStarts.clear();
+		if (!triangles) {
+			return;
+		}
+
+		std::vector<glm::vec3> corners;
+		for (size_t i = 0; i < meshViews.size(); i++) {
+
+			const MeshView& mesh = meshViews[i];
+			bvh.triangleStarts.push_back(corners.size() / 3);
+			for (size_t j = 0; j + 2 < mesh.indexCount; j += 3) {
+
+				corners.push_back(mesh.vertices[mesh.indices[j]].Position);
+				corners.push_back(mesh.vertices[mesh.indices[j + 1]].Position);
+				corners.push_back(mesh.vertices[mesh.indices[j + 2]].Position);
+			}
+		}
+		bvh.triangles.buildTriangles(corners);
+	}
+
+	// Appends the corners of the largest triangles over all meshes, by model space area
+	static void SelectOccluders(const std::vector<MeshView>& meshViews, std::vector<glm::vec3>& corners) {
+
+		// (area, mesh, first index) of every triangle
+		std::vector<std::pair<float, std::pair<size_t, size_t> > > candidates;
+		for (size_t i = 0; i < meshViews.size(); i++) {
+
+			const MeshView& mesh = meshViews[i];
+			for (size_t j = 0; j + 2 < mesh.indexCount; j += 3) {
+
+				glm::vec3 a = mesh.vertices[mesh.indices[j]].Position;
+				glm::vec3 b = mesh.vertices[mesh.indices[j + 1]].Position;
+				glm::vec3 c = mesh.vertices[mesh.indices[j + 2]].Position;
+				float area = glm::length(glm::cross(b - a, c - a));
+				if (area > 0.0f) {
+					candidates.push_back(std::make_pair(area, std::make_pair(i, j)));
+				}
+			}
+		}
+
+		size_t count = std::min(candidates.size(), OCCLUSION_MAX_OCCLUDER_TRIANGLES);
+		std::nth_element(candidates.begin(), candidates.begin() + count, candidates.end(),
+			std::greater<std::pair<float, std::pair<size_t, size_t> > >());
+
+		for (size_t i = 0; i < count; i++) {
+
+			const MeshView& mesh = meshViews[candidates[i].second.first];
+			size_t first = candidates[i].second.second;
+			for (size_t k = 0; k < 3; k++) {
+				corners.push_back(mesh.vertices[mesh.indices[first + k]].Position);
+			}
+		}
+	}
+
+	// Unique paths of the textures referenced by the meshes' materials
+	static std::vector<std::string> CollectTexturePaths(const std::vector<MeshView>& meshViews, const std::vector<MaterialData>& materials, std::string basePath) {
+
+		std::vector<std::string> paths;
+		std::unordered_set<std::string> seen;
+
+		for (size_t i = 0; i < meshViews.size(); i++) {
+
+			int materialId = meshViews[i].materialId;
+			if (materialId < 0 || materialId >= (int)materials.size()) {
+				continue;
+			}
+
+			const std::string names[] = { materials[materialId].ambientTexture, materials[materialId].diffuseTexture, materials[materialId].specularTexture };
+			for (size_t t = 0; t < 3; t++) {
+
+				if (names[t].empty()) {
+					continue;
+				}
+
+				std::string path = TextureManager::GetCanonicalPath(basePath + names[t]);
+				if (seen.insert(path).second) {
+					paths.push_back(path);
+				}
+			}
+		}
+
+		return paths;
+	}
+
+	void Model3D::LoadModel(std::string fileName, LoadOptions options) {
 
         std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
-		ReadOBJ(fileName, basePath);
+		LoadModel(fileName, basePath, options);
 	}
 
-    void Model3D::LoadModel(std::string fileName, std::string basePath)	{
+    void Model3D::LoadModel(std::string fileName, std::string basePath, LoadOptions options)	{
 
-		ReadOBJ(fileName, basePath);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		LoadedGeometry geometry;
+		ReadGeometry(fileName, basePath, options, geometry);
+
+		PreloadTextures(geometry.meshViews, *geometry.materials, basePath);
+
+		for (size_t i = 0; i < geometry.meshViews.size(); i++) {
+			AddMesh(geometry.meshViews[i], *geometry.materials, basePath, false, options);
+		}
+
+		this->bvh = ModelBvh();
+		this->bvh.firstMesh = meshes.size() - geometry.meshViews.size();
+		BuildBvh(geometry.meshViews, options.buildTriangleBvh, this->bvh);
+
+		if (options.selectOccluders) {
+			SelectOccluders(geometry.meshViews, this->occluderTriangles);
+		}
+
+		FinishLoad(fileName, geometry.faceVertexCount, geometry.fromCache, options.vertexFormat, start);
+	}
+
+	void Model3D::LoadModelAsync(std::string fileName, LoadOptions options) {
+
+        std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
+		LoadModelAsync(fileName, basePath, options);
+	}
+
+	void Model3D::LoadModelAsync(std::string fileName, std::string basePath, LoadOptions options) {
+
+		// one load in flight at a time
+		while (!isLoaded()) {
+			Update(1000.0);
+		}
+
+		std::shared_ptr<AsyncLoad> load = std::make_shared<AsyncLoad>();
+		load->fileName = fileName;
+		load->basePath = basePath;
+		load->options = options;
+		load->start = std::chrono::steady_clock::now();
+		load->textureCount = 0;
+		load->geometryReady = false;
+		load->bvhReady = false;
+		load->nextMesh = 0;
+		load->uploadedTextures = 0;
+		this->asyncLoad = load;
+
+		// a dedicated thread rather than a pool task: parsing itself waits on pool tasks
+		this->asyncLoader = std::thread([load]() {
+
+			ReadGeometry(load->fileName, load->basePath, load->options, load->geometry);
+
+			// only decode what no other model has uploaded yet
+			std::vector<std::string> referenced = CollectTexturePaths(load->geometry.meshViews, *load->geometry.materials, load->basePath);
+			std::vector<std::string> paths;
+
+			for (size_t i = 0; i < referenced.size(); i++) {
+
+				GLuint textureId;
+				if (TextureManager::GetShared().acquire(referenced[i], textureId)) {
+					load->sharedTextures.push_back(std::make_pair(referenced[i], textureId));
+				}
+				else {
+					paths.push_back(referenced[i]);
+				}
+			}
+			load->textureCount = paths.size();
+
+			{
+				std::lock_guard<std::mutex> lock(load->mutex);
+				load->geometryReady = true;
+			}
+
+			ThreadPool& pool = ThreadPool::GetShared();
+			for (size_t i = 0; i < paths.size(); i++) {
+
+				std::string path = paths[i];
+				pool.submit([path, load]() {
+
+					DecodedImage image = DecodeImage(path);
+
+					std::lock_guard<std::mutex> lock(load->mutex);
+					load->decoded.push_back(std::move(image));
+				});
+			}
+
+			BuildBvh(load->geometry.meshViews, load->options.buildTriangleBvh, load->bvh);
+			if (load->options.selectOccluders) {
+				SelectOccluders(load->geometry.meshViews, load->occluders);
+			}
+
+			std::lock_guard<std::mutex> lock(load->mutex);
+			load->bvhReady = true;
+		});
+	}
+
+	bool Model3D::isLoaded() {
+		return !this->asyncLoad;
+	}
+
+	// Uploads finished meshes and textures of an asynchronous load until the time budget is used up
+	void Model3D::Update(double budgetMs) {
+
+		if (!this->asyncLoad) {
+			return;
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		AsyncLoad& load = *this->asyncLoad;
+
+		{
+			std::lock_guard<std::mutex> lock(load.mutex);
+			if (!load.geometryReady) {
+				return;
+			}
+		}
+
+		// textures other models had already loaded were referenced by the loader thread
+		for (size_t i = 0; i < load.sharedTextures.size(); i++) {
+
+			if (loadedTextures.count(load.sharedTextures[i].first)) {
+				TextureManager::GetShared().release(load.sharedTextures[i].first);
+			}
+			else {
+				loadedTextures[load.sharedTextures[i].first] = load.sharedTextures[i].second;
+			}
+		}
+		load.sharedTextures.clear();
+
+		const std::vector<MeshView>& meshViews = load.geometry.meshViews;
+		bool didWork = false;
+
+		// always make some progress, even when a single upload exceeds the budget
+		while (!didWork || std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() < budgetMs) {
+
+			// geometry first, so everything becomes visible with placeholder textures
+			if (load.nextMesh < meshViews.size()) {
+
+				AddMesh(meshViews[load.nextMesh], *load.geometry.materials, load.basePath, true, load.options);
+				load.nextMesh++;
+				didWork = true;
+				continue;
+			}
+
+			DecodedImage image;
+			{
+				std::lock_guard<std::mutex> lock(load.mutex);
+				if (load.decoded.empty()) {
+					break;
+				}
+				image = std::move(load.decoded.back());
+				load.decoded.pop_back();
+			}
+
+			// another model may have uploaded the same image in the meantime
+			GLuint textureId;
+			if (!FindLoadedTexture(image.path, textureId)) {
+				textureId = AddLoadedTexture(image.path, UploadTexture(image));
+			}
+
+			// swap the placeholder out of every mesh using this texture
+			for (size_t m = 0; m < meshes.size(); m++) {
+				for (size_t t = 0; t < meshes[m].textures.size(); t++) {
+
+					if (meshes[m].textures[t].path == image.path) {
+						meshes[m].textures[t].id = textureId;
+					}
+				}
+			}
+
+			stbi_image_free(image.pixels);
+			load.uploadedTextures++;
+			didWork = true;
+		}
+
+		bool bvhReady;
+		{
+			std::lock_guard<std::mutex> lock(load.mutex);
+			bvhReady = load.bvhReady;
+		}
+
+		if (load.nextMesh == meshViews.size() && load.uploadedTextures == load.textureCount && bvhReady) {
+
+			this->asyncLoader.join();
+			this->bvh = std::move(load.bvh);
+			this->bvh.firstMesh = meshes.size() - meshViews.size();
+			this->occluderTriangles.insert(this->occluderTriangles.end(), load.occluders.begin(), load.occluders.end());
+			FinishLoad(load.fileName, load.geometry.faceVertexCount, load.geometry.fromCache, load.options.vertexFormat, load.start);
+			this->asyncLoad.reset();
+		}
+	}
+
+	void Model3D::FinishLoad(std::string fileName, size_t faceVertexCount, bool fromCache, VERTEX_FORMAT format, std::chrono::steady_clock::time_point start) {
+
+		stats.verticesBeforeWeld += faceVertexCount;
+		stats.verticesAfterWeld = 0;
+		stats.indices = 0;
+		stats.shortIndexMeshes = 0;
+		stats.lodLevels = 0;
+		stats.coarsestLodIndices = 0;
+		stats.meshlets = 0;
+		stats.bvhNodes = this->bvh.meshes.getNodeCount() + this->bvh.triangles.getNodeCount();
+		stats.occluderTriangles = this->occluderTriangles.size() / 3;
+		stats.quantizationError = QuantizationError();
+		for (size_t i = 0; i < meshes.size(); i++) {
+
+			stats.verticesAfterWeld += meshes[i].vertices.size();
+			stats.indices += meshes[i].indices.size();
+			if (meshes[i].getIndexType() == GL_UNSIGNED_SHORT) {
+				stats.shortIndexMeshes++;
+			}
+
+			stats.lodLevels += meshes[i].lods.size();
+			stats.coarsestLodIndices += meshes[i].getTriangleCount(meshes[i].lods.size()) * 3;
+			stats.meshlets += meshes[i].meshlets.size();
+
+			QuantizationError error = meshes[i].getQuantizationError();
+			stats.quantizationError.position = std::max(stats.quantizationError.position, error.position);
+			stats.quantizationError.normal = std::max(stats.quantizationError.normal, error.normal);
+			stats.quantizationError.texCoords = std::max(stats.quantizationError.texCoords, error.texCoords);
+		}
+		stats.loadedFromCache = fromCache;
+		stats.vertexFormat = format;
+
+		double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout << "# of meshes    : " << meshes.size() << " (" << stats.shortIndexMeshes << " with 16 bit indices)" << std::endl;
+		std::cout << "# of vertices  : " << stats.verticesBeforeWeld << " -> " << stats.verticesAfterWeld << " after welding" << std::endl;
+		if (stats.lodLevels > 0) {
+
+			std::cout << "# of LODs      : " << stats.lodLevels << ", coarsest levels keep " << stats.coarsestLodIndices / 3 << " of "
+				<< stats.indices / 3 << " triangles" << std::endl;
+		}
+		if (stats.meshlets > 0) {
+			std::cout << "# of meshlets  : " << stats.meshlets << std::endl;
+		}
+		std::cout << "# of BVH nodes : " << stats.bvhNodes << (this->bvh.triangles.empty() ? "" : " (meshes and triangles)") << std::endl;
+		if (stats.occluderTriangles > 0) {
+			std::cout << "# of occluders : " << stats.occluderTriangles << " triangles" << std::endl;
+		}
+		if (format == VERTEX_QUANTIZED) {
+
+			const QuantizationError& error = stats.quantizationError;
+			std::cout << "Quantized      : " << stats.verticesAfterWeld * (sizeof(Vertex) - sizeof(PackedVertex)) / 1024 << " KB saved, max error position "
+				<< error.position << ", normal " << error.normal << " deg, texcoord " << error.texCoords << std::endl;
+		}
+		std::cout << "Loaded " << fileName << (fromCache ? " from cache" : "") << " in " << elapsedMs << " ms" << std::endl;
 	}
 
 	// Draw each mesh from the model
-	void Model3D::Draw(gps::Shader shaderProgram) {
+	void Model3D::Draw(gps::Shader& shaderProgram) {
 
 		for (int i = 0; i < meshes.size(); i++)
 			meshes[i].Draw(shaderProgram);
 	}
 
+	// Below this many meshes one SIMD pass over all boxes is cheaper than walking the BVH
+	static const size_t BVH_CULLING_MIN_MESHES = 256;
+
+	void Model3D::cullMeshes(const DrawContext& context, DrawStats& stats) {
+
+		if (context.cullMeshes) {
+
+			glm::vec4 planes[6];
+			TransformPlanes(context.frustumPlanes, context.model, planes);
+
+			if (meshes.size() >= BVH_CULLING_MIN_MESHES && this->bvh.firstMesh == 0 && this->bvh.meshes.getPrimitiveCount() == meshes.size()) {
+
+				this->visibleMeshes.clear();
+				this->bvh.meshes.queryFrustum(planes, this->visibleMeshes);
+
+				meshVisibility.assign((meshes.size() + 31) / 32, 0);
+				for (size_t i = 0; i < this->visibleMeshes.size(); i++) {
+					meshVisibility[this->visibleMeshes[i] / 32] |= 1u << (this->visibleMeshes[i] % 32);
+				}
+			}
+			else {
+				CullBoxes(meshBounds, planes, meshVisibility);
+			}
+		}
+
+		glm::mat4 modelViewProjection = context.viewProjection * context.model;
+		this->drawnMeshes.clear();
+
+		for (size_t i = 0; i < meshes.size(); i++) {
+
+			stats.meshes++;
+			if (context.cullMeshes && !IsBoxVisible(meshVisibility, i)) {
+
+				stats.frustumCulled++;
+				continue;
+			}
+
+			if (context.occlusion != NULL) {
+
+				glm::vec3 center(meshBounds.centerX[i], meshBounds.centerY[i], meshBounds.centerZ[i]);
+				glm::vec3 extent(meshBounds.extentX[i], meshBounds.extentY[i], meshBounds.extentZ[i]);
+				if (context.occlusion->isBoxOccluded(modelViewProjection, center - extent, center + extent)) {
+
+					stats.occlusionCulled++;
+					continue;
+				}
+			}
+
+			this->drawnMeshes.push_back(i);
+		}
+	}
+
+	size_t Model3D::Draw(gps::Shader& shaderProgram, const DrawContext& context) {
+
+		DrawStats stats = {};
+		cullMeshes(context, stats);
+		for (size_t i = 0; i < this->drawnMeshes.size(); i++) {
+			stats.triangles += meshes[this->drawnMeshes[i]].Draw(shaderProgram, context);
+		}
+
+		if (context.stats != NULL) {
+
+			context.stats->meshes += stats.meshes;
+			context.stats->frustumCulled += stats.frustumCulled;
+			context.stats->occlusionCulled += stats.occlusionCulled;
+			context.stats->triangles += stats.triangles;
+		}
+		return stats.triangles;
+	}
+
+	void Model3D::Submit(RenderQueue& queue, unsigned pass, RENDER_LAYER layer, gps::Shader& shaderProgram, const DrawContext& context, int objectIndex) {
+
+		DrawStats stats = {};
+		cullMeshes(context, stats);
+		if (context.stats != NULL) {
+
+			context.stats->meshes += stats.meshes;
+			context.stats->frustumCulled += stats.frustumCulled;
+			context.stats->occlusionCulled += stats.occlusionCulled;
+		}
+		if (this->drawnMeshes.empty()) {
+			return;
+		}
+
+		size_t queueContext = queue.addContext(context);
+		for (size_t i = 0; i < this->drawnMeshes.size(); i++) {
+
+			size_t mesh = this->drawnMeshes[i];
+			glm::vec3 center(meshBounds.centerX[mesh], meshBounds.centerY[mesh], meshBounds.centerZ[mesh]);
+			float viewDepth = glm::length(glm::vec3(context.model * glm::vec4(center, 1.0f)) - context.cameraPosition);
+			queue.submit(pass, layer, meshes[mesh], shaderProgram, queueContext, objectIndex, viewDepth);
+		}
+	}
+
+	bool Model3D::Raycast(glm::vec3 origin, glm::vec3 direction, float maxDistance, ModelHit& hit) {
+
+		BvhHit bvhHit;
+		if (!this->bvh.triangles.empty()) {
+
+			if (!this->bvh.triangles.raycast(origin, direction, maxDistance, bvhHit)) {
+				return false;
+			}
+
+			// the last mesh whose triangles start at or before the primitive
+			const std::vector<size_t>& starts = this->bvh.triangleStarts;
+			size_t mesh = std::upper_bound(starts.begin(), starts.end(), (size_t)bvhHit.primitive) - starts.begin() - 1;
+			hit.distance = bvhHit.distance;
+			hit.mesh = this->bvh.firstMesh + mesh;
+			hit.triangle = (bvhHit.primitive - starts[mesh]) * 3;
+			return true;
+		}
+
+		if (!this->bvh.meshes.raycast(origin, direction, maxDistance, bvhHit)) {
+			return false;
+		}
+
+		hit.distance = bvhHit.distance;
+		hit.mesh = this->bvh.firstMesh + bvhHit.primitive;
+		hit.triangle = (size_t)-1;
+		return true;
+	}
+
+	const ModelBvh& Model3D::getBvh() {
+		return this->bvh;
+	}
+
+	void Model3D::RenderOccluders(OcclusionBuffer& buffer, const glm::mat4& modelViewProjection) {
+		buffer.addOccluder(modelViewProjection, this->occluderTriangles);
+	}
+
+	ModelStats Model3D::getStats() {
+		return this->stats;
+	}
+
+	size_t Model3D::getMeshCount() {
+		return this->meshes.size();
+	}
+
 	// Does the parsing of the .obj file and fills in the data structure
-	void Model3D::ReadOBJ(std::string fileName, std::string basePath) {
+	void Model3D::ReadOBJ(std::string fileName, std::string basePath, ModelData& data, LoadOptions options) {
 
         std::cout << "Loading : " << fileName << std::endl;
 		tinyobj::attrib_t attrib;
 		std::vector<tinyobj::shape_t> shapes;
 		std::vector<tinyobj::material_t> materials;
-		int materialId;
 
 		std::string err;
-		bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE);
+		bool ret = LoadObjParallel(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE);
 
 		if (!err.empty()) {
 
@@ -46,184 +719,440 @@ namespace gps {
 		std::cout << "# of shapes    : " << shapes.size() << std::endl;
 		std::cout << "# of materials : " << materials.size() << std::endl;
 
+		data.faceVertexCount = 0;
+
+		// Material table
+		data.materials.resize(materials.size());
+		for (size_t m = 0; m < materials.size(); m++) {
+
+			gps::MaterialData& currentMaterial = data.materials[m];
+			currentMaterial.colors.ambient = glm::vec3(materials[m].ambient[0], materials[m].ambient[1], materials[m].ambient[2]);
+			currentMaterial.colors.diffuse = glm::vec3(materials[m].diffuse[0], materials[m].diffuse[1], materials[m].diffuse[2]);
+			currentMaterial.colors.specular = glm::vec3(materials[m].specular[0], materials[m].specular[1], materials[m].specular[2]);
+			currentMaterial.ambientTexture = materials[m].ambient_texname;
+			currentMaterial.diffuseTexture = materials[m].diffuse_texname;
+			currentMaterial.specularTexture = materials[m].specular_texname;
+		}
+
+		// Batched meshes by material id, in order of first use
+		std::vector<MeshBuilder> batches;
+		std::unordered_map<int, size_t> batchForMaterial;
+
 		// Loop over shapes
 		for (size_t s = 0; s < shapes.size(); s++) {
 
-			std::vector<gps::Vertex> vertices;
-			std::vector<GLuint> indices;
-			std::vector<gps::Texture> textures;
+			MeshBuilder shapeBuilder;
+			shapeBuilder.uniqueVertices.reserve(shapes[s].mesh.indices.size());
+			shapeBuilder.mesh.indices.reserve(shapes[s].mesh.indices.size());
 
 			// Loop over faces(polygon)
 			size_t index_offset = 0;
 			for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
 
 				int fv = shapes[s].mesh.num_face_vertices[f];
+				MeshBuilder* builder = &shapeBuilder;
+
+				if (options.batchByMaterial) {
 
-				//gps::Texture currentTexture = LoadTexture("index1.png", "ambientTexture");
-				//textures.push_back(currentTexture);
+					// every face goes to the mesh of its own material
+					int materialId = -1;
+					if (f < shapes[s].mesh.material_ids.size() && materials.size() > 0) {
+						materialId = shapes[s].mesh.material_ids[f];
+					}
+
+					std::unordered_map<int, size_t>::iterator batch = batchForMaterial.find(materialId);
+					if (batch == batchForMaterial.end()) {
+
+						batch = batchForMaterial.insert(std::make_pair(materialId, batches.size())).first;
+						batches.push_back(MeshBuilder());
+						batches.back().mesh.materialId = materialId;
+					}
+					builder = &batches[batch->second];
+				}
 
 				// Loop over vertices in the face.
 				for (size_t v = 0; v < fv; v++) {
 
 					// access to vertex
-					tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
+					AddFaceCorner(attrib, shapes[s].mesh.indices[index_offset + v], *builder);
+				}
 
-					float vx = attrib.vertices[3 * idx.vertex_index + 0];
-					float vy = attrib.vertices[3 * idx.vertex_index + 1];
-					float vz = attrib.vertices[3 * idx.vertex_index + 2];
-					float nx = attrib.normals[3 * idx.normal_index + 0];
-					float ny = attrib.normals[3 * idx.normal_index + 1];
-					float nz = attrib.normals[3 * idx.normal_index + 2];
-					float tx = 0.0f;
-					float ty = 0.0f;
+				index_offset += fv;
+			}
 
-					if (idx.texcoord_index != -1) {
+			data.faceVertexCount += index_offset;
 
-						tx = attrib.texcoords[2 * idx.texcoord_index + 0];
-						ty = attrib.texcoords[2 * idx.texcoord_index + 1];
-					}
+			if (options.batchByMaterial) {
+				continue;
+			}
 
-					glm::vec3 vertexPosition(vx, vy, vz);
-					glm::vec3 vertexNormal(nx, ny, nz);
-					glm::vec2 vertexTexCoords(tx, ty);
+			// get material id
+			// Only try to read materials if the .mtl file is present
+			shapeBuilder.mesh.materialId = -1;
+			if (shapes[s].mesh.material_ids.size() > 0 && materials.size() > 0) {
 
-					gps::Vertex currentVertex;
-					currentVertex.Position = vertexPosition;
-					currentVertex.Normal = vertexNormal;
-					currentVertex.TexCoords = vertexTexCoords;
+				shapeBuilder.mesh.materialId = shapes[s].mesh.material_ids[0];
+			}
 
-					vertices.push_back(currentVertex);
+			data.meshes.push_back(std::move(shapeBuilder.mesh));
+		}
 
-					indices.push_back((GLuint)(index_offset + v));
-				}
+		for (size_t b = 0; b < batches.size(); b++) {
+			data.meshes.push_back(std::move(batches[b].mesh));
+		}
 
-				index_offset += fv;
+		if (options.optimizeMeshes) {
+			OptimizeMeshes(data);
+		}
+
+		if (options.generateLods) {
+			SimplifyMeshes(data);
+		}
+
+		if (options.buildMeshlets) {
+			ClusterMeshes(data);
+		}
+	}
+
+	// Reorders every mesh for the vertex cache, overdraw and vertex fetch, one pool task per mesh
+	void Model3D::OptimizeMeshes(ModelData& data) {
+
+		std::vector<VertexCacheStats> before(data.meshes.size());
+		std::vector<VertexCacheStats> after(data.meshes.size());
+		std::vector<std::future<void> > pending;
+
+		for (size_t i = 0; i < data.meshes.size(); i++) {
+
+			MeshData* mesh = &data.meshes[i];
+			VertexCacheStats* meshBefore = &before[i];
+			VertexCacheStats* meshAfter = &after[i];
+
+			pending.push_back(ThreadPool::GetShared().submit([mesh, meshBefore, meshAfter]() {
+
+				*meshBefore = AnalyzeVertexCache(mesh->indices, mesh->vertices.size());
+				OptimizeMesh(*mesh);
+				*meshAfter = AnalyzeVertexCache(mesh->indices, mesh->vertices.size());
+			}));
+		}
+
+		size_t triangles = 0;
+		size_t missesBefore = 0;
+		size_t missesAfter = 0;
+		for (size_t i = 0; i < pending.size(); i++) {
+
+			pending[i].get();
+			triangles += before[i].triangles;
+			missesBefore += before[i].misses;
+			missesAfter += after[i].misses;
+		}
+
+		if (triangles > 0) {
+			std::cout << "ACMR           : " << (float)missesBefore / triangles << " -> " << (float)missesAfter / triangles << " after optimization" << std::endl;
+		}
+	}
+
+	// Builds the LOD chain of every mesh, one pool task per mesh
+	void Model3D::SimplifyMeshes(ModelData& data) {
+
+		std::vector<std::future<void> > pending;
+
+		for (size_t i = 0; i < data.meshes.size(); i++) {
+
+			MeshData* mesh = &data.meshes[i];
+			pending.push_back(ThreadPool::GetShared().submit([mesh]() {
+
+				GenerateLods(*mesh);
+			}));
+		}
+
+		for (size_t i = 0; i < pending.size(); i++) {
+			pending[i].get();
+		}
+	}
+
+	// Splits every mesh into meshlets, one pool task per mesh
+	void Model3D::ClusterMeshes(ModelData& data) {
+
+		std::vector<std::future<void> > pending;
+
+		for (size_t i = 0; i < data.meshes.size(); i++) {
+
+			MeshData* mesh = &data.meshes[i];
+			pending.push_back(ThreadPool::GetShared().submit([mesh]() {
+
+				BuildMeshlets(*mesh);
+			}));
+		}
+
+		for (size_t i = 0; i < pending.size(); i++) {
+			pending[i].get();
+		}
+	}
+
+	// Creates the GPU mesh of a parsed or cached mesh and loads its material textures
+	void Model3D::AddMesh(const MeshView& mesh, const std::vector<MaterialData>& materials, std::string basePath, bool usePlaceholders, const LoadOptions& options) {
+
+		std::vector<gps::Texture> textures;
+
+		if (mesh.materialId >= 0 && mesh.materialId < (int)materials.size()) {
+
+			const gps::MaterialData& material = materials[mesh.materialId];
+
+			//ambient texture
+			if (!material.ambientTexture.empty()) {
+
+				textures.push_back(GetMaterialTexture(TextureManager::GetCanonicalPath(basePath + material.ambientTexture), "ambientTexture", usePlaceholders));
 			}
 
-			// get material id
-			// Only try to read materials if the .mtl file is present
-			size_t a = shapes[s].mesh.material_ids.size();
+			//diffuse texture
+			if (!material.diffuseTexture.empty()) {
+
+				textures.push_back(GetMaterialTexture(TextureManager::GetCanonicalPath(basePath + material.diffuseTexture), "diffuseTexture", usePlaceholders));
+			}
 
-			if (a > 0 && materials.size()>0) {
+			//specular texture
+			if (!material.specularTexture.empty()) {
 
-				materialId = shapes[s].mesh.material_ids[0];
-				if (materialId != -1) {
+				textures.push_back(GetMaterialTexture(TextureManager::GetCanonicalPath(basePath + material.specularTexture), "specularTexture", usePlaceholders));
+			}
+		}
 
-					gps::Material currentMaterial;
-					currentMaterial.ambient = glm::vec3(materials[materialId].ambient[0], materials[materialId].ambient[1], materials[materialId].ambient[2]);
-					currentMaterial.diffuse = glm::vec3(materials[materialId].diffuse[0], materials[materialId].diffuse[1], materials[materialId].diffuse[2]);
-					currentMaterial.specular = glm::vec3(materials[materialId].specular[0], materials[materialId].specular[1], materials[materialId].specular[2]);
+		meshes.push_back(gps::Mesh(mesh.vertices, mesh.vertexCount, mesh.indices, mesh.indexCount, textures, options.vertexFormat, mesh.lodIndices, mesh.lods, mesh.lodCount,
+			mesh.meshlets, mesh.meshletCount, options.useGeometryArena));
 
-					//ambient texture
-					std::string ambientTexturePath = materials[materialId].ambient_texname;
+		Bounds bounds = meshes.back().getBounds();
+		meshBounds.add(bounds.minimum, bounds.maximum);
+	}
 
-					if (!ambientTexturePath.empty()) {
+	// Loaded texture for a material slot, or the placeholder while it is still being decoded
+	gps::Texture Model3D::GetMaterialTexture(std::string path, std::string type, bool usePlaceholders) {
 
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + ambientTexturePath, "ambientTexture");
-						textures.push_back(currentTexture);
-					}
+		if (!usePlaceholders) {
+			return LoadTexture(path, type);
+		}
 
-					//diffuse texture
-					std::string diffuseTexturePath = materials[materialId].diffuse_texname;
+		GLuint textureId;
+		if (FindLoadedTexture(path, textureId)) {
+			return LoadTexture(path, type);
+		}
 
-					if (!diffuseTexturePath.empty()) {
+		if (this->placeholderTexture == 0) {
 
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + diffuseTexturePath, "diffuseTexture");
-						textures.push_back(currentTexture);
-					}
+			// opaque white, so alpha tests pass and lighting still shows the shapes
+			unsigned char white[4] = { 255, 255, 255, 255 };
+			DecodedImage image = { "", 1, 1, white, CompressedImage() };
+			this->placeholderTexture = UploadTexture(image);
+		}
 
-					//specular texture
-					std::string specularTexturePath = materials[materialId].specular_texname;
+		gps::Texture currentTexture;
+		currentTexture.id = this->placeholderTexture;
+		currentTexture.type = type;
+		currentTexture.path = path;
+		return currentTexture;
+	}
 
-					if (!specularTexturePath.empty()) {
+	// Decodes all textures used by the meshes on the thread pool, uploading each as soon as it is ready
+	void Model3D::PreloadTextures(const std::vector<MeshView>& meshViews, const std::vector<MaterialData>& materials, std::string basePath) {
 
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + specularTexturePath, "specularTexture");
-						textures.push_back(currentTexture);
-					}
-				}
+		// unique texture paths that are not loaded yet
+		std::vector<std::string> paths;
+		std::vector<std::string> referenced = CollectTexturePaths(meshViews, materials, basePath);
+
+		for (size_t i = 0; i < referenced.size(); i++) {
+
+			GLuint textureId;
+			if (!FindLoadedTexture(referenced[i], textureId)) {
+				paths.push_back(referenced[i]);
 			}
+		}
+
+		if (paths.empty()) {
+			return;
+		}
+
+		// workers hand finished images back through this queue
+		std::mutex queueMutex;
+		std::condition_variable queueReady;
+		std::vector<DecodedImage> decoded;
+
+		ThreadPool& pool = ThreadPool::GetShared();
+		for (size_t i = 0; i < paths.size(); i++) {
+
+			std::string path = paths[i];
+			pool.submit([path, &queueMutex, &queueReady, &decoded]() {
+
+				DecodedImage image = DecodeImage(path);
 
-			meshes.push_back(gps::Mesh(vertices, indices, textures));
+				// notify under the lock, the loader may return as soon as it sees the last image
+				std::lock_guard<std::mutex> lock(queueMutex);
+				decoded.push_back(std::move(image));
+				queueReady.notify_one();
+			});
+		}
+
+		size_t uploaded = 0;
+		while (uploaded < paths.size()) {
+
+			std::vector<DecodedImage> ready;
+			{
+				std::unique_lock<std::mutex> lock(queueMutex);
+				queueReady.wait(lock, [&decoded]() { return !decoded.empty(); });
+				ready.swap(decoded);
+			}
+
+			for (size_t i = 0; i < ready.size(); i++) {
+
+				AddLoadedTexture(ready[i].path, UploadTexture(ready[i]));
+				stbi_image_free(ready[i].pixels);
+			}
+
+			uploaded += ready.size();
 		}
 	}
 
 	// Retrieves a texture associated with the object - by its name and type
 	gps::Texture Model3D::LoadTexture(std::string path, std::string type) {
 
-			for (int i = 0; i < loadedTextures.size(); i++) {
-
-				if (loadedTextures[i].path == path)	{
-
-					//already loaded texture
-					return loadedTextures[i];
-				}
+			//already loaded texture, possibly used with another type or by another model
+			GLuint textureId;
+			if (!FindLoadedTexture(path, textureId)) {
+				textureId = AddLoadedTexture(path, ReadTextureFromFile(path.c_str()));
 			}
 
 			gps::Texture currentTexture;
-			currentTexture.id = ReadTextureFromFile(path.c_str());
+			currentTexture.id = textureId;
 			currentTexture.type = std::string(type);
 			currentTexture.path = path;
 
-			loadedTextures.push_back(currentTexture);
-
 			return currentTexture;
 		}
 
+	// Texture this model already holds, or one another model loaded, referenced through the TextureManager
+	bool Model3D::FindLoadedTexture(const std::string& path, GLuint& textureId) {
+
+		std::unordered_map<std::string, GLuint>::iterator found = loadedTextures.find(path);
+		if (found != loadedTextures.end()) {
+
+			textureId = found->second;
+			return true;
+		}
+
+		if (TextureManager::GetShared().acquire(path, textureId)) {
+
+			loadedTextures[path] = textureId;
+			return true;
+		}
+
+		return false;
+	}
+
+	// Shares a freshly uploaded texture, returns the id to use in case another model won the race
+	GLuint Model3D::AddLoadedTexture(const std::string& path, GLuint textureId) {
+
+		// failed loads are remembered locally so they are not retried for every material slot
+		if (textureId != 0) {
+			textureId = TextureManager::GetShared().add(path, textureId);
+		}
+
+		loadedTextures[path] = textureId;
+		return textureId;
+	}
+
 	// Reads the pixel data from an image file and loads it into the video memory
 	GLuint Model3D::ReadTextureFromFile(const char* file_name) {
 
-		int x, y, n;
+		DecodedImage image = DecodeImage(file_name);
+		GLuint textureID = UploadTexture(image);
+		stbi_image_free(image.pixels);
+
+		return textureID;
+	}
+
+	// Reads and flips the pixel data of an image file, safe to call from any thread
+	DecodedImage Model3D::DecodeImage(std::string path) {
+
+		DecodedImage image;
+		image.path = path;
+		image.pixels = NULL;
+
+		// block-compressed containers are uploaded as they are, with their stored mip chain
+		std::string extension = path.substr(path.find_last_of('.') + 1);
+		if (extension == "dds" || extension == "ktx2") {
+
+			if (!ReadCompressedTexture(path, image.compressed) || !IsCompressedFormatSupported(image.compressed.format)) {
+				fprintf(stderr, "ERROR: could not load %s\n", path.c_str());
+				image.compressed.levelOffsets.clear();
+			}
+			image.width = image.compressed.width;
+			image.height = image.compressed.height;
+			return image;
+		}
+
+		// an image cooked with --cook-textures replaces its source
+		if (ReadCookedTexture(path, image.compressed)) {
+
+			image.width = image.compressed.width;
+			image.height = image.compressed.height;
+			return image;
+		}
+
+		int n;
 		int force_channels = 4;
-		unsigned char* image_data = stbi_load(file_name, &x, &y, &n, force_channels);
+		image.pixels = stbi_load(path.c_str(), &image.width, &image.height, &n, force_channels);
 
-		if (!image_data) {
-			fprintf(stderr, "ERROR: could not load %s\n", file_name);
-			return false;
+		if (!image.pixels) {
+			fprintf(stderr, "ERROR: could not load %s\n", path.c_str());
+			return image;
 		}
 		// NPOT check
-		if ((x & (x - 1)) != 0 || (y & (y - 1)) != 0) {
+		if ((image.width & (image.width - 1)) != 0 || (image.height & (image.height - 1)) != 0) {
 			fprintf(
-				stderr, "WARNING: texture %s is not power-of-2 dimensions\n", file_name
+				stderr, "WARNING: texture %s is not power-of-2 dimensions\n", path.c_str()
 			);
 		}
 
-		int width_in_bytes = x * 4;
-		unsigned char *top = NULL;
-		unsigned char *bottom = NULL;
-		unsigned char temp = 0;
-		int half_height = y / 2;
+		// flip rows for OpenGL, whole rows at a time
+		size_t width_in_bytes = (size_t)image.width * 4;
+		std::vector<unsigned char> row(width_in_bytes);
+		int half_height = image.height / 2;
 
-		for (int row = 0; row < half_height; row++) {
+		for (int r = 0; r < half_height; r++) {
 
-			top = image_data + row * width_in_bytes;
-			bottom = image_data + (y - row - 1) * width_in_bytes;
+			unsigned char* top = image.pixels + r * width_in_bytes;
+			unsigned char* bottom = image.pixels + (image.height - r - 1) * width_in_bytes;
 
-			for (int col = 0; col < width_in_bytes; col++) {
+			memcpy(row.data(), top, width_in_bytes);
+			memcpy(top, bottom, width_in_bytes);
+			memcpy(bottom, row.data(), width_in_bytes);
+		}
 
-				temp = *top;
-				*top = *bottom;
-				*bottom = temp;
-				top++;
-				bottom++;
-			}
+		return image;
+	}
+
+	// Creates the mipmapped texture object, must run on the OpenGL thread
+	GLuint Model3D::UploadTexture(const DecodedImage& image) {
+
+		if (!image.compressed.levelOffsets.empty()) {
+			return UploadCompressedTexture(image.compressed);
+		}
+
+		if (!image.pixels) {
+			return 0;
 		}
 
 		GLuint textureID;
 		glGenTextures(1, &textureID);
-		glBindTexture(GL_TEXTURE_2D, textureID);
+		GLStateCache::GetShared().bindTexture(GL_TEXTURE_2D, textureID);
 		glTexImage2D(
 			GL_TEXTURE_2D,
 			0,
 			GL_SRGB, //GL_SRGB,//GL_RGBA,
-			x,
-			y,
+			image.width,
+			image.height,
 			0,
 			GL_RGBA,
 			GL_UNSIGNED_BYTE,
-			image_data
+			image.pixels
 		);
 		glGenerateMipmap(GL_TEXTURE_2D);
 
@@ -231,26 +1160,69 @@ namespace gps {
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glBindTexture(GL_TEXTURE_2D, 0);
+
+		return textureID;
+	}
+
+	// Creates a texture object from the stored mip levels, no mipmaps are generated at runtime
+	GLuint Model3D::UploadCompressedTexture(const CompressedImage& image) {
+
+		GLuint textureID;
+		glGenTextures(1, &textureID);
+		GLStateCache::GetShared().bindTexture(GL_TEXTURE_2D, textureID);
+
+		for (size_t level = 0; level < image.levelOffsets.size(); level++) {
+
+			glCompressedTexImage2D(
+				GL_TEXTURE_2D,
+				(GLint)level,
+				image.format,
+				std::max(1, image.width >> level),
+				std::max(1, image.height >> level),
+				0,
+				(GLsizei)image.levelSizes[level],
+				image.data.data() + image.levelOffsets[level]
+			);
+		}
+
+		GLint maxLevel = (GLint)image.levelOffsets.size() - 1;
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, maxLevel);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, maxLevel > 0 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
 		return textureID;
 	}
 
 	Model3D::~Model3D() {
 
-        for (size_t i = 0; i < loadedTextures.size(); i++) {
+		// let a load still in flight finish its parsing before the model goes away
+		if (this->asyncLoader.joinable()) {
+			this->asyncLoader.join();
+		}
+
+		if (this->placeholderTexture != 0) {
+			GLStateCache::GetShared().deleteTextures(1, &this->placeholderTexture);
+		}
+
+        // textures shared with other models stay alive until their last user releases them
+        for (std::unordered_map<std::string, GLuint>::iterator it = loadedTextures.begin(); it != loadedTextures.end(); ++it) {
 
-            glDeleteTextures(1, &loadedTextures.at(i).id);
+            if (it->second != 0) {
+                TextureManager::GetShared().release(it->first);
+            }
         }
 
-        for (size_t i = 0; i < meshes.size(); i++) {
+        if (this->asyncLoad) {
 
-            GLuint VBO = meshes.at(i).getBuffers().VBO;
-            GLuint EBO = meshes.at(i).getBuffers().EBO;
-            GLuint VAO = meshes.at(i).getBuffers().VAO;
-            glDeleteBuffers(1, &VBO);
-            glDeleteBuffers(1, &EBO);
-            glDeleteVertexArrays(1, &VAO);
+            for (size_t i = 0; i < this->asyncLoad->sharedTextures.size(); i++) {
+                TextureManager::GetShared().release(this->asyncLoad->sharedTextures[i].first);
+            }
+        }
+
+        for (size_t i = 0; i < meshes.size(); i++) {
+            meshes.at(i).releaseBuffers();
         }
 	}
 }
@@ -1,42 +1,225 @@
 #ifndef Model3D_hpp
 #define Model3D_hpp
 
+#include "Bvh.hpp"
+#include "FrustumCulling.hpp"
 #include "Mesh.hpp"
+#include "MeshCache.hpp"
+#include "OcclusionCulling.hpp"
+#include "RenderQueue.hpp"
+#include "TextureFile.hpp"
 
 #include "tiny_obj_loader.h"
 #include "stb_image.h"
 
+#include <chrono>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 namespace gps {
 
+    struct ModelStats {
+        // face corners read from the .obj, i.e. vertices before welding
+        size_t verticesBeforeWeld;
+        // unique (position, normal, texcoord) combinations after welding
+        size_t verticesAfterWeld;
+        size_t indices;
+        // meshes whose index buffer fits GL_UNSIGNED_SHORT
+        size_t shortIndexMeshes;
+        // levels of detail over all meshes, and the indices left when every mesh draws its coarsest one
+        size_t lodLevels;
+        size_t coarsestLodIndices;
+        size_t meshlets;
+        // nodes of the mesh BVH and of the triangle BVH, if built
+        size_t bvhNodes;
+        // triangles kept for RenderOccluders, see LoadOptions::selectOccluders
+        size_t occluderTriangles;
+        // geometry came from the binary mesh cache instead of the .obj
+        bool loadedFromCache;
+        VERTEX_FORMAT vertexFormat;
+        // largest error over all meshes, zero for VERTEX_FLOAT
+        QuantizationError quantizationError;
+    };
+
+    // RGBA8 pixels or compressed blocks of a decoded image, already in OpenGL's bottom-up row order
+    struct DecodedImage {
+
+        std::string path;
+        int width;
+        int height;
+        // owned by stb_image, NULL if decoding failed or the image is compressed
+        unsigned char* pixels;
+        // filled instead of pixels for .dds/.ktx2 files and cooked textures
+        CompressedImage compressed;
+    };
+
+    struct LoadOptions {
+        // Regroup the faces of all shapes by their own material id into one mesh per material,
+        // fewer draw calls and texture binds for models whose parts share a few materials
+        bool batchByMaterial = false;
+        // Reorder vertices and triangles for the vertex cache, overdraw and vertex fetch (see MeshOptimizer)
+        bool optimizeMeshes = true;
+        // Vertex layout of the uploaded meshes, VERTEX_QUANTIZED uses 16 instead of 32 bytes per vertex.
+        // The cache keeps float vertices, they are packed at upload.
+        VERTEX_FORMAT vertexFormat = VERTEX_FLOAT;
+        // Build a chain of simplified index buffers per mesh (see MeshSimplifier), picked by Draw with a DrawContext
+        bool generateLods = true;
+        // Split the full-detail level into meshlets (see MeshClusters) that Draw culls against the camera
+        bool buildMeshlets = true;
+        // Also build a BVH over every triangle, so Raycast hits the surface instead of the mesh boxes
+        bool buildTriangleBvh = false;
+        // Keep the largest triangles of the model (up to OCCLUSION_MAX_OCCLUDER_TRIANGLES) for RenderOccluders,
+        // for models made of walls, floors and other big surfaces that hide what is behind them
+        bool selectOccluders = false;
+        // Put the meshes in the shared GeometryArena instead of buffers of their own, so a RenderQueue can draw
+        // many of them with one indirect multi-draw
+        bool useGeometryArena = false;
+    };
+
+    struct ModelHit {
+
+        // along the ray, in units of its direction
+        float distance;
+        size_t mesh;
+        // first index of the triangle in the mesh, only with LoadOptions::buildTriangleBvh
+        size_t triangle;
+    };
+
+    // Spatial indices over the meshes of one load, in model space
+    struct ModelBvh {
+
+        // one primitive per mesh box
+        Bvh meshes;
+        // one primitive per triangle, only with LoadOptions::buildTriangleBvh
+        Bvh triangles;
+        // first triangle primitive of each mesh
+        std::vector<size_t> triangleStarts;
+        // index of the load's first mesh in the model
+        size_t firstMesh = 0;
+    };
+
+    struct AsyncLoad;
+
     class Model3D {
 
     public:
         ~Model3D();
 
-		void LoadModel(std::string fileName);
+		void LoadModel(std::string fileName, LoadOptions options = LoadOptions());
+
+		void LoadModel(std::string fileName, std::string basePath, LoadOptions options = LoadOptions());
+
+		// Starts loading in the background, meshes become drawable one by one through Update()
+		void LoadModelAsync(std::string fileName, LoadOptions options = LoadOptions());
+
+		void LoadModelAsync(std::string fileName, std::string basePath, LoadOptions options = LoadOptions());
+
+		// Uploads meshes and textures of an asynchronous load for at most budgetMs, call once per frame
+		void Update(double budgetMs);
+
+		// False while an asynchronous load is still in progress
+		bool isLoaded();
+
+		void Draw(gps::Shader& shaderProgram);
 
-		void LoadModel(std::string fileName, std::string basePath);
+		// Draws every mesh inside the context's frustum and not hidden by its occlusion buffer at the coarsest
+		// level of detail that stays within its screen error, returns the number of triangles drawn
+		size_t Draw(gps::Shader& shaderProgram, const DrawContext& context);
 
-		void Draw(gps::Shader shaderProgram);
+		// Culls like Draw, then queues the remaining meshes instead of drawing them; their triangles are counted
+		// in the context's stats once the queue executes. objectIndex is where the model's matrices are, see ObjectBuffer.
+		void Submit(RenderQueue& queue, unsigned pass, RENDER_LAYER layer, gps::Shader& shaderProgram, const DrawContext& context, int objectIndex);
+
+		// Closest mesh hit by a model space ray, see LoadOptions::buildTriangleBvh
+		bool Raycast(glm::vec3 origin, glm::vec3 direction, float maxDistance, ModelHit& hit);
+
+		// BVHs of the last load, empty until it has finished
+		const ModelBvh& getBvh();
+
+		// Queues the occluder triangles picked at load time, see LoadOptions::selectOccluders
+		void RenderOccluders(OcclusionBuffer& buffer, const glm::mat4& modelViewProjection);
+
+		ModelStats getStats();
+
+		// Meshes are only ever added, so a changed count means the model draws something new
+		size_t getMeshCount();
+
+		// Does the parsing of the .obj file and fills in the data structure, needs no OpenGL context
+		static void ReadOBJ(std::string fileName, std::string basePath, ModelData& data, LoadOptions options = LoadOptions());
+
+		// The stages ReadOBJ runs after parsing, in this order, as its options ask for them
+
+		// Reorders every mesh for the vertex cache, overdraw and vertex fetch, one pool task per mesh
+		static void OptimizeMeshes(ModelData& data);
+
+		// Builds the LOD chain of every mesh, one pool task per mesh
+		static void SimplifyMeshes(ModelData& data);
+
+		// Splits every mesh into meshlets, one pool task per mesh
+		static void ClusterMeshes(ModelData& data);
 
     private:
 		// Component meshes - group of objects
         std::vector<gps::Mesh> meshes;
-		// Associated textures
-        std::vector<gps::Texture> loadedTextures;
+		// Model space box of each mesh, in the order of meshes
+		BoundingBoxes meshBounds;
+		// Visibility bitmask of the last culled Draw, kept to reuse its storage
+		std::vector<GLuint> meshVisibility;
+		std::vector<GLuint> visibleMeshes;
+		// Meshes that passed the last cullMeshes
+		std::vector<size_t> drawnMeshes;
+		ModelBvh bvh;
+		// Model space corners of the occluder triangles of every load, three per triangle
+		std::vector<glm::vec3> occluderTriangles;
+		// Associated textures by canonical path, each holding one TextureManager reference
+        std::unordered_map<std::string, GLuint> loadedTextures;
+		// Vertex counts gathered while loading
+		ModelStats stats = {};
+		// Shown in place of textures that are still being decoded
+		GLuint placeholderTexture = 0;
+		// Background load in progress, if any
+		std::shared_ptr<AsyncLoad> asyncLoad;
+		std::thread asyncLoader;
 
-		// Does the parsing of the .obj file and fills in the data structure
-		void ReadOBJ(std::string fileName, std::string basePath);
+		// Fills drawnMeshes with the meshes inside the context's frustum and not hidden by its occlusion buffer
+		void cullMeshes(const DrawContext& context, DrawStats& stats);
+
+		// Creates the GPU mesh of a parsed or cached mesh and loads its material textures
+		void AddMesh(const MeshView& mesh, const std::vector<MaterialData>& materials, std::string basePath, bool usePlaceholders, const LoadOptions& options);
+
+		// Loaded texture for a material slot, or the placeholder while it is still being decoded
+		gps::Texture GetMaterialTexture(std::string path, std::string type, bool usePlaceholders);
+
+		// Updates the statistics and reports the load time
+		void FinishLoad(std::string fileName, size_t faceVertexCount, bool fromCache, VERTEX_FORMAT format, std::chrono::steady_clock::time_point start);
+
+		// Decodes all textures used by the meshes on the thread pool, uploading each as soon as it is ready
+		void PreloadTextures(const std::vector<MeshView>& meshViews, const std::vector<MaterialData>& materials, std::string basePath);
 
 		// Retrieves a texture associated with the object - by its name and type
 		gps::Texture LoadTexture(std::string path, std::string type);
 
+		// Texture this model already holds, or one another model loaded, referenced through the TextureManager
+		bool FindLoadedTexture(const std::string& path, GLuint& textureId);
+
+		// Shares a freshly uploaded texture, returns the id to use in case another model won the race
+		GLuint AddLoadedTexture(const std::string& path, GLuint textureId);
+
 		// Reads the pixel data from an image file and loads it into the video memory
 		GLuint ReadTextureFromFile(const char* file_name);
+
+		// Reads and flips the pixel data of an image file, safe to call from any thread
+		static DecodedImage DecodeImage(std::string path);
+
+		// Creates the mipmapped texture object, must run on the OpenGL thread
+		static GLuint UploadTexture(const DecodedImage& image);
+
+		// Creates the texture object of a block-compressed image with its stored mip chain
+		static GLuint UploadCompressedTexture(const CompressedImage& image);
     };
 }
 
@@ -0,0 +1,609 @@
+#include "ObjParser.hpp"
+
+#include "MappedFile.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <map>
+#include <sstream>
+
+namespace gps {
+
+    enum ObjStatement { OBJ_USEMTL, OBJ_MTLLIB, OBJ_GROUP, OBJ_OBJECT };
+
+    // A non-geometry statement, remembered with the number of faces that preceded it in its chunk
+    struct ObjEvent {
+
+        ObjStatement statement;
+        size_t faceCount;
+        std::string name;
+    };
+
+    // Everything tokenized from one line-aligned slice of the file
+    struct ObjChunk {
+
+        std::vector<float> vertices;
+        std::vector<float> normals;
+        std::vector<float> texcoords;
+        // face corners, indices already zero based
+        std::vector<tinyobj::index_t> corners;
+        std::vector<unsigned int> faceSizes;
+        // components of `corners` that were relative (negative) and still miss the counts of
+        // the previous chunks, encoded as corner * 3 + {0: vertex, 1: normal, 2: texcoord}
+        std::vector<size_t> relativeComponents;
+        std::vector<ObjEvent> events;
+
+        size_t firstVertex;
+        size_t firstNormal;
+        size_t firstTexcoord;
+    };
+
+    static const double EXACT_POWERS_OF_TEN[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    static inline bool IsSpace(char c) {
+        return c == ' ' || c == '\t';
+    }
+
+    static inline bool IsDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    static inline const char* SkipSpace(const char* p, const char* end) {
+
+        while (p < end && IsSpace(*p)) {
+            p++;
+        }
+        return p;
+    }
+
+    // End of the current token, tokens are separated by spaces, tabs or '\r'
+    static inline const char* TokenEnd(const char* p, const char* end) {
+
+        while (p < end && !IsSpace(*p) && *p != '\r') {
+            p++;
+        }
+        return p;
+    }
+
+    // Decimal float parser: exact for up to 19 significant digits and powers of ten up to 22
+    // (the Clinger fast path), which covers every number an exporter writes; anything else
+    // goes through strtod.
+    static bool ParseDouble(const char* p, const char* end, double* result) {
+
+        const char* start = p;
+        bool negative = false;
+
+        if (p < end && (*p == '+' || *p == '-')) {
+            negative = (*p == '-');
+            p++;
+        }
+
+        uint64_t mantissa = 0;
+        int exponent = 0;
+        int digits = 0;
+
+        while (p < end && IsDigit(*p)) {
+
+            if (mantissa < 100000000000000000ULL) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            }
+            else {
+                exponent++;
+            }
+            digits++;
+            p++;
+        }
+
+        if (p < end && *p == '.') {
+
+            p++;
+            while (p < end && IsDigit(*p)) {
+
+                if (mantissa < 100000000000000000ULL) {
+                    mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                    exponent--;
+                }
+                digits++;
+                p++;
+            }
+        }
+
+        if (digits == 0) {
+            return false;
+        }
+
+        if (p < end && (*p == 'e' || *p == 'E')) {
+
+            p++;
+            bool negativeExponent = false;
+            if (p < end && (*p == '+' || *p == '-')) {
+                negativeExponent = (*p == '-');
+                p++;
+            }
+
+            if (p >= end || !IsDigit(*p)) {
+                return false;
+            }
+
+            int exponentValue = 0;
+            while (p < end && IsDigit(*p)) {
+
+                if (exponentValue < 10000) {
+                    exponentValue = exponentValue * 10 + (*p - '0');
+                }
+                p++;
+            }
+            exponent += negativeExponent ? -exponentValue : exponentValue;
+        }
+
+        if (mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+
+            double value = (double)mantissa;
+            value = exponent < 0 ? value / EXACT_POWERS_OF_TEN[-exponent] : value * EXACT_POWERS_OF_TEN[exponent];
+            *result = negative ? -value : value;
+            return true;
+        }
+
+        char buffer[128];
+        size_t length = std::min((size_t)(end - start), sizeof(buffer) - 1);
+        memcpy(buffer, start, length);
+        buffer[length] = '\0';
+        *result = strtod(buffer, NULL);
+        return true;
+    }
+
+    static inline float ParseFloat(const char** token, const char* end) {
+
+        const char* p = SkipSpace(*token, end);
+        const char* tokenEnd = TokenEnd(p, end);
+
+        double value = 0.0;
+        ParseDouble(p, tokenEnd, &value);
+
+        *token = tokenEnd;
+        return (float)value;
+    }
+
+    // atoi() semantics: optional sign followed by digits, 0 if there are none
+    static inline int ParseInt(const char* p, const char* end) {
+
+        bool negative = false;
+        if (p < end && (*p == '+' || *p == '-')) {
+            negative = (*p == '-');
+            p++;
+        }
+
+        int value = 0;
+        while (p < end && IsDigit(*p)) {
+            value = value * 10 + (*p - '0');
+            p++;
+        }
+        return negative ? -value : value;
+    }
+
+    static inline const char* IndexEnd(const char* p, const char* end) {
+
+        while (p < end && *p != '/' && !IsSpace(*p) && *p != '\r') {
+            p++;
+        }
+        return p;
+    }
+
+    // Same mapping as tinyobj's fixIndex, except relative indices are resolved against the
+    // chunk-local count and flagged for the later prefix fix-up
+    static inline int ResolveIndex(int index, size_t localCount, ObjChunk& chunk, size_t component) {
+
+        if (index > 0) {
+            return index - 1;
+        }
+        if (index == 0) {
+            return 0;
+        }
+
+        chunk.relativeComponents.push_back(component);
+        return (int)localCount + index;
+    }
+
+    static void ParseFace(const char* token, const char* end, ObjChunk& chunk) {
+
+        token = SkipSpace(token, end);
+        unsigned int faceSize = 0;
+
+        while (token < end && *token != '\r') {
+
+            tinyobj::index_t corner;
+            corner.vertex_index = -1;
+            corner.normal_index = -1;
+            corner.texcoord_index = -1;
+
+            size_t componentBase = chunk.corners.size() * 3;
+
+            corner.vertex_index = ResolveIndex(ParseInt(token, end), chunk.vertices.size() / 3, chunk, componentBase + 0);
+            token = IndexEnd(token, end);
+
+            if (token < end && *token == '/') {
+
+                token++;
+                if (token < end && *token == '/') {
+
+                    // i//k
+                    token++;
+                    corner.normal_index = ResolveIndex(ParseInt(token, end), chunk.normals.size() / 3, chunk, componentBase + 1);
+                    token = IndexEnd(token, end);
+                }
+                else {
+
+                    // i/j or i/j/k
+                    corner.texcoord_index = ResolveIndex(ParseInt(token, end), chunk.texcoords.size() / 2, chunk, componentBase + 2);
+                    token = IndexEnd(token, end);
+
+                    if (token < end && *token == '/') {
+
+                        token++;
+                        corner.normal_index = ResolveIndex(ParseInt(token, end), chunk.normals.size() / 3, chunk, componentBase + 1);
+                        token = IndexEnd(token, end);
+                    }
+                }
+            }
+
+            chunk.corners.push_back(corner);
+            faceSize++;
+
+            while (token < end && (IsSpace(*token) || *token == '\r')) {
+                token++;
+            }
+        }
+
+        chunk.faceSizes.push_back(faceSize);
+    }
+
+    static void AddEvent(ObjChunk& chunk, ObjStatement statement, std::string name) {
+
+        ObjEvent event;
+        event.statement = statement;
+        event.faceCount = chunk.faceSizes.size();
+        event.name = name;
+        chunk.events.push_back(event);
+    }
+
+    static void ParseChunk(const char* begin, const char* end, ObjChunk& chunk) {
+
+        // rough reservation, a typical exported line is 30-40 bytes
+        size_t expectedLines = (size_t)(end - begin) / 32;
+        chunk.vertices.reserve(expectedLines);
+        chunk.corners.reserve(expectedLines);
+
+        const char* line = begin;
+        while (line < end) {
+
+            const char* lineEnd = (const char*)memchr(line, '\n', (size_t)(end - line));
+            if (!lineEnd) {
+                lineEnd = end;
+            }
+
+            const char* token = SkipSpace(line, lineEnd);
+            size_t length = (size_t)(lineEnd - token);
+            line = lineEnd + 1;
+
+            if (length == 0 || *token == '#' || *token == '\r') {
+                continue;
+            }
+
+            if (token[0] == 'v' && length > 1 && IsSpace(token[1])) {
+
+                token += 2;
+                float x = ParseFloat(&token, lineEnd);
+                float y = ParseFloat(&token, lineEnd);
+                float z = ParseFloat(&token, lineEnd);
+                chunk.vertices.push_back(x);
+                chunk.vertices.push_back(y);
+                chunk.vertices.push_back(z);
+            }
+            else if (token[0] == 'v' && length > 2 && token[1] == 'n' && IsSpace(token[2])) {
+
+                token += 3;
+                float x = ParseFloat(&token, lineEnd);
+                float y = ParseFloat(&token, lineEnd);
+                float z = ParseFloat(&token, lineEnd);
+                chunk.normals.push_back(x);
+                chunk.normals.push_back(y);
+                chunk.normals.push_back(z);
+            }
+            else if (token[0] == 'v' && length > 2 && token[1] == 't' && IsSpace(token[2])) {
+
+                token += 3;
+                float x = ParseFloat(&token, lineEnd);
+                float y = ParseFloat(&token, lineEnd);
+                chunk.texcoords.push_back(x);
+                chunk.texcoords.push_back(y);
+            }
+            else if (token[0] == 'f' && length > 1 && IsSpace(token[1])) {
+
+                ParseFace(token + 2, lineEnd, chunk);
+            }
+            else if (length > 6 && (strncmp(token, "usemtl", 6) == 0 || strncmp(token, "mtllib", 6) == 0) && IsSpace(token[6])) {
+
+                const char* name = SkipSpace(token + 7, lineEnd);
+                ObjStatement statement = token[0] == 'u' ? OBJ_USEMTL : OBJ_MTLLIB;
+                AddEvent(chunk, statement, std::string(name, TokenEnd(name, lineEnd)));
+            }
+            else if (token[0] == 'g' && length > 1 && IsSpace(token[1])) {
+
+                // the first name after 'g' is used as the shape name
+                const char* name = SkipSpace(token + 2, lineEnd);
+                AddEvent(chunk, OBJ_GROUP, std::string(name, TokenEnd(name, lineEnd)));
+            }
+            else if (token[0] == 'o' && length > 1 && IsSpace(token[1])) {
+
+                const char* name = SkipSpace(token + 2, lineEnd);
+                AddEvent(chunk, OBJ_OBJECT, std::string(name, TokenEnd(name, lineEnd)));
+            }
+
+            // Ignore unknown command.
+        }
+    }
+
+    // Contiguous run of faces inside one chunk
+    struct FaceRange {
+
+        const ObjChunk* chunk;
+        size_t firstFace;
+        size_t lastFace;
+        size_t firstCorner;
+    };
+
+    // Mirrors tinyobj's exportFaceGroupToShape
+    static bool ExportFaceGroup(tinyobj::shape_t& shape, const std::vector<FaceRange>& faceGroup,
+                                int materialId, const std::string& name, bool triangulate) {
+
+        bool empty = true;
+        for (size_t r = 0; r < faceGroup.size(); r++) {
+            empty = empty && faceGroup[r].firstFace == faceGroup[r].lastFace;
+        }
+        if (empty) {
+            return false;
+        }
+
+        tinyobj::mesh_t& mesh = shape.mesh;
+
+        for (size_t r = 0; r < faceGroup.size(); r++) {
+
+            const FaceRange& range = faceGroup[r];
+            const tinyobj::index_t* corner = range.chunk->corners.data() + range.firstCorner;
+
+            for (size_t f = range.firstFace; f < range.lastFace; f++) {
+
+                size_t faceSize = range.chunk->faceSizes[f];
+
+                if (triangulate) {
+
+                    // Polygon -> triangle fan conversion
+                    for (size_t k = 2; k < faceSize; k++) {
+
+                        mesh.indices.push_back(corner[0]);
+                        mesh.indices.push_back(corner[k - 1]);
+                        mesh.indices.push_back(corner[k]);
+                        mesh.num_face_vertices.push_back(3);
+                        mesh.material_ids.push_back(materialId);
+                    }
+                }
+                else {
+
+                    mesh.indices.insert(mesh.indices.end(), corner, corner + faceSize);
+                    mesh.num_face_vertices.push_back((unsigned char)faceSize);
+                    mesh.material_ids.push_back(materialId);
+                }
+
+                corner += faceSize;
+            }
+        }
+
+        shape.name = name;
+        return true;
+    }
+
+    bool LoadObjParallel(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes,
+                         std::vector<tinyobj::material_t>* materials, std::string* err,
+                         const char* filename, const char* mtl_basepath,
+                         bool triangulate) {
+
+        attrib->vertices.clear();
+        attrib->normals.clear();
+        attrib->texcoords.clear();
+        shapes->clear();
+
+        MappedFile file;
+        if (!file.open(filename)) {
+
+            if (err) {
+                std::stringstream errss;
+                errss << "Cannot open file [" << filename << "]" << std::endl;
+                (*err) = errss.str();
+            }
+            return false;
+        }
+
+        const char* data = (const char*)file.getData();
+        const char* dataEnd = data + file.getSize();
+
+        // Split into line-aligned chunks, a few per worker so uneven chunks balance out
+        ThreadPool& pool = ThreadPool::GetShared();
+        const size_t minimumChunkSize = 1 << 20;
+        size_t chunkCount = std::max((size_t)1, std::min(pool.getThreadCount() * 4, file.getSize() / minimumChunkSize));
+
+        std::vector<const char*> boundaries;
+        boundaries.push_back(data);
+        for (size_t i = 1; i < chunkCount; i++) {
+
+            const char* split = data + file.getSize() * i / chunkCount;
+            if (split <= boundaries.back()) {
+                continue;
+            }
+            const char* lineEnd = (const char*)memchr(split, '\n', (size_t)(dataEnd - split));
+            if (!lineEnd) {
+                break;
+            }
+            boundaries.push_back(lineEnd + 1);
+        }
+        boundaries.push_back(dataEnd);
+
+        std::vector<ObjChunk> chunks(boundaries.size() - 1);
+        std::vector<std::future<void> > pending;
+
+        for (size_t i = 0; i < chunks.size(); i++) {
+
+            const char* begin = boundaries[i];
+            const char* end = boundaries[i + 1];
+            ObjChunk* chunk = &chunks[i];
+            pending.push_back(pool.submit([begin, end, chunk]() { ParseChunk(begin, end, *chunk); }));
+        }
+        for (size_t i = 0; i < pending.size(); i++) {
+            pending[i].get();
+        }
+        pending.clear();
+
+        // Attribute offsets of each chunk, then resolve its relative indices in parallel
+        size_t vertexCount = 0, normalCount = 0, texcoordCount = 0;
+        for (size_t i = 0; i < chunks.size(); i++) {
+
+            chunks[i].firstVertex = vertexCount;
+            chunks[i].firstNormal = normalCount;
+            chunks[i].firstTexcoord = texcoordCount;
+            vertexCount += chunks[i].vertices.size() / 3;
+            normalCount += chunks[i].normals.size() / 3;
+            texcoordCount += chunks[i].texcoords.size() / 2;
+        }
+
+        attrib->vertices.resize(vertexCount * 3);
+        attrib->normals.resize(normalCount * 3);
+        attrib->texcoords.resize(texcoordCount * 2);
+
+        for (size_t i = 0; i < chunks.size(); i++) {
+
+            ObjChunk* chunk = &chunks[i];
+            pending.push_back(pool.submit([chunk, attrib]() {
+
+                if (!chunk->vertices.empty()) {
+                    memcpy(&attrib->vertices[chunk->firstVertex * 3], chunk->vertices.data(), chunk->vertices.size() * sizeof(float));
+                }
+                if (!chunk->normals.empty()) {
+                    memcpy(&attrib->normals[chunk->firstNormal * 3], chunk->normals.data(), chunk->normals.size() * sizeof(float));
+                }
+                if (!chunk->texcoords.empty()) {
+                    memcpy(&attrib->texcoords[chunk->firstTexcoord * 2], chunk->texcoords.data(), chunk->texcoords.size() * sizeof(float));
+                }
+
+                for (size_t r = 0; r < chunk->relativeComponents.size(); r++) {
+
+                    size_t component = chunk->relativeComponents[r];
+                    tinyobj::index_t& corner = chunk->corners[component / 3];
+                    switch (component % 3) {
+                    case 0:
+                        corner.vertex_index += (int)chunk->firstVertex;
+                        break;
+                    case 1:
+                        corner.normal_index += (int)chunk->firstNormal;
+                        break;
+                    default:
+                        corner.texcoord_index += (int)chunk->firstTexcoord;
+                        break;
+                    }
+                }
+            }));
+        }
+        for (size_t i = 0; i < pending.size(); i++) {
+            pending[i].get();
+        }
+
+        // Replay the statements in file order with the same state machine as tinyobj::LoadObj
+        tinyobj::MaterialFileReader materialReader(mtl_basepath ? mtl_basepath : "");
+        std::map<std::string, int> materialMap;
+        int material = -1;
+        std::string name;
+        tinyobj::shape_t shape;
+        std::vector<FaceRange> faceGroup;
+
+        for (size_t c = 0; c < chunks.size(); c++) {
+
+            const ObjChunk& chunk = chunks[c];
+            size_t face = 0;
+            size_t corner = 0;
+
+            for (size_t e = 0; e <= chunk.events.size(); e++) {
+
+                // faces before this statement join the current group
+                size_t faceEnd = e < chunk.events.size() ? chunk.events[e].faceCount : chunk.faceSizes.size();
+                if (faceEnd > face) {
+
+                    FaceRange range = { &chunk, face, faceEnd, corner };
+                    faceGroup.push_back(range);
+                    for (; face < faceEnd; face++) {
+                        corner += chunk.faceSizes[face];
+                    }
+                }
+
+                if (e == chunk.events.size()) {
+                    break;
+                }
+
+                const ObjEvent& event = chunk.events[e];
+                switch (event.statement) {
+
+                case OBJ_USEMTL: {
+
+                    std::map<std::string, int>::const_iterator found = materialMap.find(event.name);
+                    int newMaterialId = found != materialMap.end() ? found->second : -1;
+
+                    if (newMaterialId != material) {
+
+                        // per-face material, the shape itself continues
+                        ExportFaceGroup(shape, faceGroup, material, name, triangulate);
+                        faceGroup.clear();
+                        material = newMaterialId;
+                    }
+                    break;
+                }
+
+                case OBJ_MTLLIB: {
+
+                    std::string mtlErr;
+                    bool ok = materialReader(event.name, materials, &materialMap, &mtlErr);
+                    if (err) {
+                        (*err) += mtlErr;
+                    }
+                    if (!ok) {
+                        return false;
+                    }
+                    break;
+                }
+
+                case OBJ_GROUP:
+                case OBJ_OBJECT: {
+
+                    if (ExportFaceGroup(shape, faceGroup, material, name, triangulate)) {
+                        shapes->push_back(shape);
+                    }
+                    shape = tinyobj::shape_t();
+                    faceGroup.clear();
+                    name = event.name;
+                    break;
+                }
+                }
+            }
+        }
+
+        bool exported = ExportFaceGroup(shape, faceGroup, material, name, triangulate);
+        if (exported || shape.mesh.indices.size()) {
+            shapes->push_back(shape);
+        }
+
+        return true;
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef ObjParser_hpp
+#define ObjParser_hpp
+
+#include "tiny_obj_loader.h"
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Drop-in replacement for tinyobj::LoadObj that parses the file on all cores.
+    //
+    // The file is memory mapped and split into line-aligned chunks. Each chunk is tokenized
+    // by a worker thread into its own v/vn/vt/f streams plus the ordered list of usemtl,
+    // mtllib, g and o statements; the chunks are then merged in file order, reproducing the
+    // shape and per-face material grouping of tinyobj::LoadObj. SubD tags ('t') are ignored.
+    bool LoadObjParallel(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes,
+                         std::vector<tinyobj::material_t>* materials, std::string* err,
+                         const char* filename, const char* mtl_basepath = NULL,
+                         bool triangulate = true);
+}
+
+#endif /* ObjParser_hpp */
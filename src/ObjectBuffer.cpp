@@ -0,0 +1,125 @@
+#include "ObjectBuffer.hpp"
+#include "GLStateCache.hpp"
+
+#include <iostream>
+
+namespace gps {
+
+    void ObjectBuffer::create(int capacity) {
+
+        this->capacity = capacity;
+        GLsizeiptr size = (GLsizeiptr)sizeof(ObjectConstants) * capacity * OBJECT_BUFFER_FRAMES;
+
+        glGenBuffers(1, &this->buffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, this->buffer);
+
+#if !defined (__APPLE__)
+        if (GLEW_ARB_buffer_storage) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_TEXTURE_BUFFER, size, NULL, flags);
+            this->persistent = (ObjectConstants*)glMapBufferRange(GL_TEXTURE_BUFFER, 0, size, flags);
+        }
+#endif
+        if (this->persistent == NULL) {
+            glBufferData(GL_TEXTURE_BUFFER, size, NULL, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        glGenTextures(1, &this->texture);
+        GLStateCache::GetShared().bindTexture(GL_TEXTURE_BUFFER, this->texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, this->buffer);
+    }
+
+    void ObjectBuffer::beginFrame() {
+
+        this->slot = (this->slot + 1) % OBJECT_BUFFER_FRAMES;
+        this->count = 0;
+
+        GLsync& fence = this->fences[this->slot];
+        if (fence != NULL) {
+            // the slot was fenced two frames ago, so this rarely waits
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {
+            }
+            glDeleteSync(fence);
+            fence = NULL;
+        }
+
+        if (this->persistent != NULL) {
+            this->writes = this->persistent + this->slot * this->capacity;
+            return;
+        }
+
+        GLsizeiptr slotSize = (GLsizeiptr)sizeof(ObjectConstants) * this->capacity;
+        glBindBuffer(GL_TEXTURE_BUFFER, this->buffer);
+        this->writes = (ObjectConstants*)glMapBufferRange(GL_TEXTURE_BUFFER, this->slot * slotSize, slotSize,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    int ObjectBuffer::add(const glm::mat4& model, const glm::mat3& normalMatrix) {
+
+        if (this->writes == NULL || this->count == this->capacity) {
+            if (!this->overflowReported) {
+                std::cerr << "ERROR: Object buffer is full (" << this->capacity << " objects per frame)" << std::endl;
+                this->overflowReported = true;
+            }
+            return -1;
+        }
+
+        ObjectConstants& constants = this->writes[this->count];
+        constants.model = model;
+        for (int column = 0; column < 3; column++) {
+            constants.normalMatrix[column] = glm::vec4(normalMatrix[column], 0.0f);
+        }
+
+        return this->slot * this->capacity + this->count++;
+    }
+
+    void ObjectBuffer::finishWriting() {
+
+        if (this->persistent == NULL && this->writes != NULL) {
+            glBindBuffer(GL_TEXTURE_BUFFER, this->buffer);
+            glUnmapBuffer(GL_TEXTURE_BUFFER);
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        }
+        this->writes = NULL;
+    }
+
+    void ObjectBuffer::endFrame() {
+
+        this->fences[this->slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    GLuint ObjectBuffer::getTexture() const {
+
+        return this->texture;
+    }
+
+    bool ObjectBuffer::isPersistent() const {
+
+        return this->persistent != NULL;
+    }
+
+    void ObjectBuffer::destroy() {
+
+        for (int i = 0; i < OBJECT_BUFFER_FRAMES; i++) {
+            if (this->fences[i] != NULL) {
+                glDeleteSync(this->fences[i]);
+                this->fences[i] = NULL;
+            }
+        }
+        if (this->buffer != 0) {
+
+            if (this->persistent != NULL) {
+                glBindBuffer(GL_TEXTURE_BUFFER, this->buffer);
+                glUnmapBuffer(GL_TEXTURE_BUFFER);
+                glBindBuffer(GL_TEXTURE_BUFFER, 0);
+                this->persistent = NULL;
+            }
+            GLStateCache::GetShared().deleteTextures(1, &this->texture);
+            glDeleteBuffers(1, &this->buffer);
+            this->buffer = 0;
+            this->texture = 0;
+        }
+    }
+}
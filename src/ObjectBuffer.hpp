@@ -0,0 +1,70 @@
+#ifndef ObjectBuffer_hpp
+#define ObjectBuffer_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+namespace gps {
+
+    // Frames the GPU may still be reading while the CPU writes the next one
+    static const int OBJECT_BUFFER_FRAMES = 3;
+
+    // What a shader fetches for one object: texels 0-3 hold the model matrix's columns, 4-6 the normal matrix's
+    struct ObjectConstants {
+
+        glm::mat4 model;
+        glm::vec4 normalMatrix[3];
+    };
+
+    // Per-object constants of each frame, in a ring of OBJECT_BUFFER_FRAMES slots of one buffer that shaders
+    // read through a buffer texture (samplerBuffer objectConstants, at the index add returned). A slot is
+    // written only once the fence of the frame that last used it has passed, so the writes never wait on the
+    // driver. The buffer stays mapped when ARB_buffer_storage is available; otherwise each frame maps its
+    // own slot, unsynchronized since the fence already orders it.
+    class ObjectBuffer {
+
+    public:
+        // Room for capacity objects per frame, needs the OpenGL context
+        void create(int capacity);
+
+        // Waits for the GPU to finish the frame that last used this frame's slot, and opens the slot for add
+        void beginFrame();
+
+        // Copies an object's constants into the frame's slot and returns the index shaders fetch them at,
+        // or -1 once the slot is full
+        int add(const glm::mat4& model, const glm::mat3& normalMatrix);
+
+        // Ends the writes of this frame, before the first draw that reads them
+        void finishWriting();
+
+        // Fences the frame's slot after its last draw
+        void endFrame();
+
+        // The buffer texture, for a samplerBuffer uniform
+        GLuint getTexture() const;
+
+        bool isPersistent() const;
+
+        void destroy();
+
+    private:
+        GLuint buffer = 0;
+        GLuint texture = 0;
+        GLsync fences[OBJECT_BUFFER_FRAMES] = {};
+        ObjectConstants* persistent = NULL;
+        ObjectConstants* writes = NULL;
+        int capacity = 0;
+        int slot = 0;
+        int count = 0;
+        bool overflowReported = false;
+    };
+}
+
+#endif /* ObjectBuffer_hpp */
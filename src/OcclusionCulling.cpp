@@ -0,0 +1,291 @@
+#include "OcclusionCulling.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <future>
+#include <thread>
+
+#if defined (__SSE__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 1)
+    #include <xmmintrin.h>
+    #define OCCLUSION_CULLING_SSE
+#endif
+
+namespace gps {
+
+    // Workers of the occlusion rasterizer only. Bands on the shared pool would queue behind the texture decodes
+    // of streaming and stall the frame; the calling thread fills one band itself, so one worker fewer is enough.
+    static ThreadPool& GetRasterizerPool() {
+
+        static ThreadPool rasterizerPool(std::max(2u, std::thread::hardware_concurrency()) - 1);
+        return rasterizerPool;
+    }
+
+    OcclusionBuffer::OcclusionBuffer(int width, int height) {
+
+        // rows are processed 4 pixels at a time
+        this->width = std::max(4, (width + 3) / 4 * 4);
+        this->height = std::max(1, height);
+        this->depth.assign((size_t)this->width * this->height, 1.0f);
+    }
+
+    void OcclusionBuffer::clear() {
+
+        this->triangles.clear();
+        std::fill(this->depth.begin(), this->depth.end(), 1.0f);
+    }
+
+    void OcclusionBuffer::addOccluder(const glm::mat4& modelViewProjection, const std::vector<glm::vec3>& corners) {
+
+        for (size_t t = 0; t + 2 < corners.size(); t += 3) {
+
+            glm::vec4 clip[3];
+            for (int k = 0; k < 3; k++) {
+                clip[k] = modelViewProjection * glm::vec4(corners[t + k], 1.0f);
+            }
+
+            // Sutherland-Hodgman against the near plane z >= -w, a triangle becomes at most a quad
+            glm::vec4 polygon[4];
+            int count = 0;
+            for (int k = 0; k < 3; k++) {
+
+                const glm::vec4& a = clip[k];
+                const glm::vec4& b = clip[(k + 1) % 3];
+                float distanceA = a.z + a.w;
+                float distanceB = b.z + b.w;
+
+                if (distanceA >= 0.0f) {
+                    polygon[count++] = a;
+                }
+                if ((distanceA >= 0.0f) != (distanceB >= 0.0f)) {
+                    polygon[count++] = a + (b - a) * (distanceA / (distanceA - distanceB));
+                }
+            }
+
+            if (count < 3) {
+                continue;
+            }
+
+            glm::vec3 screen[4];
+            bool valid = true;
+            for (int k = 0; k < count && valid; k++) {
+
+                valid = polygon[k].w > 0.0f;
+                float inverseW = 1.0f / polygon[k].w;
+                screen[k] = glm::vec3((polygon[k].x * inverseW * 0.5f + 0.5f) * this->width,
+                                      (polygon[k].y * inverseW * 0.5f + 0.5f) * this->height,
+                                      polygon[k].z * inverseW);
+            }
+
+            if (!valid) {
+                continue;
+            }
+
+            for (int k = 1; k + 1 < count; k++) {
+
+                this->triangles.push_back(screen[0]);
+                this->triangles.push_back(screen[k]);
+                this->triangles.push_back(screen[k + 1]);
+            }
+        }
+    }
+
+    void OcclusionBuffer::rasterize() {
+
+        int bands = std::min((int)std::thread::hardware_concurrency(), this->height / 8);
+        if (bands < 2) {
+
+            rasterizeRows(0, this->height);
+            return;
+        }
+
+        ThreadPool& pool = GetRasterizerPool();
+        // bands of rows never share a pixel, each task walks every triangle but only fills its own rows
+        std::vector<std::future<void> > pending;
+        for (int band = 1; band < bands; band++) {
+
+            int firstRow = this->height * band / bands;
+            int endRow = this->height * (band + 1) / bands;
+            pending.push_back(pool.submit([this, firstRow, endRow]() {
+                rasterizeRows(firstRow, endRow);
+            }));
+        }
+
+        rasterizeRows(0, this->height / bands);
+
+        for (size_t i = 0; i < pending.size(); i++) {
+            pending[i].get();
+        }
+    }
+
+    void OcclusionBuffer::rasterizeRows(int firstRow, int endRow) {
+
+        for (size_t t = 0; t + 2 < this->triangles.size(); t += 3) {
+
+            glm::vec3 v0 = this->triangles[t];
+            glm::vec3 v1 = this->triangles[t + 1];
+            glm::vec3 v2 = this->triangles[t + 2];
+
+            int minX = std::max(0, (int)floorf(std::min(v0.x, std::min(v1.x, v2.x))));
+            int endX = std::min(this->width, (int)ceilf(std::max(v0.x, std::max(v1.x, v2.x))));
+            int minY = std::max(firstRow, (int)floorf(std::min(v0.y, std::min(v1.y, v2.y))));
+            int endY = std::min(endRow, (int)ceilf(std::max(v0.y, std::max(v1.y, v2.y))));
+            if (minX >= endX || minY >= endY) {
+                continue;
+            }
+
+            // counter-clockwise on screen, so each edge function is positive inside
+            double area = ((double)v1.x - v0.x) * ((double)v2.y - v0.y) - ((double)v2.x - v0.x) * ((double)v1.y - v0.y);
+            if (!(area > 0.0 || area < 0.0)) {
+                continue;
+            }
+            if (area < 0.0) {
+
+                std::swap(v1, v2);
+                area = -area;
+            }
+
+            // edge i runs from corner i to the next: E(x, y) = a * x + b * y + c. A pixel counts as covered only
+            // when E holds at its four corners, i.e. at its center with a margin of half the edge's slope.
+            const glm::vec3* corners[3] = { &v0, &v1, &v2 };
+            double a[3], b[3], c[3];
+            float margin[3];
+            for (int e = 0; e < 3; e++) {
+
+                const glm::vec3& from = *corners[e];
+                const glm::vec3& to = *corners[(e + 1) % 3];
+                a[e] = (double)from.y - to.y;
+                b[e] = (double)to.x - from.x;
+                c[e] = -(a[e] * from.x + b[e] * from.y);
+                margin[e] = (float)(0.5 * (fabs(a[e]) + fabs(b[e])) * (1.0 + 1e-5));
+            }
+
+            // depth plane, and the farthest depth the triangle reaches within one pixel
+            double dzdx = (((double)v1.z - v0.z) * ((double)v2.y - v0.y) - ((double)v2.z - v0.z) * ((double)v1.y - v0.y)) / area;
+            double dzdy = (((double)v2.z - v0.z) * ((double)v1.x - v0.x) - ((double)v1.z - v0.z) * ((double)v2.x - v0.x)) / area;
+            float depthMargin = (float)(0.5 * (fabs(dzdx) + fabs(dzdy)));
+            float maxDepth = std::max(v0.z, std::max(v1.z, v2.z));
+
+            // whole groups of 4, the width is a multiple of 4
+            minX &= ~3;
+
+            for (int y = minY; y < endY; y++) {
+
+                double centerY = y + 0.5;
+                double centerX = minX + 0.5;
+                float edge[3];
+                for (int e = 0; e < 3; e++) {
+                    edge[e] = (float)(a[e] * centerX + b[e] * centerY + c[e]) - margin[e];
+                }
+                float z = (float)(v0.z + dzdx * (centerX - v0.x) + dzdy * (centerY - v0.y)) + depthMargin;
+                float* row = &this->depth[(size_t)y * this->width];
+
+#if defined (OCCLUSION_CULLING_SSE)
+                __m128 lane = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+                __m128 edge0 = _mm_add_ps(_mm_set1_ps(edge[0]), _mm_mul_ps(lane, _mm_set1_ps((float)a[0])));
+                __m128 edge1 = _mm_add_ps(_mm_set1_ps(edge[1]), _mm_mul_ps(lane, _mm_set1_ps((float)a[1])));
+                __m128 edge2 = _mm_add_ps(_mm_set1_ps(edge[2]), _mm_mul_ps(lane, _mm_set1_ps((float)a[2])));
+                __m128 depth = _mm_add_ps(_mm_set1_ps(z), _mm_mul_ps(lane, _mm_set1_ps((float)dzdx)));
+                __m128 step0 = _mm_set1_ps((float)a[0] * 4.0f);
+                __m128 step1 = _mm_set1_ps((float)a[1] * 4.0f);
+                __m128 step2 = _mm_set1_ps((float)a[2] * 4.0f);
+                __m128 depthStep = _mm_set1_ps((float)dzdx * 4.0f);
+                __m128 farthest = _mm_set1_ps(maxDepth);
+                __m128 zero = _mm_setzero_ps();
+
+                for (int x = minX; x < endX; x += 4) {
+
+                    __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(edge0, zero), _mm_cmpge_ps(edge1, zero)), _mm_cmpge_ps(edge2, zero));
+                    if (_mm_movemask_ps(inside) != 0) {
+
+                        __m128 stored = _mm_loadu_ps(row + x);
+                        __m128 written = _mm_min_ps(stored, _mm_min_ps(depth, farthest));
+                        _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, written), _mm_andnot_ps(inside, stored)));
+                    }
+
+                    edge0 = _mm_add_ps(edge0, step0);
+                    edge1 = _mm_add_ps(edge1, step1);
+                    edge2 = _mm_add_ps(edge2, step2);
+                    depth = _mm_add_ps(depth, depthStep);
+                }
+#else
+                for (int x = minX; x < endX; x++) {
+
+                    float offset = (float)(x - minX);
+                    if (edge[0] + (float)a[0] * offset >= 0.0f && edge[1] + (float)a[1] * offset >= 0.0f && edge[2] + (float)a[2] * offset >= 0.0f) {
+                        row[x] = std::min(row[x], std::min(z + (float)dzdx * offset, maxDepth));
+                    }
+                }
+#endif
+            }
+        }
+    }
+
+    bool OcclusionBuffer::isBoxOccluded(const glm::mat4& modelViewProjection, glm::vec3 minimum, glm::vec3 maximum) const {
+
+        glm::vec2 low(FLT_MAX);
+        glm::vec2 high(-FLT_MAX);
+        float nearest = FLT_MAX;
+
+        for (int corner = 0; corner < 8; corner++) {
+
+            glm::vec3 position(corner & 1 ? maximum.x : minimum.x, corner & 2 ? maximum.y : minimum.y, corner & 4 ? maximum.z : minimum.z);
+            glm::vec4 clip = modelViewProjection * glm::vec4(position, 1.0f);
+            if (clip.w <= 0.0f || clip.z < -clip.w) {
+                return false;
+            }
+
+            glm::vec3 ndc = glm::vec3(clip) / clip.w;
+            low = glm::min(low, glm::vec2(ndc.x, ndc.y));
+            high = glm::max(high, glm::vec2(ndc.x, ndc.y));
+            nearest = std::min(nearest, ndc.z);
+        }
+
+        // every pixel the screen rectangle touches
+        int minX = std::max(0, (int)floorf((low.x * 0.5f + 0.5f) * this->width));
+        int endX = std::min(this->width, (int)ceilf((high.x * 0.5f + 0.5f) * this->width));
+        int minY = std::max(0, (int)floorf((low.y * 0.5f + 0.5f) * this->height));
+        int endY = std::min(this->height, (int)ceilf((high.y * 0.5f + 0.5f) * this->height));
+        if (minX >= endX || minY >= endY) {
+            return false;
+        }
+
+        for (int y = minY; y < endY; y++) {
+
+            const float* row = &this->depth[(size_t)y * this->width];
+            int x = minX;
+
+#if defined (OCCLUSION_CULLING_SSE)
+            __m128 boxDepth = _mm_set1_ps(nearest);
+            for (; x + 4 <= endX; x += 4) {
+
+                if (_mm_movemask_ps(_mm_cmple_ps(boxDepth, _mm_loadu_ps(row + x))) != 0) {
+                    return false;
+                }
+            }
+#endif
+
+            for (; x < endX; x++) {
+
+                if (nearest <= row[x]) {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    int OcclusionBuffer::getWidth() const {
+        return this->width;
+    }
+
+    int OcclusionBuffer::getHeight() const {
+        return this->height;
+    }
+
+    size_t OcclusionBuffer::getTriangleCount() const {
+        return this->triangles.size() / 3;
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef OcclusionCulling_hpp
+#define OcclusionCulling_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace gps {
+
+    // Resolution of the depth buffer occluders are rasterized into, the width a multiple of 4
+    static const int OCCLUSION_BUFFER_WIDTH = 256;
+    static const int OCCLUSION_BUFFER_HEIGHT = 128;
+    // Largest triangles of a model kept as its occluders, see LoadOptions::selectOccluders
+    static const size_t OCCLUSION_MAX_OCCLUDER_TRIANGLES = 8192;
+
+    // Small CPU depth buffer for occlusion culling. Occluders only write the pixels they cover entirely,
+    // at the farthest depth they have inside each pixel, so a box found behind them is hidden at any resolution.
+    // Rows are rasterized 4 pixels at a time with SSE where available.
+    class OcclusionBuffer {
+
+    public:
+        OcclusionBuffer(int width = OCCLUSION_BUFFER_WIDTH, int height = OCCLUSION_BUFFER_HEIGHT);
+
+        // Forgets the queued occluders and resets every pixel to the far plane
+        void clear();
+
+        // Queues the triangles of an occluder, three model space corners each, clipped against the near plane
+        void addOccluder(const glm::mat4& modelViewProjection, const std::vector<glm::vec3>& corners);
+
+        // Rasterizes the queued occluders in bands of rows, the first on the calling thread and the rest on workers
+        // of its own, so texture decodes queued on the shared ThreadPool never delay it
+        void rasterize();
+
+        // True if every pixel the box may cover holds an occluder in front of the box's nearest point.
+        // Boxes reaching the near plane or entirely off screen are never occluded.
+        bool isBoxOccluded(const glm::mat4& modelViewProjection, glm::vec3 minimum, glm::vec3 maximum) const;
+
+        int getWidth() const;
+
+        int getHeight() const;
+
+        // Screen space triangles queued since clear
+        size_t getTriangleCount() const;
+
+    private:
+        int width;
+        int height;
+        // normalized device depth per pixel, rows bottom up
+        std::vector<float> depth;
+        // three corners per triangle: x and y in pixels, z in normalized device depth
+        std::vector<glm::vec3> triangles;
+
+        void rasterizeRows(int firstRow, int endRow);
+    };
+}
+
+#endif /* OcclusionCulling_hpp */
@@ -0,0 +1,307 @@
+#include "RenderQueue.hpp"
+#include "GLStateCache.hpp"
+
+#include <cstring>
+
+namespace gps {
+
+    // The bits of a non-negative float sort like the float itself; the top 24 keep 15 bits of mantissa
+    static uint64_t QuantizeDepth(float viewDepth) {
+
+        if (!(viewDepth > 0.0f)) {
+            return 0;
+        }
+        uint32_t bits;
+        memcpy(&bits, &viewDepth, sizeof(bits));
+        return bits >> 8;
+    }
+
+    uint64_t MakeRenderKey(unsigned pass, RENDER_LAYER layer, unsigned shader, unsigned material, float viewDepth) {
+
+        uint64_t key = (uint64_t)(pass & 0xF) << 60 | (uint64_t)(layer & 0x3) << 58;
+        uint64_t depth = QuantizeDepth(viewDepth);
+        uint64_t state = (uint64_t)(shader & 0x3FF) << 24 | (material & 0xFFFFFF);
+
+        if (layer == RENDER_TRANSPARENT) {
+            return key | (0xFFFFFF - depth) << 34 | state;
+        }
+        return key | state << 24 | depth;
+    }
+
+    // 11 bit digits sort 64 bit keys in six passes, with histograms that still fit the L1 cache
+    static const int RADIX_BITS = 11;
+    static const int RADIX_DIGITS = 1 << RADIX_BITS;
+    static const int RADIX_PASSES = (64 + RADIX_BITS - 1) / RADIX_BITS;
+
+    void RadixSortKeys(std::vector<RenderKey>& keys, std::vector<RenderKey>& scratch) {
+
+        size_t count = keys.size();
+        if (count < 2) {
+            return;
+        }
+        scratch.resize(count);
+
+        // histograms of all digits in a single read of the keys
+        uint32_t histograms[RADIX_PASSES][RADIX_DIGITS];
+        memset(histograms, 0, sizeof(histograms));
+        for (size_t i = 0; i < count; i++) {
+
+            uint64_t key = keys[i].key;
+            for (int pass = 0; pass < RADIX_PASSES; pass++) {
+                histograms[pass][(key >> (pass * RADIX_BITS)) & (RADIX_DIGITS - 1)]++;
+            }
+        }
+
+        RenderKey* source = keys.data();
+        RenderKey* target = scratch.data();
+        for (int pass = 0; pass < RADIX_PASSES; pass++) {
+
+            int shift = pass * RADIX_BITS;
+            uint32_t* histogram = histograms[pass];
+            if (histogram[(source[0].key >> shift) & (RADIX_DIGITS - 1)] == count) {
+                continue;
+            }
+
+            uint32_t offset = 0;
+            for (int digit = 0; digit < RADIX_DIGITS; digit++) {
+
+                uint32_t digitCount = histogram[digit];
+                histogram[digit] = offset;
+                offset += digitCount;
+            }
+
+            for (size_t i = 0; i < count; i++) {
+                target[histogram[(source[i].key >> shift) & (RADIX_DIGITS - 1)]++] = source[i];
+            }
+
+            RenderKey* swap = source;
+            source = target;
+            target = swap;
+        }
+
+        if (source != keys.data()) {
+            keys.swap(scratch);
+        }
+    }
+
+    void RenderQueue::clear() {
+
+        this->items.clear();
+        this->contexts.clear();
+        this->keys.clear();
+    }
+
+    size_t RenderQueue::addContext(const DrawContext& context) {
+
+        this->contexts.push_back(context);
+        return this->contexts.size() - 1;
+    }
+
+    void RenderQueue::submit(unsigned pass, RENDER_LAYER layer, Mesh& mesh, Shader& shader, size_t context, int objectIndex, float viewDepth) {
+
+        // the same textures give the same material, a collision only costs some grouping. Meshes of an arena
+        // pool start from its vertex array, so they stay together for the batches.
+        unsigned material = mesh.isInArena() ? mesh.getBuffers().VAO : 0;
+        for (size_t i = 0; i < mesh.textures.size(); i++) {
+            material = material * 4099u + mesh.textures[i].id;
+        }
+
+        RenderKey key = { MakeRenderKey(pass, layer, shader.shaderProgram, material, viewDepth), (uint32_t)this->items.size() };
+        RenderItem item = { &mesh, &shader, context, objectIndex, layer };
+        this->keys.push_back(key);
+        this->items.push_back(item);
+    }
+
+    void RenderQueue::sort() {
+
+        RadixSortKeys(this->keys, this->scratch);
+    }
+
+    static bool SameTextures(const Mesh& a, const Mesh& b) {
+
+        if (a.textures.size() != b.textures.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a.textures.size(); i++) {
+            if (a.textures[i].id != b.textures[i].id || a.textures[i].type != b.textures[i].type) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool RenderQueue::canBatch(const RenderItem& first, const RenderItem& item) const {
+
+        if (item.shader != first.shader || item.layer != first.layer || !item.mesh->isInArena()) {
+            return false;
+        }
+        // one pool, so one vertex layout and index type
+        if (item.mesh->getBuffers().VAO != first.mesh->getBuffers().VAO) {
+            return false;
+        }
+        // depth only passes sample no textures and batch across materials
+        return !first.shader->samplesMaterialTextures() || SameTextures(*first.mesh, *item.mesh);
+    }
+
+    size_t RenderQueue::execute() {
+
+        GLStateCache& state = GLStateCache::GetShared();
+        GeometryArena& arena = GeometryArena::GetShared();
+        size_t triangles = 0;
+
+        // the culled ranges of every batch first, so all their records and commands go up in one upload
+        this->batches.clear();
+        this->records.clear();
+        this->commands.clear();
+        for (size_t i = 0; i < this->keys.size(); ) {
+
+            const RenderItem& first = this->items[this->keys[i].item];
+            Batch batch = { i, i + 1, this->commands.size(), 0 };
+            if (!first.mesh->isInArena()) {
+
+                this->batches.push_back(batch);
+                i++;
+                continue;
+            }
+
+            while (batch.end < this->keys.size() && canBatch(first, this->items[this->keys[batch.end].item])) {
+                batch.end++;
+            }
+
+            for (size_t k = batch.first; k < batch.end; k++) {
+
+                const RenderItem& item = this->items[this->keys[k].item];
+                DrawContext& context = this->contexts[item.context];
+                this->ranges.clear();
+                size_t drawn = item.mesh->getDrawRanges(context, this->ranges);
+                if (context.stats != NULL) {
+                    context.stats->triangles += drawn;
+                }
+                triangles += drawn;
+                if (this->ranges.empty()) {
+                    continue;
+                }
+
+                GLuint record = (GLuint)this->records.size();
+                DrawRecord drawRecord = { glm::vec4(item.mesh->getPositionScale(), (float)item.objectIndex), glm::vec4(item.mesh->getPositionOffset(), 0.0f) };
+                this->records.push_back(drawRecord);
+
+                size_t indexSize = item.mesh->getIndexType() == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+                for (size_t r = 0; r < this->ranges.size(); r++) {
+
+                    const IndexRange& range = this->ranges[r];
+                    DrawElementsCommand command = { (GLuint)range.count, 1, (GLuint)(range.offset / indexSize), range.baseVertex, record };
+                    this->commands.push_back(command);
+                }
+            }
+
+            batch.commandCount = this->commands.size() - batch.firstCommand;
+            this->batches.push_back(batch);
+            i = batch.end;
+        }
+        arena.uploadDraws(this->records, this->commands);
+
+        Shader* shader = NULL;
+        int objectIndexId = -1;
+        int drawBaseId = -1;
+        bool blending = false;
+
+        for (size_t b = 0; b < this->batches.size(); b++) {
+
+            const Batch& batch = this->batches[b];
+            const RenderItem& first = this->items[this->keys[batch.first].item];
+            if (first.shader != shader) {
+
+                shader = first.shader;
+                shader->useShaderProgram();
+                objectIndexId = shader->getKnownUniformId(UNIFORM_OBJECT_INDEX);
+                drawBaseId = shader->getKnownUniformId(UNIFORM_DRAW_BASE);
+            }
+
+            // transparent meshes come last, blended over the rest without writing depth
+            bool blend = first.layer == RENDER_TRANSPARENT;
+            if (blend != blending) {
+
+                state.setEnabled(GL_BLEND, blend);
+                state.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                state.depthMask(blend ? GL_FALSE : GL_TRUE);
+                blending = blend;
+            }
+
+            if (first.mesh->isInArena()) {
+
+                if (batch.commandCount > 0) {
+                    drawBatch(*shader, drawBaseId, first, batch);
+                }
+                continue;
+            }
+
+            shader->setUniform(objectIndexId, first.objectIndex);
+            DrawContext& context = this->contexts[first.context];
+            size_t drawn = first.mesh->Draw(*shader, context);
+            if (context.stats != NULL) {
+                context.stats->triangles += drawn;
+            }
+            triangles += drawn;
+            this->drawCalls += drawn > 0 ? 1 : 0;
+        }
+
+        if (blending) {
+
+            state.setEnabled(GL_BLEND, false);
+            state.depthMask(GL_TRUE);
+        }
+        return triangles;
+    }
+
+    void RenderQueue::drawBatch(Shader& shader, int drawBaseId, const RenderItem& first, const Batch& batch) {
+
+        GeometryArena& arena = GeometryArena::GetShared();
+        Mesh& mesh = *first.mesh;
+        GLenum indexType = mesh.getIndexType();
+
+        mesh.bindTextures(shader);
+        GLStateCache::GetShared().bindVertexArray(mesh.getBuffers().VAO);
+
+        // each command's baseInstance is its draw record
+        if (arena.hasMultiDrawIndirect()) {
+
+            shader.setUniform(drawBaseId, 0);
+            arena.drawIndirect(indexType, batch.firstCommand, batch.commandCount);
+            this->drawCalls++;
+            return;
+        }
+
+        // without base instances the draw id is always 0, drawBase alone picks the record
+        size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+        size_t end = batch.firstCommand + batch.commandCount;
+        for (size_t c = batch.firstCommand; c < end; ) {
+
+            GLuint record = this->commands[c].baseInstance;
+            this->drawCounts.clear();
+            this->drawOffsets.clear();
+            this->drawBaseVertices.clear();
+            for (; c < end && this->commands[c].baseInstance == record; c++) {
+
+                const DrawElementsCommand& command = this->commands[c];
+                this->drawCounts.push_back((GLsizei)command.count);
+                this->drawOffsets.push_back((const GLvoid*)(command.firstIndex * indexSize));
+                this->drawBaseVertices.push_back(command.baseVertex);
+            }
+
+            shader.setUniform(drawBaseId, (GLint)record);
+            glMultiDrawElementsBaseVertex(GL_TRIANGLES, this->drawCounts.data(), indexType, this->drawOffsets.data(), (GLsizei)this->drawCounts.size(), this->drawBaseVertices.data());
+            this->drawCalls++;
+        }
+    }
+
+    size_t RenderQueue::size() const {
+
+        return this->keys.size();
+    }
+
+    size_t RenderQueue::getDrawCallCount() const {
+
+        return this->drawCalls;
+    }
+}
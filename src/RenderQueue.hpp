@@ -0,0 +1,100 @@
+#ifndef RenderQueue_hpp
+#define RenderQueue_hpp
+
+#include "GeometryArena.hpp"
+#include "Mesh.hpp"
+#include "Shader.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    enum RENDER_LAYER { RENDER_OPAQUE = 0, RENDER_ALPHA_TESTED = 1, RENDER_TRANSPARENT = 2 };
+
+    // Sort key of a submission, most significant bits first:
+    //   pass (4) | layer (2) | shader (10) | material (24) | view depth (24)            opaque and alpha tested
+    //   pass (4) | layer (2) | inverted view depth (24) | shader (10) | material (24)   transparent
+    // Passes run in order. Opaque and alpha tested meshes are grouped by program and textures and drawn front to
+    // back within a group, for early depth rejection; transparent ones are drawn back to front for blending.
+    uint64_t MakeRenderKey(unsigned pass, RENDER_LAYER layer, unsigned shader, unsigned material, float viewDepth);
+
+    struct RenderKey {
+
+        uint64_t key;
+        // submission the key belongs to
+        uint32_t item;
+    };
+
+    // Stable least significant digit radix sort on the keys, 11 bits per pass. Digits that are the same in every
+    // key (such as the pass and layer within one pass) cost no pass. scratch is only storage, kept by the caller
+    // between frames.
+    void RadixSortKeys(std::vector<RenderKey>& keys, std::vector<RenderKey>& scratch);
+
+    // Meshes submitted for a frame, drawn in key order instead of the order they were submitted in
+    class RenderQueue {
+
+    public:
+        void clear();
+
+        // Keeps a copy of the context meshes submitted with the returned handle are drawn with
+        size_t addContext(const DrawContext& context);
+
+        // Queues a mesh for execute. viewDepth is its distance from the context's camera; objectIndex goes to the
+        // shader's objectIndex uniform, see ObjectBuffer.
+        void submit(unsigned pass, RENDER_LAYER layer, Mesh& mesh, Shader& shader, size_t context, int objectIndex, float viewDepth);
+
+        void sort();
+
+        // Draws the sorted submissions through the GL state cache, blending the transparent layer, and adds
+        // their triangles to their contexts' stats. Consecutive meshes of the GeometryArena that share the program
+        // and textures (or whose textures the program does not sample) go out as one batch of indirect commands.
+        // Returns the number of triangles drawn.
+        size_t execute();
+
+        size_t size() const;
+
+        // Draw calls issued by execute so far
+        size_t getDrawCallCount() const;
+
+    private:
+        struct RenderItem {
+
+            Mesh* mesh;
+            Shader* shader;
+            size_t context;
+            int objectIndex;
+            RENDER_LAYER layer;
+        };
+
+        // Sorted submissions first to end, with their commands if they are in the arena
+        struct Batch {
+
+            size_t first;
+            size_t end;
+            size_t firstCommand;
+            size_t commandCount;
+        };
+
+        bool canBatch(const RenderItem& first, const RenderItem& item) const;
+        // Issues a batch's commands with one glMultiDrawElementsIndirect, or on OpenGL 4.1 with one
+        // glMultiDrawElementsBaseVertex per draw record
+        void drawBatch(Shader& shader, int drawBaseId, const RenderItem& first, const Batch& batch);
+
+        std::vector<RenderItem> items;
+        std::vector<DrawContext> contexts;
+        std::vector<RenderKey> keys;
+        std::vector<RenderKey> scratch;
+        // per execute scratch
+        std::vector<Batch> batches;
+        std::vector<DrawRecord> records;
+        std::vector<DrawElementsCommand> commands;
+        std::vector<IndexRange> ranges;
+        std::vector<GLsizei> drawCounts;
+        std::vector<const GLvoid*> drawOffsets;
+        std::vector<GLint> drawBaseVertices;
+        size_t drawCalls = 0;
+    };
+}
+
+#endif /* RenderQueue_hpp */
@@ -7,6 +7,11 @@
 //
 
 #include "Shader.hpp"
+#include "GLStateCache.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cstring>
 
 namespace gps {
     std::string Shader::readShaderFile(std::string fileName) {
@@ -89,11 +94,178 @@ namespace gps {
         glDeleteShader(fragmentShader);
         //check linking info
         shaderLinkLog(this->shaderProgram);
+
+        reflect();
+    }
+
+    // Names of the SHADER_UNIFORM values in the shaders, the samplers matching Texture::type
+    static const char* KNOWN_UNIFORM_NAMES[UNIFORM_KNOWN_COUNT] = {
+        "positionScale", "positionOffset", "drawBase", "objectIndex", "ambientTexture", "diffuseTexture", "specularTexture"
+    };
+
+    Shader::Shader() {
+
+        this->shaderProgram = 0;
+        // until loadShader reflects a program, it has no uniforms
+        for (int uniform = 0; uniform <= UNIFORM_KNOWN_COUNT; uniform++) {
+            this->knownUniformIds[uniform] = -1;
+        }
+    }
+
+    SHADER_UNIFORM GetTextureUniform(const std::string& type) {
+
+        for (int uniform = UNIFORM_AMBIENT_TEXTURE; uniform <= UNIFORM_SPECULAR_TEXTURE; uniform++) {
+            if (type == KNOWN_UNIFORM_NAMES[uniform]) {
+                return (SHADER_UNIFORM)uniform;
+            }
+        }
+        return UNIFORM_KNOWN_COUNT;
+    }
+
+    void Shader::reflect() {
+
+        this->uniforms.clear();
+        this->uniformIds.clear();
+        this->uniformBlocks.clear();
+
+        GLint count = 0;
+        GLint maxLength = 0;
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> name(maxLength + 1);
+
+        for (GLint i = 0; i < count; i++) {
+
+            Uniform uniform;
+            GLsizei length = 0;
+            glGetActiveUniform(this->shaderProgram, i, (GLsizei)name.size(), &length, &uniform.size, &uniform.type, name.data());
+            uniform.name.assign(name.data(), length);
+            // arrays are reported as name[0]
+            if (uniform.name.size() > 3 && uniform.name.compare(uniform.name.size() - 3, 3, "[0]") == 0) {
+                uniform.name.resize(uniform.name.size() - 3);
+            }
+
+            // members of uniform blocks have no location, the blocks are reflected below
+            uniform.location = glGetUniformLocation(this->shaderProgram, uniform.name.c_str());
+            if (uniform.location < 0) {
+                continue;
+            }
+
+            uniform.known = false;
+
+            this->uniformIds[uniform.name] = (int)this->uniforms.size();
+            this->uniforms.push_back(uniform);
+        }
+
+        count = 0;
+        maxLength = 0;
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+        name.resize(maxLength + 1);
+
+        for (GLint i = 0; i < count; i++) {
+
+            GLsizei length = 0;
+            glGetActiveUniformBlockName(this->shaderProgram, i, (GLsizei)name.size(), &length, name.data());
+            this->uniformBlocks[std::string(name.data(), length)] = (GLuint)i;
+        }
+
+        for (int uniform = 0; uniform < UNIFORM_KNOWN_COUNT; uniform++) {
+            this->knownUniformIds[uniform] = getUniformId(KNOWN_UNIFORM_NAMES[uniform]);
+        }
+        this->knownUniformIds[UNIFORM_KNOWN_COUNT] = -1;
+    }
+
+    int Shader::getUniformId(const std::string& name) const {
+
+        std::unordered_map<std::string, int>::const_iterator found = this->uniformIds.find(name);
+        return found == this->uniformIds.end() ? -1 : found->second;
+    }
+
+    int Shader::getKnownUniformId(SHADER_UNIFORM uniform) const {
+
+        return this->knownUniformIds[uniform];
+    }
+
+    bool Shader::samplesMaterialTextures() const {
+
+        return this->knownUniformIds[UNIFORM_AMBIENT_TEXTURE] >= 0 || this->knownUniformIds[UNIFORM_DIFFUSE_TEXTURE] >= 0 ||
+            this->knownUniformIds[UNIFORM_SPECULAR_TEXTURE] >= 0;
+    }
+
+    GLint Shader::getUniformLocation(int uniformId) const {
+
+        return uniformId < 0 ? -1 : this->uniforms[uniformId].location;
+    }
+
+    GLuint Shader::getUniformBlockIndex(const std::string& name) const {
+
+        std::unordered_map<std::string, GLuint>::const_iterator found = this->uniformBlocks.find(name);
+        return found == this->uniformBlocks.end() ? GL_INVALID_INDEX : found->second;
+    }
+
+    bool Shader::updateCachedValue(int uniformId, const void* value, size_t size) {
+
+        Uniform& uniform = this->uniforms[uniformId];
+        if (uniform.known && memcmp(uniform.value, value, size) == 0) {
+            this->uniformSkips++;
+            return false;
+        }
+
+        memcpy(uniform.value, value, size);
+        uniform.known = true;
+        this->uniformUploads++;
+        return true;
+    }
+
+    void Shader::setUniform(int uniformId, GLint value) {
+
+        if (uniformId >= 0 && updateCachedValue(uniformId, &value, sizeof(value))) {
+            glUniform1i(this->uniforms[uniformId].location, value);
+        }
+    }
+
+    void Shader::setUniform(int uniformId, GLfloat value) {
+
+        if (uniformId >= 0 && updateCachedValue(uniformId, &value, sizeof(value))) {
+            glUniform1f(this->uniforms[uniformId].location, value);
+        }
+    }
+
+    void Shader::setUniform(int uniformId, const glm::vec3& value) {
+
+        if (uniformId >= 0 && updateCachedValue(uniformId, glm::value_ptr(value), sizeof(value))) {
+            glUniform3fv(this->uniforms[uniformId].location, 1, glm::value_ptr(value));
+        }
+    }
+
+    void Shader::setUniform(int uniformId, const glm::mat3& value) {
+
+        if (uniformId >= 0 && updateCachedValue(uniformId, glm::value_ptr(value), sizeof(value))) {
+            glUniformMatrix3fv(this->uniforms[uniformId].location, 1, GL_FALSE, glm::value_ptr(value));
+        }
+    }
+
+    void Shader::setUniform(int uniformId, const glm::mat4& value) {
+
+        if (uniformId >= 0 && updateCachedValue(uniformId, glm::value_ptr(value), sizeof(value))) {
+            glUniformMatrix4fv(this->uniforms[uniformId].location, 1, GL_FALSE, glm::value_ptr(value));
+        }
+    }
+
+    size_t Shader::getUniformUploadCount() const {
+
+        return this->uniformUploads;
+    }
+
+    size_t Shader::getUniformSkipCount() const {
+
+        return this->uniformSkips;
     }
     
     void Shader::useShaderProgram() {
 
-        glUseProgram(this->shaderProgram);
+        GLStateCache::GetShared().useProgram(this->shaderProgram);
     }
 
 }
@@ -17,24 +17,93 @@
     #include <GL/glew.h>
 #endif
 
+#include <glm/glm.hpp>
+
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 
 namespace gps {
+
+    // Uniforms set for every draw, by Mesh and RenderQueue. Their ids are resolved once after linking,
+    // so drawing never looks a name up.
+    enum SHADER_UNIFORM {
+        UNIFORM_POSITION_SCALE, UNIFORM_POSITION_OFFSET, UNIFORM_DRAW_BASE, UNIFORM_OBJECT_INDEX,
+        UNIFORM_AMBIENT_TEXTURE, UNIFORM_DIFFUSE_TEXTURE, UNIFORM_SPECULAR_TEXTURE, UNIFORM_KNOWN_COUNT
+    };
+
+    // The material sampler a Texture::type binds to, UNIFORM_KNOWN_COUNT if it is none of them
+    SHADER_UNIFORM GetTextureUniform(const std::string& type);
     
     class Shader {
 
     public:
         GLuint shaderProgram;
+        Shader();
         void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
         void useShaderProgram();
-    
+
+        // Index of an active uniform in the table filled after linking, -1 if the program has no uniform of
+        // that name (or the compiler dropped it). Look ids up once and keep them where a uniform is set per draw.
+        int getUniformId(const std::string& name) const;
+
+        // Id of a uniform set per draw, -1 if the program does not use it; UNIFORM_KNOWN_COUNT gives -1
+        int getKnownUniformId(SHADER_UNIFORM uniform) const;
+
+        // True if the program samples any of the material textures
+        bool samplesMaterialTextures() const;
+
+        // Location of a uniform by id, -1 for id -1
+        GLint getUniformLocation(int uniformId) const;
+
+        // Index of an active uniform block, GL_INVALID_INDEX if the program has none of that name
+        GLuint getUniformBlockIndex(const std::string& name) const;
+
+        // Set a uniform of this program, which must be in use. The upload is skipped when the uniform already
+        // holds the value set last, so the program's uniforms must only be set through these; ids of -1 are ignored.
+        void setUniform(int uniformId, GLint value);
+        void setUniform(int uniformId, GLfloat value);
+        void setUniform(int uniformId, const glm::vec3& value);
+        void setUniform(int uniformId, const glm::mat3& value);
+        void setUniform(int uniformId, const glm::mat4& value);
+
+        // Uploads that changed a uniform, and the ones skipped because it already held the value
+        size_t getUniformUploadCount() const;
+        size_t getUniformSkipCount() const;
+
     private:
+        struct Uniform {
+
+            std::string name;
+            GLint location;
+            // GL_FLOAT_MAT4, GL_SAMPLER_2D...
+            GLenum type;
+            // array length, only the first element is cached
+            GLint size;
+            // the value set last, as raw bits, if any
+            bool known;
+            GLfloat value[16];
+        };
+
+        std::vector<Uniform> uniforms;
+        std::unordered_map<std::string, int> uniformIds;
+        std::unordered_map<std::string, GLuint> uniformBlocks;
+        // one more than needed, so UNIFORM_KNOWN_COUNT reads as absent
+        int knownUniformIds[UNIFORM_KNOWN_COUNT + 1];
+        size_t uniformUploads = 0;
+        size_t uniformSkips = 0;
+
         std::string readShaderFile(std::string fileName);
         void shaderCompileLog(GLuint shaderId);
         void shaderLinkLog(GLuint shaderProgramId);
+        // Fills the uniform and block tables from the linked program
+        void reflect();
+        // True if the uniform needs uploading, and remembers the value
+        bool updateCachedValue(int uniformId, const void* value, size_t size);
     };
     
 }
@@ -0,0 +1,120 @@
+#include "ShadowCache.hpp"
+#include "GLStateCache.hpp"
+
+#include <iostream>
+
+namespace gps {
+
+    void ShadowCache::beginFrame() {
+
+        this->inputs.clear();
+    }
+
+    void ShadowCache::track(const glm::mat4& value) {
+
+        for (int column = 0; column < 4; column++) {
+            for (int row = 0; row < 4; row++) {
+                this->inputs.push_back(value[column][row]);
+            }
+        }
+    }
+
+    void ShadowCache::track(size_t value) {
+
+        this->inputs.push_back((double)value);
+    }
+
+    bool ShadowCache::isStaticLayerValid() {
+
+        bool reused = this->enabled && this->valid && this->inputs == this->drawnInputs;
+        if (reused) {
+            this->reuses++;
+        }
+        return reused;
+    }
+
+    void ShadowCache::staticLayerDrawn() {
+
+        this->drawnInputs.swap(this->inputs);
+        this->valid = true;
+        this->redraws++;
+    }
+
+    void ShadowCache::invalidate() {
+
+        this->valid = false;
+    }
+
+    void ShadowCache::setEnabled(bool enabled) {
+
+        this->enabled = enabled;
+        this->valid = false;
+    }
+
+    bool ShadowCache::isEnabled() const {
+
+        return this->enabled;
+    }
+
+    GLuint ShadowCache::getStaticLayerFramebuffer(GLsizei width, GLsizei height) {
+
+        if (this->staticFramebuffer != 0 && this->width == width && this->height == height) {
+            return this->staticFramebuffer;
+        }
+
+        destroy();
+        this->width = width;
+        this->height = height;
+
+        glGenTextures(1, &this->staticTexture);
+        GLStateCache& state = GLStateCache::GetShared();
+        state.bindTexture(GL_TEXTURE_2D, this->staticTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        glGenFramebuffers(1, &this->staticFramebuffer);
+        state.bindFramebuffer(GL_FRAMEBUFFER, this->staticFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, this->staticTexture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "ERROR: Static shadow layer framebuffer is not complete!" << std::endl;
+        }
+
+        // nothing has been drawn into the new layer yet
+        this->valid = false;
+        return this->staticFramebuffer;
+    }
+
+    void ShadowCache::copyStaticLayer(GLuint targetFramebuffer) {
+
+        GLStateCache& state = GLStateCache::GetShared();
+        state.bindFramebuffer(GL_READ_FRAMEBUFFER, this->staticFramebuffer);
+        state.bindFramebuffer(GL_DRAW_FRAMEBUFFER, targetFramebuffer);
+        glBlitFramebuffer(0, 0, this->width, this->height, 0, 0, this->width, this->height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        state.bindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+    }
+
+    void ShadowCache::destroy() {
+
+        if (this->staticFramebuffer != 0) {
+
+            GLStateCache::GetShared().deleteFramebuffers(1, &this->staticFramebuffer);
+            GLStateCache::GetShared().deleteTextures(1, &this->staticTexture);
+            this->staticFramebuffer = 0;
+            this->staticTexture = 0;
+        }
+    }
+
+    size_t ShadowCache::getRedrawCount() const {
+
+        return this->redraws;
+    }
+
+    size_t ShadowCache::getReuseCount() const {
+
+        return this->reuses;
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef ShadowCache_hpp
+#define ShadowCache_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace gps {
+
+    // Keeps a shadow map's static casters from being drawn again while nothing they depend on changes.
+    // Each frame the caller tracks every input of the static layer (light matrices, caster transforms,
+    // what the casters hold) in the same order; the layer is redrawn only when one of them differs from
+    // the frame it was last drawn with. Dynamic casters, if any, are drawn each frame over a copy of the
+    // static layer, kept in a depth texture of its own.
+    class ShadowCache {
+
+    public:
+        // Starts collecting the inputs of this frame
+        void beginFrame();
+
+        void track(const glm::mat4& value);
+        void track(size_t value);
+
+        // False if the static layer must be redrawn: caching is off, nothing was drawn yet,
+        // invalidate was called or a tracked input changed
+        bool isStaticLayerValid();
+
+        // Remembers the inputs of this frame as the ones the static layer now reflects
+        void staticLayerDrawn();
+
+        // Forces a redraw on the next frame, e.g. after the shadow map was resized
+        void invalidate();
+
+        void setEnabled(bool enabled);
+
+        bool isEnabled() const;
+
+        // Framebuffer of the separate static layer, created on first use with the shadow map's size and format
+        GLuint getStaticLayerFramebuffer(GLsizei width, GLsizei height);
+
+        // Copies the static layer's depth into a shadow map framebuffer of the same size, before dynamic casters are drawn
+        void copyStaticLayer(GLuint targetFramebuffer);
+
+        // Deletes the static layer, must run on the OpenGL thread
+        void destroy();
+
+        // Frames that redrew the static layer, and frames that reused it
+        size_t getRedrawCount() const;
+        size_t getReuseCount() const;
+
+    private:
+        bool enabled = true;
+        bool valid = false;
+        std::vector<double> inputs;
+        std::vector<double> drawnInputs;
+        GLuint staticFramebuffer = 0;
+        GLuint staticTexture = 0;
+        GLsizei width = 0;
+        GLsizei height = 0;
+        size_t redraws = 0;
+        size_t reuses = 0;
+    };
+}
+
+#endif /* ShadowCache_hpp */
@@ -0,0 +1,77 @@
+#include "ShadowCascades.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    void ComputeCascadeSplits(float nearPlane, float farPlane, int count, float lambda, float splits[]) {
+
+        for (int i = 1; i <= count; i++) {
+
+            float fraction = (float)i / count;
+            float logarithmic = nearPlane * powf(farPlane / nearPlane, fraction);
+            float uniform = nearPlane + (farPlane - nearPlane) * fraction;
+            splits[i - 1] = lambda * logarithmic + (1.0f - lambda) * uniform;
+        }
+        splits[count - 1] = farPlane;
+    }
+
+    void FitShadowCascades(const glm::mat4& view, const glm::mat4& projection, float shadowDistance, glm::vec3 lightDirection,
+                           int resolution, int count, float lambda, ShadowCascade cascades[]) {
+
+        // clip planes of a glm::perspective matrix
+        float nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+        float farPlane = projection[3][2] / (projection[2][2] + 1.0f);
+
+        float splits[SHADOW_MAX_CASCADES];
+        count = std::min(std::max(count, 1), SHADOW_MAX_CASCADES);
+        ComputeCascadeSplits(nearPlane, std::min(shadowDistance, farPlane), count, lambda, splits);
+
+        // half extents of the frustum at distance one along the view axis
+        float tanX = 1.0f / projection[0][0];
+        float tanY = 1.0f / projection[1][1];
+        glm::mat4 inverseView = glm::inverse(view);
+
+        lightDirection = glm::normalize(lightDirection);
+        glm::vec3 up = fabsf(lightDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        // rotation into light space, for the texel snapping
+        glm::mat4 lightRotation = glm::lookAt(glm::vec3(0.0f), -lightDirection, up);
+
+        float sliceNear = nearPlane;
+        for (int i = 0; i < count; i++) {
+
+            float sliceFar = splits[i];
+
+            // sphere around the slice's corners, centered on the view axis so it only depends on the distances
+            glm::vec3 center(0.0f, 0.0f, -(sliceNear + sliceFar) * 0.5f);
+            float radius = 0.0f;
+            for (int corner = 0; corner < 8; corner++) {
+
+                float distance = corner & 4 ? sliceFar : sliceNear;
+                glm::vec3 position((corner & 1 ? tanX : -tanX) * distance, (corner & 2 ? tanY : -tanY) * distance, -distance);
+                radius = std::max(radius, glm::length(position - center));
+            }
+            // rounding keeps the size fixed against floating point noise
+            radius = ceilf(radius * 16.0f) / 16.0f;
+            center = glm::vec3(inverseView * glm::vec4(center, 1.0f));
+
+            float texelSize = 2.0f * radius / resolution;
+            glm::vec3 lightCenter = glm::vec3(lightRotation * glm::vec4(center, 1.0f));
+            lightCenter.x = floorf(lightCenter.x / texelSize) * texelSize;
+            lightCenter.y = floorf(lightCenter.y / texelSize) * texelSize;
+            center = glm::vec3(glm::inverse(lightRotation) * glm::vec4(lightCenter, 1.0f));
+
+            ShadowCascade& cascade = cascades[i];
+            cascade.view = glm::lookAt(center + lightDirection * radius, center, up);
+            cascade.projection = glm::ortho(-radius, radius, -radius, radius, 0.0f, 2.0f * radius);
+            cascade.viewProjection = cascade.projection * cascade.view;
+            cascade.splitDistance = sliceFar;
+            cascade.texelSize = texelSize;
+
+            sliceNear = sliceFar;
+        }
+    }
+}
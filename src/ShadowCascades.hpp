@@ -0,0 +1,35 @@
+#ifndef ShadowCascades_hpp
+#define ShadowCascades_hpp
+
+#include <glm/glm.hpp>
+
+namespace gps {
+
+    // Layers of the cascade texture array, and the size of the arrays in basic.frag
+    static const int SHADOW_MAX_CASCADES = 4;
+
+    struct ShadowCascade {
+
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::mat4 viewProjection;
+        // far end of the cascade, as a distance along the camera's view axis
+        float splitDistance;
+        // world size of one shadow map texel
+        float texelSize;
+    };
+
+    // Far ends of count slices of [nearPlane, farPlane], blending logarithmic and uniform splits: lambda 1 gives
+    // every slice the same ratio of far to near distance, lambda 0 the same length
+    void ComputeCascadeSplits(float nearPlane, float farPlane, int count, float lambda, float splits[]);
+
+    // Fits an orthographic light box of resolution texels square around each slice of a perspective camera's frustum,
+    // from its near plane up to shadowDistance or its far plane, whichever is closer. The boxes enclose the slices'
+    // bounding spheres, so their size does not change as the camera turns, and move in whole texels, so shadow edges
+    // do not shimmer as it moves.
+    // lightDirection points towards the light; casters between it and a box are left to depth clamping.
+    void FitShadowCascades(const glm::mat4& view, const glm::mat4& projection, float shadowDistance, glm::vec3 lightDirection,
+                           int resolution, int count, float lambda, ShadowCascade cascades[]);
+}
+
+#endif /* ShadowCascades_hpp */
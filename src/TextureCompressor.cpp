@@ -0,0 +1,427 @@
+#include "TextureCompressor.hpp"
+
+#include "Model3D.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <unordered_set>
+
+namespace gps {
+
+    // Rows of 4x4 blocks (or pixel rows when downsampling) handed to one pool task
+    static const int ROWS_PER_TASK = 16;
+
+    static float SRGBToLinear[256];
+    static unsigned char LinearToSRGB[4096];
+
+    static void InitColorTables() {
+
+        static bool initialized = false;
+        if (initialized) {
+            return;
+        }
+
+        for (int i = 0; i < 256; i++) {
+
+            float c = i / 255.0f;
+            SRGBToLinear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+        }
+
+        for (int i = 0; i < 4096; i++) {
+
+            float c = i / 4095.0f;
+            float s = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+            LinearToSRGB[i] = (unsigned char)std::min(255.0f, s * 255.0f + 0.5f);
+        }
+
+        initialized = true;
+    }
+
+    // Runs task(begin, end) over [0, count) in ranges of grain on the shared pool and waits for all of them
+    template <typename Task>
+    static void ParallelFor(int count, int grain, Task task) {
+
+        std::vector<std::future<void> > pending;
+        for (int begin = 0; begin < count; begin += grain) {
+
+            int end = std::min(count, begin + grain);
+            pending.push_back(ThreadPool::GetShared().submit([task, begin, end]() { task(begin, end); }));
+        }
+
+        for (size_t i = 0; i < pending.size(); i++) {
+            pending[i].get();
+        }
+    }
+
+    // 2x2 box filter, colors averaged in linear space, clamped at odd edges
+    static std::vector<unsigned char> Downsample(const std::vector<unsigned char>& source, int width, int height, bool srgb) {
+
+        int nextWidth = std::max(1, width / 2);
+        int nextHeight = std::max(1, height / 2);
+        std::vector<unsigned char> result((size_t)nextWidth * nextHeight * 4);
+
+        ParallelFor(nextHeight, ROWS_PER_TASK, [&source, &result, width, height, nextWidth, srgb](int begin, int end) {
+
+            for (int y = begin; y < end; y++) {
+
+                int y0 = std::min(2 * y, height - 1);
+                int y1 = std::min(2 * y + 1, height - 1);
+
+                for (int x = 0; x < nextWidth; x++) {
+
+                    int x0 = std::min(2 * x, width - 1);
+                    int x1 = std::min(2 * x + 1, width - 1);
+                    const unsigned char* samples[4] = {
+                        &source[((size_t)y0 * width + x0) * 4], &source[((size_t)y0 * width + x1) * 4],
+                        &source[((size_t)y1 * width + x0) * 4], &source[((size_t)y1 * width + x1) * 4]
+                    };
+                    unsigned char* destination = &result[((size_t)y * nextWidth + x) * 4];
+
+                    for (int c = 0; c < 3; c++) {
+
+                        if (srgb) {
+                            float sum = SRGBToLinear[samples[0][c]] + SRGBToLinear[samples[1][c]] + SRGBToLinear[samples[2][c]] + SRGBToLinear[samples[3][c]];
+                            destination[c] = LinearToSRGB[(int)(sum * 0.25f * 4095.0f + 0.5f)];
+                        }
+                        else {
+                            destination[c] = (unsigned char)((samples[0][c] + samples[1][c] + samples[2][c] + samples[3][c] + 2) / 4);
+                        }
+                    }
+                    destination[3] = (unsigned char)((samples[0][3] + samples[1][3] + samples[2][3] + samples[3][3] + 2) / 4);
+                }
+            }
+        });
+
+        return result;
+    }
+
+    static uint16_t PackColor565(const float color[3]) {
+
+        int r = (int)(std::min(std::max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+        int g = (int)(std::min(std::max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+        int b = (int)(std::min(std::max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+        return (uint16_t)((r << 11) | (g << 5) | b);
+    }
+
+    static void UnpackColor565(uint16_t packed, float color[3]) {
+
+        int r = (packed >> 11) & 31;
+        int g = (packed >> 5) & 63;
+        int b = packed & 31;
+        color[0] = (float)((r << 3) | (r >> 2));
+        color[1] = (float)((g << 2) | (g >> 4));
+        color[2] = (float)((b << 3) | (b >> 2));
+    }
+
+    // Picks the nearest of the four palette colors per pixel, returns the squared error of the block
+    static float FitIndices(const float colors[16][3], uint16_t color0, uint16_t color1, uint32_t& indices) {
+
+        float palette[4][3];
+        UnpackColor565(color0, palette[0]);
+        UnpackColor565(color1, palette[1]);
+        for (int c = 0; c < 3; c++) {
+
+            palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+            palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+        }
+
+        // equal endpoints select the three color mode, where only index 0 is safe
+        int paletteSize = color0 == color1 ? 1 : 4;
+
+        float error = 0.0f;
+        indices = 0;
+        for (int i = 0; i < 16; i++) {
+
+            int best = 0;
+            float bestDistance = 1e30f;
+            for (int p = 0; p < paletteSize; p++) {
+
+                float dr = colors[i][0] - palette[p][0];
+                float dg = colors[i][1] - palette[p][1];
+                float db = colors[i][2] - palette[p][2];
+                float distance = dr * dr + dg * dg + db * db;
+                if (distance < bestDistance) {
+                    bestDistance = distance;
+                    best = p;
+                }
+            }
+
+            indices |= (uint32_t)best << (2 * i);
+            error += bestDistance;
+        }
+
+        return error;
+    }
+
+    // Quantizes the endpoints in four color order (color0 > color1) and fits the indices
+    static float FitEndpoints(const float colors[16][3], const float endpoint0[3], const float endpoint1[3], uint16_t& color0, uint16_t& color1, uint32_t& indices) {
+
+        color0 = PackColor565(endpoint0);
+        color1 = PackColor565(endpoint1);
+        if (color0 < color1) {
+            std::swap(color0, color1);
+        }
+        return FitIndices(colors, color0, color1, indices);
+    }
+
+    // Principal axis fit followed by least squares refinement of the endpoints
+    static void EncodeBC1Block(const unsigned char* pixels, size_t stride, int blockWidth, int blockHeight, unsigned char* output) {
+
+        // pixels outside a partial block repeat the last valid row/column
+        float colors[16][3];
+        float mean[3] = { 0.0f, 0.0f, 0.0f };
+        for (int y = 0; y < 4; y++) {
+            for (int x = 0; x < 4; x++) {
+
+                const unsigned char* pixel = pixels + std::min(y, blockHeight - 1) * stride + std::min(x, blockWidth - 1) * 4;
+                for (int c = 0; c < 3; c++) {
+                    colors[y * 4 + x][c] = pixel[c];
+                    mean[c] += pixel[c] / 16.0f;
+                }
+            }
+        }
+
+        float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; i++) {
+
+            float r = colors[i][0] - mean[0];
+            float g = colors[i][1] - mean[1];
+            float b = colors[i][2] - mean[2];
+            covariance[0] += r * r;
+            covariance[1] += r * g;
+            covariance[2] += r * b;
+            covariance[3] += g * g;
+            covariance[4] += g * b;
+            covariance[5] += b * b;
+        }
+
+        // power iteration towards the dominant eigenvector
+        float axis[3] = { 1.0f, 1.0f, 1.0f };
+        for (int iteration = 0; iteration < 8; iteration++) {
+
+            float next[3] = {
+                covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+                covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+                covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2]
+            };
+            float length = std::max(fabsf(next[0]), std::max(fabsf(next[1]), fabsf(next[2])));
+            if (length < 1e-6f) {
+                break;
+            }
+            for (int c = 0; c < 3; c++) {
+                axis[c] = next[c] / length;
+            }
+        }
+
+        float axisLengthSquared = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+        float minimum = 0.0f;
+        float maximum = 0.0f;
+        float projections[16];
+        for (int i = 0; i < 16; i++) {
+
+            projections[i] = ((colors[i][0] - mean[0]) * axis[0] + (colors[i][1] - mean[1]) * axis[1] + (colors[i][2] - mean[2]) * axis[2]) / axisLengthSquared;
+            minimum = std::min(minimum, projections[i]);
+            maximum = std::max(maximum, projections[i]);
+        }
+
+        float endpoint0[3];
+        float endpoint1[3];
+        for (int c = 0; c < 3; c++) {
+            endpoint0[c] = mean[c] + axis[c] * maximum;
+            endpoint1[c] = mean[c] + axis[c] * minimum;
+        }
+
+        uint16_t color0, color1;
+        uint32_t indices;
+        float error = FitEndpoints(colors, endpoint0, endpoint1, color0, color1, indices);
+
+        // each index weights color0 by 1, 0, 2/3 or 1/3, solve for the endpoints that fit the chosen weights best
+        static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+        for (int iteration = 0; iteration < 2 && error > 0.0f && color0 != color1; iteration++) {
+
+            float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+            float ax[3] = { 0.0f, 0.0f, 0.0f };
+            float bx[3] = { 0.0f, 0.0f, 0.0f };
+            for (int i = 0; i < 16; i++) {
+
+                float a = weights[(indices >> (2 * i)) & 3];
+                float b = 1.0f - a;
+                aa += a * a;
+                ab += a * b;
+                bb += b * b;
+                for (int c = 0; c < 3; c++) {
+                    ax[c] += a * colors[i][c];
+                    bx[c] += b * colors[i][c];
+                }
+            }
+
+            float determinant = aa * bb - ab * ab;
+            if (fabsf(determinant) < 1e-6f) {
+                break;
+            }
+
+            for (int c = 0; c < 3; c++) {
+                endpoint0[c] = (bb * ax[c] - ab * bx[c]) / determinant;
+                endpoint1[c] = (aa * bx[c] - ab * ax[c]) / determinant;
+            }
+
+            uint16_t refined0, refined1;
+            uint32_t refinedIndices;
+            float refinedError = FitEndpoints(colors, endpoint0, endpoint1, refined0, refined1, refinedIndices);
+            if (refinedError >= error) {
+                break;
+            }
+
+            color0 = refined0;
+            color1 = refined1;
+            indices = refinedIndices;
+            error = refinedError;
+        }
+
+        output[0] = (unsigned char)(color0 & 0xFF);
+        output[1] = (unsigned char)(color0 >> 8);
+        output[2] = (unsigned char)(color1 & 0xFF);
+        output[3] = (unsigned char)(color1 >> 8);
+        for (int i = 0; i < 4; i++) {
+            output[4 + i] = (unsigned char)(indices >> (8 * i));
+        }
+    }
+
+    CompressedImage CompressImage(const unsigned char* pixels, int width, int height, GLenum format) {
+
+        InitColorTables();
+
+        bool srgb = format == GL_COMPRESSED_SRGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT;
+
+        CompressedImage image;
+        image.format = format;
+        image.width = width;
+        image.height = height;
+
+        std::vector<unsigned char> level(pixels, pixels + (size_t)width * height * 4);
+        int levelWidth = width;
+        int levelHeight = height;
+
+        while (true) {
+
+            size_t levelSize = GetLevelSize(format, levelWidth, levelHeight);
+            image.levelOffsets.push_back(image.data.size());
+            image.levelSizes.push_back(levelSize);
+            image.data.resize(image.data.size() + levelSize);
+
+            unsigned char* output = image.data.data() + image.levelOffsets.back();
+            const unsigned char* source = level.data();
+            int blocksWide = (levelWidth + 3) / 4;
+            int blocksHigh = (levelHeight + 3) / 4;
+            size_t stride = (size_t)levelWidth * 4;
+
+            ParallelFor(blocksHigh, ROWS_PER_TASK, [output, source, blocksWide, levelWidth, levelHeight, stride](int begin, int end) {
+
+                for (int by = begin; by < end; by++) {
+                    for (int bx = 0; bx < blocksWide; bx++) {
+
+                        EncodeBC1Block(source + (size_t)by * 4 * stride + (size_t)bx * 16, stride,
+                                       std::min(4, levelWidth - bx * 4), std::min(4, levelHeight - by * 4),
+                                       output + ((size_t)by * blocksWide + bx) * 8);
+                    }
+                }
+            });
+
+            if (levelWidth == 1 && levelHeight == 1) {
+                break;
+            }
+
+            level = Downsample(level, levelWidth, levelHeight, srgb);
+            levelWidth = std::max(1, levelWidth / 2);
+            levelHeight = std::max(1, levelHeight / 2);
+        }
+
+        return image;
+    }
+
+    int CookTextures(std::string fileName) {
+
+        std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
+
+        // only the materials are needed
+        LoadOptions options;
+        options.optimizeMeshes = false;
+        options.generateLods = false;
+        options.buildMeshlets = false;
+        ModelData data;
+        Model3D::ReadOBJ(fileName, basePath, data, options);
+
+        std::vector<std::string> paths;
+        std::unordered_set<std::string> seen;
+        for (size_t i = 0; i < data.materials.size(); i++) {
+
+            const std::string names[] = { data.materials[i].ambientTexture, data.materials[i].diffuseTexture, data.materials[i].specularTexture };
+            for (size_t t = 0; t < 3; t++) {
+
+                if (!names[t].empty() && seen.insert(basePath + names[t]).second) {
+                    paths.push_back(basePath + names[t]);
+                }
+            }
+        }
+
+        // OpenGL's bottom-up row order, like Model3D uploads its images
+        stbi_set_flip_vertically_on_load_thread(1);
+
+        size_t uncompressedBytes = 0;
+        size_t compressedBytes = 0;
+        bool failed = false;
+
+        for (size_t i = 0; i < paths.size(); i++) {
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+            int width, height, channels;
+            unsigned char* pixels = stbi_load(paths[i].c_str(), &width, &height, &channels, 4);
+            if (!pixels) {
+
+                std::cerr << "ERROR: could not load " << paths[i] << std::endl;
+                failed = true;
+                continue;
+            }
+
+            // textures are uploaded as GL_SRGB, i.e. without alpha, so BC1 keeps exactly what is sampled today
+            CompressedImage image = CompressImage(pixels, width, height, GL_COMPRESSED_SRGB_S3TC_DXT1_EXT);
+            stbi_image_free(pixels);
+
+            std::string cookedFileName = GetCookedTextureName(paths[i]);
+            if (!WriteKTX2(cookedFileName, image)) {
+
+                std::cerr << "ERROR: could not write " << cookedFileName << std::endl;
+                failed = true;
+                continue;
+            }
+
+            // RGBA8 with a full mip chain is about 4/3 of the base level
+            size_t uncompressed = (size_t)width * height * 4 * 4 / 3;
+            uncompressedBytes += uncompressed;
+            compressedBytes += image.data.size();
+
+            double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::cout << cookedFileName << " : " << width << "x" << height << ", " << image.levelOffsets.size() << " levels, "
+                      << uncompressed / 1024 << " KB -> " << image.data.size() / 1024 << " KB in " << elapsedMs << " ms" << std::endl;
+        }
+
+        stbi_set_flip_vertically_on_load_thread(0);
+
+        if (compressedBytes > 0) {
+
+            std::cout << "Cooked " << paths.size() << " textures on " << ThreadPool::GetShared().getThreadCount() << " threads: "
+                      << uncompressedBytes / (1024 * 1024) << " MB -> " << compressedBytes / (1024 * 1024) << " MB of texture memory ("
+                      << (double)uncompressedBytes / compressedBytes << "x smaller)" << std::endl;
+        }
+
+        return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+}
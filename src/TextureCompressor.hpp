@@ -0,0 +1,20 @@
+#ifndef TextureCompressor_hpp
+#define TextureCompressor_hpp
+
+#include "TextureFile.hpp"
+
+#include <string>
+
+namespace gps {
+
+    // Builds the full mip chain of an RGBA8 image (filtered in linear space) and encodes every level
+    // as BC1 on the shared thread pool. The format picks the color space, e.g. GL_COMPRESSED_SRGB_S3TC_DXT1_EXT.
+    // Waits for the pool, so it must not be called from a pool task.
+    CompressedImage CompressImage(const unsigned char* pixels, int width, int height, GLenum format);
+
+    // --cook-textures <file.obj> : encodes every texture referenced by the model's materials next to
+    // its source image (see GetCookedTextureName), where Model3D picks it up instead of the image
+    int CookTextures(std::string fileName);
+}
+
+#endif /* TextureCompressor_hpp */
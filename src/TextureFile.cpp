@@ -0,0 +1,555 @@
+#include "TextureFile.hpp"
+#include "MappedFile.hpp"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace gps {
+
+    static const uint32_t DDS_MAGIC = 0x20534444; // "DDS "
+    static const uint32_t DDS_PIXEL_FORMAT_FOURCC = 0x4;
+    static const uint32_t DDS_DIMENSION_TEXTURE2D = 3;
+
+    static const uint32_t KHR_DF_MODEL_BC1A = 128;
+    static const uint32_t KHR_DF_MODEL_BC2 = 129;
+    static const uint32_t KHR_DF_MODEL_BC3 = 130;
+    static const uint32_t KHR_DF_MODEL_BC7 = 134;
+
+    static const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+    struct DDSPixelFormat {
+
+        uint32_t size;
+        uint32_t flags;
+        uint32_t fourCC;
+        uint32_t rgbBitCount;
+        uint32_t bitMasks[4];
+    };
+
+    struct DDSHeader {
+
+        uint32_t size;
+        uint32_t flags;
+        uint32_t height;
+        uint32_t width;
+        uint32_t pitchOrLinearSize;
+        uint32_t depth;
+        uint32_t mipMapCount;
+        uint32_t reserved1[11];
+        DDSPixelFormat pixelFormat;
+        uint32_t caps[4];
+        uint32_t reserved2;
+    };
+
+    struct DDSHeaderDX10 {
+
+        uint32_t dxgiFormat;
+        uint32_t resourceDimension;
+        uint32_t miscFlag;
+        uint32_t arraySize;
+        uint32_t miscFlags2;
+    };
+
+    struct KTX2Header {
+
+        unsigned char identifier[12];
+        uint32_t vkFormat;
+        uint32_t typeSize;
+        uint32_t pixelWidth;
+        uint32_t pixelHeight;
+        uint32_t pixelDepth;
+        uint32_t layerCount;
+        uint32_t faceCount;
+        uint32_t levelCount;
+        uint32_t supercompressionScheme;
+        uint32_t dfdByteOffset;
+        uint32_t dfdByteLength;
+        uint32_t kvdByteOffset;
+        uint32_t kvdByteLength;
+        uint64_t sgdByteOffset;
+        uint64_t sgdByteLength;
+    };
+
+    struct KTX2Level {
+
+        uint64_t byteOffset;
+        uint64_t byteLength;
+        uint64_t uncompressedByteLength;
+    };
+
+    static uint32_t MakeFourCC(char a, char b, char c, char d) {
+        return (uint32_t)(unsigned char)a | ((uint32_t)(unsigned char)b << 8) | ((uint32_t)(unsigned char)c << 16) | ((uint32_t)(unsigned char)d << 24);
+    }
+
+    static GLenum GetFormatFromDXGI(uint32_t dxgiFormat) {
+
+        switch (dxgiFormat) {
+        case 71: return GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;         // BC1_UNORM
+        case 72: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT;   // BC1_UNORM_SRGB
+        case 74: return GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;         // BC2_UNORM
+        case 75: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT;   // BC2_UNORM_SRGB
+        case 77: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;         // BC3_UNORM
+        case 78: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;   // BC3_UNORM_SRGB
+        case 98: return GL_COMPRESSED_RGBA_BPTC_UNORM;            // BC7_UNORM
+        case 99: return GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;      // BC7_UNORM_SRGB
+        default: return 0;
+        }
+    }
+
+    static GLenum GetFormatFromVulkan(uint32_t vkFormat) {
+
+        switch (vkFormat) {
+        case 131: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;          // BC1_RGB_UNORM
+        case 132: return GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;         // BC1_RGB_SRGB
+        case 133: return GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;         // BC1_RGBA_UNORM
+        case 134: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT;   // BC1_RGBA_SRGB
+        case 135: return GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;         // BC2_UNORM
+        case 136: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT;   // BC2_SRGB
+        case 137: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;         // BC3_UNORM
+        case 138: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;   // BC3_SRGB
+        case 145: return GL_COMPRESSED_RGBA_BPTC_UNORM;            // BC7_UNORM
+        case 146: return GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;      // BC7_SRGB
+        default: return 0;
+        }
+    }
+
+    static uint32_t GetVulkanFromFormat(GLenum format) {
+
+        for (uint32_t vkFormat = 131; vkFormat <= 146; vkFormat++) {
+
+            if (GetFormatFromVulkan(vkFormat) == format) {
+                return vkFormat;
+            }
+        }
+        return 0;
+    }
+
+    static bool IsSRGB(GLenum format) {
+
+        return format == GL_COMPRESSED_SRGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT ||
+               format == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT || format == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT ||
+               format == GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+    }
+
+    size_t GetBlockSize(GLenum format) {
+
+        switch (format) {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+            return 8;
+        case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+        case GL_COMPRESSED_RGBA_BPTC_UNORM:
+        case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+            return 16;
+        default:
+            return 0;
+        }
+    }
+
+    size_t GetLevelSize(GLenum format, int width, int height) {
+
+        return (size_t)((width + 3) / 4) * (size_t)((height + 3) / 4) * GetBlockSize(format);
+    }
+
+    static bool IsBPTC(GLenum format) {
+        return format == GL_COMPRESSED_RGBA_BPTC_UNORM || format == GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+    }
+
+    bool IsCompressedFormatSupported(GLenum format) {
+
+        bool bptc = IsBPTC(format);
+        bool srgb = IsSRGB(format) && !bptc;
+
+        if (GetBlockSize(format) == 0) {
+            return false;
+        }
+
+#if defined (__APPLE__)
+        // every Mac OpenGL 4.1 driver exposes S3TC including its sRGB variants, none exposes BPTC
+        return !bptc;
+#else
+        if (bptc) {
+            return GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc;
+        }
+        return GLEW_EXT_texture_compression_s3tc && (!srgb || GLEW_EXT_texture_sRGB);
+#endif
+    }
+
+    // Exchanges two pixel rows inside one 4x4 block
+    static void SwapBlockRows(GLenum format, unsigned char* block, int rowA, int rowB) {
+
+        size_t blockSize = GetBlockSize(format);
+        unsigned char* color = block + blockSize - 8;
+
+        if (format == GL_COMPRESSED_RGBA_S3TC_DXT3_EXT || format == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT) {
+
+            // explicit 4 bit alpha, two bytes per row
+            std::swap(block[2 * rowA], block[2 * rowB]);
+            std::swap(block[2 * rowA + 1], block[2 * rowB + 1]);
+        }
+        else if (format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT || format == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT) {
+
+            // 3 bit alpha indices, 12 bits per row
+            uint64_t indices = 0;
+            for (int i = 0; i < 6; i++) {
+                indices |= (uint64_t)block[2 + i] << (8 * i);
+            }
+
+            uint64_t bitsA = (indices >> (12 * rowA)) & 0xFFF;
+            uint64_t bitsB = (indices >> (12 * rowB)) & 0xFFF;
+            indices &= ~((0xFFFULL << (12 * rowA)) | (0xFFFULL << (12 * rowB)));
+            indices |= (bitsA << (12 * rowB)) | (bitsB << (12 * rowA));
+
+            for (int i = 0; i < 6; i++) {
+                block[2 + i] = (unsigned char)(indices >> (8 * i));
+            }
+        }
+
+        // 2 bit color indices, one byte per row
+        std::swap(color[4 + rowA], color[4 + rowB]);
+    }
+
+    // Flips every level between top-down and bottom-up row order, BC7 blocks cannot be flipped without re-encoding
+    static bool FlipImage(CompressedImage& image) {
+
+        size_t blockSize = GetBlockSize(image.format);
+        if (blockSize == 0 || IsBPTC(image.format)) {
+            return false;
+        }
+
+        std::vector<unsigned char> row;
+        for (size_t level = 0; level < image.levelOffsets.size(); level++) {
+
+            int width = std::max(1, image.width >> level);
+            int height = std::max(1, image.height >> level);
+            size_t blocksWide = (size_t)(width + 3) / 4;
+            size_t blocksHigh = (size_t)(height + 3) / 4;
+            size_t rowBytes = blocksWide * blockSize;
+            unsigned char* data = image.data.data() + image.levelOffsets[level];
+
+            if (height <= 2) {
+
+                // only the first rows of each block hold pixels
+                for (size_t b = 0; height == 2 && b < blocksWide; b++) {
+                    SwapBlockRows(image.format, data + b * blockSize, 0, 1);
+                }
+                continue;
+            }
+
+            // a partial last block row would end up at the wrong place
+            if (height % 4 != 0) {
+                return false;
+            }
+
+            row.resize(rowBytes);
+            for (size_t top = 0; top < blocksHigh; top++) {
+
+                unsigned char* topRow = data + top * rowBytes;
+                for (size_t b = 0; b < blocksWide; b++) {
+
+                    SwapBlockRows(image.format, topRow + b * blockSize, 0, 3);
+                    SwapBlockRows(image.format, topRow + b * blockSize, 1, 2);
+                }
+            }
+
+            for (size_t top = 0; top < blocksHigh / 2; top++) {
+
+                unsigned char* topRow = data + top * rowBytes;
+                unsigned char* bottomRow = data + (blocksHigh - 1 - top) * rowBytes;
+                memcpy(row.data(), topRow, rowBytes);
+                memcpy(topRow, bottomRow, rowBytes);
+                memcpy(bottomRow, row.data(), rowBytes);
+            }
+        }
+
+        return true;
+    }
+
+    // Copies the level blobs out of the mapped file after validating their sizes
+    static bool CopyLevels(const MappedFile& file, const std::vector<size_t>& offsets, CompressedImage& image) {
+
+        image.data.clear();
+        image.levelOffsets.clear();
+        image.levelSizes.clear();
+
+        for (size_t level = 0; level < offsets.size(); level++) {
+
+            int width = std::max(1, image.width >> level);
+            int height = std::max(1, image.height >> level);
+            size_t size = GetLevelSize(image.format, width, height);
+
+            if (offsets[level] > file.getSize() || size > file.getSize() - offsets[level]) {
+                return false;
+            }
+
+            image.levelOffsets.push_back(image.data.size());
+            image.levelSizes.push_back(size);
+            image.data.insert(image.data.end(), file.getData() + offsets[level], file.getData() + offsets[level] + size);
+        }
+
+        return !offsets.empty();
+    }
+
+    static bool ReadDDS(const MappedFile& file, CompressedImage& image) {
+
+        uint32_t magic;
+        DDSHeader header;
+        if (file.getSize() < sizeof(magic) + sizeof(header)) {
+            return false;
+        }
+        memcpy(&magic, file.getData(), sizeof(magic));
+        memcpy(&header, file.getData() + sizeof(magic), sizeof(header));
+
+        if (magic != DDS_MAGIC || header.size != sizeof(DDSHeader) || !(header.pixelFormat.flags & DDS_PIXEL_FORMAT_FOURCC)) {
+            return false;
+        }
+
+        size_t offset = sizeof(magic) + sizeof(header);
+        uint32_t fourCC = header.pixelFormat.fourCC;
+
+        // legacy files carry no color space, material textures are treated as sRGB like the uncompressed path
+        if (fourCC == MakeFourCC('D', 'X', 'T', '1')) {
+            image.format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT;
+        }
+        else if (fourCC == MakeFourCC('D', 'X', 'T', '3')) {
+            image.format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT;
+        }
+        else if (fourCC == MakeFourCC('D', 'X', 'T', '5')) {
+            image.format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+        }
+        else if (fourCC == MakeFourCC('D', 'X', '1', '0')) {
+
+            DDSHeaderDX10 extension;
+            if (file.getSize() < offset + sizeof(extension)) {
+                return false;
+            }
+            memcpy(&extension, file.getData() + offset, sizeof(extension));
+            offset += sizeof(extension);
+
+            if (extension.resourceDimension != DDS_DIMENSION_TEXTURE2D || extension.arraySize > 1) {
+                return false;
+            }
+            image.format = GetFormatFromDXGI(extension.dxgiFormat);
+        }
+        else {
+            return false;
+        }
+
+        image.width = (int)header.width;
+        image.height = (int)header.height;
+        if (image.format == 0 || image.width <= 0 || image.height <= 0) {
+            return false;
+        }
+
+        std::vector<size_t> offsets;
+        uint32_t levelCount = std::max(1u, header.mipMapCount);
+        for (uint32_t level = 0; level < levelCount && level < 32; level++) {
+
+            offsets.push_back(offset);
+            offset += GetLevelSize(image.format, std::max(1, image.width >> level), std::max(1, image.height >> level));
+        }
+
+        // DDS stores rows top-down
+        return CopyLevels(file, offsets, image) && FlipImage(image);
+    }
+
+    static bool ReadKTX2(const MappedFile& file, CompressedImage& image) {
+
+        KTX2Header header;
+        if (file.getSize() < sizeof(header)) {
+            return false;
+        }
+        memcpy(&header, file.getData(), sizeof(header));
+
+        if (memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0 ||
+            header.supercompressionScheme != 0 || header.pixelDepth > 1 || header.layerCount > 1 || header.faceCount != 1) {
+            return false;
+        }
+
+        image.format = GetFormatFromVulkan(header.vkFormat);
+        image.width = (int)header.pixelWidth;
+        image.height = (int)header.pixelHeight;
+        if (image.format == 0 || image.width <= 0 || image.height <= 0) {
+            return false;
+        }
+
+        uint32_t levelCount = std::max(1u, header.levelCount);
+        if (levelCount > 32 || file.getSize() < sizeof(header) + levelCount * sizeof(KTX2Level)) {
+            return false;
+        }
+
+        std::vector<size_t> offsets;
+        for (uint32_t level = 0; level < levelCount; level++) {
+
+            KTX2Level entry;
+            memcpy(&entry, file.getData() + sizeof(header) + level * sizeof(KTX2Level), sizeof(entry));
+            offsets.push_back((size_t)entry.byteOffset);
+        }
+
+        if (!CopyLevels(file, offsets, image)) {
+            return false;
+        }
+
+        // rows are top-down unless the KTXorientation key says "ru"
+        bool bottomUp = false;
+        size_t kvdOffset = header.kvdByteOffset;
+        size_t kvdEnd = kvdOffset + header.kvdByteLength;
+        if (kvdEnd > file.getSize() || kvdEnd < kvdOffset) {
+            return false;
+        }
+
+        while (kvdOffset + 4 <= kvdEnd) {
+
+            uint32_t length;
+            memcpy(&length, file.getData() + kvdOffset, sizeof(length));
+            kvdOffset += 4;
+            if (length > kvdEnd - kvdOffset) {
+                break;
+            }
+
+            const char* entry = (const char*)file.getData() + kvdOffset;
+            const char key[] = "KTXorientation";
+            if (length > sizeof(key) + 1 && memcmp(entry, key, sizeof(key)) == 0) {
+                bottomUp = entry[sizeof(key) + 1] == 'u';
+            }
+
+            kvdOffset += (length + 3) & ~(size_t)3;
+        }
+
+        return bottomUp || FlipImage(image);
+    }
+
+    bool ReadCompressedTexture(std::string fileName, CompressedImage& image) {
+
+        MappedFile file;
+        if (!file.open(fileName)) {
+            return false;
+        }
+
+        bool read = ReadDDS(file, image) || ReadKTX2(file, image);
+        if (!read) {
+            fprintf(stderr, "WARNING: unsupported or top-down BC7 compressed texture %s\n", fileName.c_str());
+        }
+        return read;
+    }
+
+    bool WriteKTX2(std::string fileName, const CompressedImage& image) {
+
+        uint32_t vkFormat = GetVulkanFromFormat(image.format);
+        if (vkFormat == 0 || image.levelOffsets.empty()) {
+            return false;
+        }
+
+        uint32_t levelCount = (uint32_t)image.levelOffsets.size();
+        uint32_t blockSize = (uint32_t)GetBlockSize(image.format);
+        bool srgb = IsSRGB(image.format);
+
+        // data format descriptor: one basic block with a single sample covering the whole block
+        uint32_t colorModel = KHR_DF_MODEL_BC1A;
+        uint32_t channel = image.format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || image.format == GL_COMPRESSED_SRGB_S3TC_DXT1_EXT ? 0 : 15;
+        if (blockSize == 16) {
+            colorModel = IsBPTC(image.format) ? KHR_DF_MODEL_BC7 : (image.format == GL_COMPRESSED_RGBA_S3TC_DXT3_EXT || image.format == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT ? KHR_DF_MODEL_BC2 : KHR_DF_MODEL_BC3);
+            channel = 0;
+        }
+
+        uint32_t dfd[11];
+        memset(dfd, 0, sizeof(dfd));
+        dfd[0] = sizeof(dfd);
+        dfd[2] = 2 | ((uint32_t)(sizeof(dfd) - 4) << 16);                         // version 2, block size
+        dfd[3] = colorModel | (1u << 8) | ((srgb ? 2u : 1u) << 16);                 // model, BT.709 primaries, transfer
+        dfd[4] = 3 | (3 << 8);                                                      // 4x4 texel blocks
+        dfd[5] = blockSize;                                                         // bytesPlane0
+        dfd[7] = ((blockSize * 8 - 1) << 16) | (channel << 24);                     // bit length - 1, channel
+        dfd[10] = 0xFFFFFFFF;                                                       // sample upper
+
+        // the data is already bottom-up, which is what the orientation "ru" declares
+        const char orientation[] = "KTXorientation\0ru";
+        uint32_t kvdLength = sizeof(orientation);
+        std::vector<unsigned char> kvd(4 + ((kvdLength + 3) & ~3u), 0);
+        memcpy(kvd.data(), &kvdLength, sizeof(kvdLength));
+        memcpy(kvd.data() + 4, orientation, sizeof(orientation));
+
+        KTX2Header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+        header.vkFormat = vkFormat;
+        header.typeSize = 1;
+        header.pixelWidth = (uint32_t)image.width;
+        header.pixelHeight = (uint32_t)image.height;
+        header.faceCount = 1;
+        header.levelCount = levelCount;
+        header.dfdByteOffset = (uint32_t)(sizeof(header) + levelCount * sizeof(KTX2Level));
+        header.dfdByteLength = sizeof(dfd);
+        header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+        header.kvdByteLength = (uint32_t)kvd.size();
+
+        // levels are stored smallest first, each aligned to the block size
+        std::vector<KTX2Level> levels(levelCount);
+        size_t offset = header.kvdByteOffset + header.kvdByteLength;
+        for (uint32_t i = levelCount; i-- > 0;) {
+
+            offset = (offset + blockSize - 1) / blockSize * blockSize;
+            levels[i].byteOffset = offset;
+            levels[i].byteLength = image.levelSizes[i];
+            levels[i].uncompressedByteLength = image.levelSizes[i];
+            offset += image.levelSizes[i];
+        }
+
+        std::vector<unsigned char> buffer(offset, 0);
+        memcpy(buffer.data(), &header, sizeof(header));
+        memcpy(buffer.data() + sizeof(header), levels.data(), levels.size() * sizeof(KTX2Level));
+        memcpy(buffer.data() + header.dfdByteOffset, dfd, sizeof(dfd));
+        memcpy(buffer.data() + header.kvdByteOffset, kvd.data(), kvd.size());
+        for (uint32_t i = 0; i < levelCount; i++) {
+            memcpy(buffer.data() + levels[i].byteOffset, image.data.data() + image.levelOffsets[i], image.levelSizes[i]);
+        }
+
+        // write to a temporary file first so an interrupted write never leaves a damaged texture
+        std::string temporaryFileName = fileName + ".tmp";
+        FILE* file = fopen(temporaryFileName.c_str(), "wb");
+        if (!file) {
+            return false;
+        }
+
+        bool written = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+        written = (fclose(file) == 0) && written;
+
+        if (!written) {
+            remove(temporaryFileName.c_str());
+            return false;
+        }
+
+        remove(fileName.c_str());
+        return rename(temporaryFileName.c_str(), fileName.c_str()) == 0;
+    }
+
+    std::string GetCookedTextureName(std::string fileName) {
+
+        // the source extension stays, so images that only differ in it do not share a cooked file
+        return fileName + ".ktx2";
+    }
+
+    bool ReadCookedTexture(std::string fileName, CompressedImage& image) {
+
+        std::string cookedFileName = GetCookedTextureName(fileName);
+
+        // an edited source image wins over its stale cooked version
+        struct stat source;
+        struct stat cooked;
+        if (stat(cookedFileName.c_str(), &cooked) != 0 ||
+            (stat(fileName.c_str(), &source) == 0 && source.st_mtime > cooked.st_mtime)) {
+            return false;
+        }
+
+        return ReadCompressedTexture(cookedFileName, image) && IsCompressedFormatSupported(image.format);
+    }
+}
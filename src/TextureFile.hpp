@@ -0,0 +1,69 @@
+#ifndef TextureFile_hpp
+#define TextureFile_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <string>
+#include <vector>
+
+// S3TC and BPTC formats are extensions on OpenGL 4.1
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT 0x83F2
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT 0x8C4E
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM 0x8E8D
+#endif
+
+namespace gps {
+
+    // Block-compressed (BC1/BC2/BC3/BC7) image with its stored mip chain, in OpenGL's bottom-up row order
+    struct CompressedImage {
+
+        GLenum format;
+        int width;
+        int height;
+        // all levels back to back, level 0 first
+        std::vector<unsigned char> data;
+        std::vector<size_t> levelOffsets;
+        std::vector<size_t> levelSizes;
+    };
+
+    // Bytes per 4x4 block of a compressed format, 0 if the format is not supported
+    size_t GetBlockSize(GLenum format);
+
+    // Byte size of one mip level
+    size_t GetLevelSize(GLenum format, int width, int height);
+
+    // True if the current context can sample the format, needs glewInit to have run
+    bool IsCompressedFormatSupported(GLenum format);
+
+    // Reads a .dds (legacy DXT1/DXT3/DXT5 or DX10 BC1/BC2/BC3/BC7) or .ktx2 (uncompressed supercompression) file
+    bool ReadCompressedTexture(std::string fileName, CompressedImage& image);
+
+    // Writes the image as a .ktx2 file, keeping the bottom-up rows and declaring them with KTXorientation "ru"
+    bool WriteKTX2(std::string fileName, const CompressedImage& image);
+
+    // Name of the cooked container that replaces an image file, e.g. "grass.jpg" -> "grass.jpg.ktx2"
+    std::string GetCookedTextureName(std::string fileName);
+
+    // Loads the cooked container of an image if it exists, is not older than the image and its format is supported
+    bool ReadCookedTexture(std::string fileName, CompressedImage& image);
+}
+
+#endif /* TextureFile_hpp */
@@ -0,0 +1,118 @@
+#include "TextureManager.hpp"
+#include "GLStateCache.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    TextureManager& TextureManager::GetShared() {
+
+        static TextureManager* sharedManager = new TextureManager();
+        return *sharedManager;
+    }
+
+    std::string TextureManager::GetCanonicalPath(std::string path) {
+
+        for (size_t i = 0; i < path.size(); i++) {
+
+            if (path[i] == '\\') {
+                path[i] = '/';
+            }
+        }
+
+        bool absolute = !path.empty() && path[0] == '/';
+        std::vector<std::string> segments;
+        size_t start = 0;
+
+        while (start <= path.size()) {
+
+            size_t end = path.find('/', start);
+            if (end == std::string::npos) {
+                end = path.size();
+            }
+
+            std::string segment = path.substr(start, end - start);
+            if (segment == "..") {
+
+                // leading ".." of a relative path cannot be resolved lexically
+                if (!segments.empty() && segments.back() != "..") {
+                    segments.pop_back();
+                }
+                else if (!absolute) {
+                    segments.push_back(segment);
+                }
+            }
+            else if (!segment.empty() && segment != ".") {
+                segments.push_back(segment);
+            }
+
+            start = end + 1;
+        }
+
+        std::string canonical = absolute ? "/" : "";
+        for (size_t i = 0; i < segments.size(); i++) {
+
+            canonical += segments[i];
+            if (i + 1 < segments.size()) {
+                canonical += '/';
+            }
+        }
+
+        return canonical;
+    }
+
+    bool TextureManager::acquire(const std::string& path, GLuint& textureId) {
+
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        std::unordered_map<std::string, Entry>::iterator found = this->textures.find(path);
+        if (found == this->textures.end()) {
+            return false;
+        }
+
+        found->second.references++;
+        textureId = found->second.textureId;
+        return true;
+    }
+
+    GLuint TextureManager::add(const std::string& path, GLuint textureId) {
+
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        std::unordered_map<std::string, Entry>::iterator found = this->textures.find(path);
+        if (found != this->textures.end()) {
+
+            if (textureId != found->second.textureId) {
+                GLStateCache::GetShared().deleteTextures(1, &textureId);
+            }
+            found->second.references++;
+            return found->second.textureId;
+        }
+
+        Entry entry = { textureId, 1 };
+        this->textures[path] = entry;
+        return textureId;
+    }
+
+    void TextureManager::release(const std::string& path) {
+
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        std::unordered_map<std::string, Entry>::iterator found = this->textures.find(path);
+        if (found == this->textures.end()) {
+            return;
+        }
+
+        if (--found->second.references == 0) {
+
+            GLStateCache::GetShared().deleteTextures(1, &found->second.textureId);
+            this->textures.erase(found);
+        }
+    }
+
+    size_t TextureManager::getTextureCount() const {
+
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->textures.size();
+    }
+}
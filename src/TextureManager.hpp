@@ -0,0 +1,60 @@
+#ifndef TextureManager_hpp
+#define TextureManager_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace gps {
+
+    // Process-wide cache of texture objects keyed by canonical path, so models sharing
+    // an image decode and upload it once. Every holder owns one reference per path and
+    // the texture is deleted when the last reference is released.
+    // Lookups are thread-safe, adding and releasing create or delete textures and
+    // must run on the OpenGL thread.
+    class TextureManager {
+
+    public:
+        // Never destroyed, so models in static storage can release their textures at exit
+        static TextureManager& GetShared();
+
+        // Lexically normalized path: '/' separators, no "." or "dir/.." segments, no repeated '/'
+        static std::string GetCanonicalPath(std::string path);
+
+        // Adds a reference to an already uploaded texture, returns false if it is not loaded
+        bool acquire(const std::string& path, GLuint& textureId);
+
+        // Registers a freshly uploaded texture with one reference. If another model uploaded the
+        // same path in the meantime, the new texture is deleted and the existing one returned.
+        GLuint add(const std::string& path, GLuint textureId);
+
+        // Drops one reference, deleting the texture with the last one
+        void release(const std::string& path);
+
+        size_t getTextureCount() const;
+
+    private:
+        struct Entry {
+
+            GLuint textureId;
+            size_t references;
+        };
+
+        std::unordered_map<std::string, Entry> textures;
+        mutable std::mutex mutex;
+
+        TextureManager() {}
+        TextureManager(const TextureManager&) = delete;
+        TextureManager& operator=(const TextureManager&) = delete;
+    };
+}
+
+#endif /* TextureManager_hpp */
@@ -0,0 +1,60 @@
+#include "ThreadPool.hpp"
+
+namespace gps {
+
+    ThreadPool::ThreadPool(size_t threadCount) : stopping(false) {
+
+        if (threadCount == 0) {
+            threadCount = 1;
+        }
+
+        for (size_t i = 0; i < threadCount; i++) {
+            this->workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->condition.notify_all();
+
+        for (size_t i = 0; i < this->workers.size(); i++) {
+            this->workers[i].join();
+        }
+    }
+
+    ThreadPool& ThreadPool::GetShared() {
+
+        static ThreadPool sharedPool(std::thread::hardware_concurrency());
+        return sharedPool;
+    }
+
+    size_t ThreadPool::getThreadCount() const {
+        return this->workers.size();
+    }
+
+    void ThreadPool::workerLoop() {
+
+        while (true) {
+
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->condition.wait(lock, [this]() { return this->stopping || !this->tasks.empty(); });
+
+                // finish the queued work before shutting down
+                if (this->tasks.empty()) {
+                    return;
+                }
+
+                task = std::move(this->tasks.front());
+                this->tasks.pop();
+            }
+
+            task();
+        }
+    }
+}
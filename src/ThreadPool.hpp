@@ -0,0 +1,56 @@
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+    // Fixed set of worker threads consuming a FIFO task queue
+    class ThreadPool {
+
+    public:
+        explicit ThreadPool(size_t threadCount);
+        ~ThreadPool();
+
+        // Process-wide pool with one worker per hardware thread
+        static ThreadPool& GetShared();
+
+        size_t getThreadCount() const;
+
+        // Queues a task, the returned future holds its result (or exception)
+        template <typename Task>
+        auto submit(Task task) -> std::future<decltype(task())> {
+
+            typedef decltype(task()) Result;
+            std::shared_ptr<std::packaged_task<Result()> > packaged = std::make_shared<std::packaged_task<Result()> >(task);
+            std::future<Result> result = packaged->get_future();
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->tasks.push([packaged]() { (*packaged)(); });
+            }
+            this->condition.notify_one();
+            return result;
+        }
+
+    private:
+        std::vector<std::thread> workers;
+        std::queue<std::function<void()> > tasks;
+        std::mutex mutex;
+        std::condition_variable condition;
+        bool stopping;
+
+        void workerLoop();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+    };
+}
+
+#endif /* ThreadPool_hpp */
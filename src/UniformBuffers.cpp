@@ -0,0 +1,69 @@
+#include "UniformBuffers.hpp"
+
+#include <cstring>
+
+namespace gps {
+
+    static GLintptr AlignOffset(GLintptr offset, GLint alignment) {
+
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    void FrameUniforms::create() {
+
+        // ranges bound with glBindBufferRange must start at a multiple of the driver's alignment
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        if (alignment <= 0) {
+            alignment = 256;
+        }
+        this->lightOffset = AlignOffset(sizeof(FrameData), alignment);
+        this->shadowOffset = AlignOffset(this->lightOffset + sizeof(LightData), alignment);
+        this->staging.assign(this->shadowOffset + sizeof(ShadowData), 0);
+
+        glGenBuffers(1, &this->buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, this->buffer);
+        glBufferData(GL_UNIFORM_BUFFER, this->staging.size(), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, this->buffer, 0, sizeof(FrameData));
+        glBindBufferRange(GL_UNIFORM_BUFFER, LIGHT_DATA_BINDING, this->buffer, this->lightOffset, sizeof(LightData));
+        glBindBufferRange(GL_UNIFORM_BUFFER, SHADOW_DATA_BINDING, this->buffer, this->shadowOffset, sizeof(ShadowData));
+    }
+
+    void FrameUniforms::upload() {
+
+        memcpy(&this->staging[0], &this->frame, sizeof(FrameData));
+        memcpy(&this->staging[this->lightOffset], &this->light, sizeof(LightData));
+        memcpy(&this->staging[this->shadowOffset], &this->shadow, sizeof(ShadowData));
+
+        // replacing the whole store lets the driver hand out fresh memory instead of waiting for last frame's draws
+        glBindBuffer(GL_UNIFORM_BUFFER, this->buffer);
+        glBufferData(GL_UNIFORM_BUFFER, this->staging.size(), this->staging.data(), GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void FrameUniforms::destroy() {
+
+        if (this->buffer != 0) {
+
+            glDeleteBuffers(1, &this->buffer);
+            this->buffer = 0;
+        }
+    }
+
+    static void BindUniformBlock(const Shader& shader, const char* name, GLuint binding) {
+
+        GLuint index = shader.getUniformBlockIndex(name);
+        if (index != GL_INVALID_INDEX) {
+            glUniformBlockBinding(shader.shaderProgram, index, binding);
+        }
+    }
+
+    void BindUniformBlocks(const Shader& shader) {
+
+        BindUniformBlock(shader, "FrameData", FRAME_DATA_BINDING);
+        BindUniformBlock(shader, "LightData", LIGHT_DATA_BINDING);
+        BindUniformBlock(shader, "ShadowData", SHADOW_DATA_BINDING);
+    }
+}
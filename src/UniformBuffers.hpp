@@ -0,0 +1,87 @@
+#ifndef UniformBuffers_hpp
+#define UniformBuffers_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Shader.hpp"
+#include "ShadowCascades.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // Binding points of the std140 blocks shared by every program
+    static const GLuint FRAME_DATA_BINDING = 0;
+    static const GLuint LIGHT_DATA_BINDING = 1;
+    static const GLuint SHADOW_DATA_BINDING = 2;
+
+    // The structs below mirror the blocks of the same name in the shaders, member for member. A vec3 takes
+    // 16 bytes in std140 unless a scalar follows it, so each one is followed by an int or an explicit pad.
+
+    struct FrameData {
+
+        glm::mat4 view;
+        glm::mat4 projection;
+    };
+
+    struct LightData {
+
+        glm::vec3 lightDir;
+        GLint fog;
+        glm::vec3 lightColor;
+        GLint secondLight;
+        glm::vec3 punctLight;
+        float padding0;
+        glm::vec3 punctLightColor;
+        float padding1;
+    };
+
+    struct ShadowData {
+
+        glm::mat4 cascadeMatrices[SHADOW_MAX_CASCADES];
+        // one cascade per component, arrays of floats would take 16 bytes per element
+        glm::vec4 cascadeSplits;
+        glm::vec4 cascadeTexelSizes;
+        GLint cascadeCount;
+        GLint padding[3];
+    };
+
+    // Per-frame data read by every program, kept in one uniform buffer. Each block has a range of its own,
+    // bound once to its binding point; the frame's values are written with a single upload before the
+    // first draw, so callbacks only change the copies here.
+    class FrameUniforms {
+
+    public:
+        FrameData frame;
+        LightData light;
+        ShadowData shadow;
+
+        // Creates the buffer and binds the blocks' ranges, needs the OpenGL context
+        void create();
+
+        // Writes all three blocks with one buffer update
+        void upload();
+
+        void destroy();
+
+    private:
+        GLuint buffer = 0;
+        GLintptr lightOffset = 0;
+        GLintptr shadowOffset = 0;
+        std::vector<unsigned char> staging;
+    };
+
+    // Points whichever of the FrameData, LightData and ShadowData blocks the shader declares at their binding
+    // points; run once after loading it
+    void BindUniformBlocks(const Shader& shader);
+}
+
+#endif /* UniformBuffers_hpp */
@@ -17,8 +17,18 @@
 #include "Shader.hpp"
 #include "Camera.hpp"
 #include "Model3D.hpp"
+#include "ShadowCache.hpp"
+#include "ShadowCascades.hpp"
+#include "UniformBuffers.hpp"
+#include "ObjectBuffer.hpp"
+#include "GLStateCache.hpp"
+#include "GeometryArena.hpp"
+#include "RenderQueue.hpp"
+#include "Benchmarks.hpp"
+#include "TextureCompressor.hpp"
 
 #include <iostream>
+#include <string>
 
 // window
 gps::Window myWindow;
@@ -38,19 +48,19 @@ glm::vec3 lightColor;
 glm::vec3 punctLight;
 glm::vec3 punctLightColor;
 
-// shader uniform locations
-GLint modelLoc;
-GLint viewLoc;
-GLint projectionLoc;
-GLint normalMatrixLoc;
-GLint lightLoc; 
-GLint lightDirLoc;
-GLint lightColorLoc;
-GLint punctLightLoc;
-GLint punctLightColorLoc;
-GLuint shadowMapFBO; 
+// ids of the uniforms set every frame, see gps::Shader::getUniformId
+int cascadeId;
+int shadowMapId;
+int depthMapId;
+int depthMapLayerId;
+int lightModelId;
+// program, texture, framebuffer and viewport binds go through it so repeated ones are dropped
+gps::GLStateCache& glState = gps::GLStateCache::GetShared();
+// camera, light and cascade data shared by all shaders, uploaded once per frame
+gps::FrameUniforms frameUniforms;
+// one per cascade, each with its layer of depthMapTexture attached
+GLuint shadowMapFBOs[gps::SHADOW_MAX_CASCADES];
 GLuint depthMapTexture; 
-GLint fogLoc; //afisare ceata
 
 
 // camera
@@ -70,6 +80,18 @@ gps::Model3D lightCube;
 gps::Model3D nanosuit;
 gps::Model3D screenQuad;
 
+// the scene's largest surfaces, rasterized each frame to skip what they hide
+gps::OcclusionBuffer occlusionBuffer;
+
+// what the last frame's passes culled and drew, T prints them
+gps::DrawStats cameraPassStats;
+gps::DrawStats shadowPassStats;
+
+// fitted to the camera frustum every frame
+gps::ShadowCascade shadowCascades[gps::SHADOW_MAX_CASCADES];
+// skip a cascade's depth pass while neither its box, the light nor the scene change, C toggles them
+gps::ShadowCache shadowCaches[gps::SHADOW_MAX_CASCADES];
+
 GLfloat angle;
 
 // shaders
@@ -79,8 +101,28 @@ gps::Shader screenQuadShader;
 gps::Shader depthMapShader; 
 
 
-const unsigned int SHADOW_WIDTH = 2048;
-const unsigned int SHADOW_HEIGHT = 2048;
+// cascaded shadow maps, 1 to gps::SHADOW_MAX_CASCADES layers of SHADOW_CASCADE_SIZE squared texels
+const int SHADOW_CASCADE_COUNT = 3;
+const int SHADOW_CASCADE_SIZE = 1024;
+// the cascades cover the camera frustum up to this distance
+const float SHADOW_DISTANCE = 60.0f;
+// 0 splits the distance into equal slices, 1 into slices of equal far to near ratio
+const float SHADOW_SPLIT_LAMBDA = 0.75f;
+
+// model and normal matrices of the objects drawn each frame, read by the shaders from a buffer texture
+gps::ObjectBuffer objectBuffer;
+const int OBJECT_BUFFER_CAPACITY = 1024;
+const int OBJECT_BUFFER_TEXTURE_UNIT = 4;
+// where this frame's constants of each object are
+int nanosuitObject;
+int groundObject;
+
+// meshes of a pass, drawn sorted by state and depth rather than in submission order
+gps::RenderQueue renderQueue;
+// per-draw records of the queue's batches of arena meshes, read by the shaders from a buffer texture
+const int DRAW_RECORD_TEXTURE_UNIT = 5;
+// pass field of the render keys, the cascades follow as 1, 2...
+const unsigned CAMERA_PASS = 0;
 
 
 GLenum glCheckError_(const char* file, int line)
@@ -112,6 +154,8 @@ GLenum glCheckError_(const char* file, int line)
 #define glCheckError() glCheckError_(__FILE__, __LINE__)
 
 int framebufferWidth, framebufferHeight;
+// samples per pixel of the default framebuffer, the window asks for 4
+int framebufferSamples = 1;
 void windowResizeCallback(GLFWwindow* window, int windowWidth, int windowHeight) 
 {
     // Log the new dimensions
@@ -120,17 +164,63 @@ void windowResizeCallback(GLFWwindow* window, int windowWidth, int windowHeight)
     glfwGetFramebufferSize(myWindow.getWindow(), &framebufferWidth, &framebufferHeight);
     WindowDimensions dim = { framebufferWidth, framebufferHeight };
     myWindow.setWindowDimensions(dim);
-    glViewport(0, 0, (float)myWindow.getWindowDimensions().width, (float)myWindow.getWindowDimensions().height);
-    myBasicShader.useShaderProgram();
+    glState.viewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
     projection = glm::perspective(glm::radians(45.0f), (float)windowWidth / (float)windowHeight, 0.1f, 1000.0f);
-    projectionLoc = glGetUniformLocation(myBasicShader.shaderProgram, "projection");
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
 }
 
 bool showDepthMap;
 bool animation; 
 
+// the scene is drawn lowered and at half size
+glm::mat4 getGroundModel() {
+    glm::mat4 groundModel = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.0f, 0.0f));
+    return glm::scale(groundModel, glm::vec3(0.5f));
+}
+
+// Reports the triangle of the scene under the screen center, through its triangle BVH
+void pickScene() {
+    glm::mat4 inverseModel = glm::inverse(getGroundModel());
+    // the direction is not normalized in model space, so hit distances stay in world units
+    glm::vec3 origin = glm::vec3(inverseModel * glm::vec4(myCamera.getPosition(), 1.0f));
+    glm::vec3 direction = glm::vec3(inverseModel * glm::vec4(myCamera.getFrontDirection(), 0.0f));
+
+    gps::ModelHit hit;
+    if (ground.Raycast(origin, direction, 100.0f, hit)) {
+        std::cout << "Picked mesh " << hit.mesh << ", triangle " << hit.triangle / 3 << " at distance " << hit.distance << std::endl;
+    }
+    else {
+        std::cout << "Picked nothing" << std::endl;
+    }
+}
+
+void printPassStats(const char* pass, const gps::DrawStats& stats) {
+    std::cout << pass << stats.meshes - stats.frustumCulled - stats.occlusionCulled << " of " << stats.meshes << " meshes ("
+        << stats.frustumCulled << " outside the frustum, " << stats.occlusionCulled << " occluded), " << stats.triangles << " triangles" << std::endl;
+}
+
+void printDrawStats() {
+    printPassStats("Camera pass : ", cameraPassStats);
+    printPassStats("Shadow pass : ", shadowPassStats);
+    size_t redraws = 0;
+    size_t reuses = 0;
+    for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+        redraws += shadowCaches[i].getRedrawCount();
+        reuses += shadowCaches[i].getReuseCount();
+    }
+    std::cout << "Shadow cache: " << (shadowCaches[0].isEnabled() ? "on" : "off") << ", scene drawn into a cascade "
+        << redraws << " times, reused " << reuses << " times" << std::endl;
+    size_t uploads = myBasicShader.getUniformUploadCount() + depthMapShader.getUniformUploadCount();
+    size_t skips = myBasicShader.getUniformSkipCount() + depthMapShader.getUniformSkipCount();
+    std::cout << "Uniforms    : " << uploads << " uploaded, " << skips << " unchanged and skipped" << std::endl;
+    std::cout << "GL state    : " << glState.getIssuedCount() << " calls issued, " << glState.getElidedCount()
+        << " redundant ones dropped" << std::endl;
+    gps::GeometryArena& arena = gps::GeometryArena::GetShared();
+    std::cout << "Draw calls  : " << renderQueue.getDrawCallCount() << " from the render queue, "
+        << (arena.hasMultiDrawIndirect() ? "multi-draw indirect" : "OpenGL 4.1 multi-draws") << ", geometry arena "
+        << arena.getUsedBytes() / 1024 << " of " << arena.getCapacityBytes() / 1024 << " KB in use" << std::endl;
+}
+
 void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int mode) {
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
         glfwSetWindowShouldClose(window, GL_TRUE);
@@ -150,6 +240,19 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
 
     if (key == GLFW_KEY_X && action == GLFW_PRESS)
         animation = !animation;
+
+    if (key == GLFW_KEY_R && action == GLFW_PRESS)
+        pickScene();
+
+    if (key == GLFW_KEY_T && action == GLFW_PRESS)
+        printDrawStats();
+
+    if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+        bool enabled = !shadowCaches[0].isEnabled();
+        for (int i = 0; i < gps::SHADOW_MAX_CASCADES; i++) {
+            shadowCaches[i].setEnabled(enabled);
+        }
+    }
 }
 
 bool firstMouse = true;
@@ -185,16 +288,12 @@ void mouseCallback(GLFWwindow* window, double xpos, double ypos) {
 
     myCamera.rotate(glm::radians(pitch), glm::radians(yaw), 0.0f); 
     view = myCamera.getViewMatrix();
-    myBasicShader.useShaderProgram();
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 }
 
 void processMovement() {
     if (pressedKeys[GLFW_KEY_W]) {
         myCamera.move(gps::MOVE_FORWARD, cameraSpeed);
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
         // compute normal matrix for teapot
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
     }
@@ -202,8 +301,6 @@ void processMovement() {
     if (pressedKeys[GLFW_KEY_S]) {
         myCamera.move(gps::MOVE_BACKWARD, cameraSpeed);
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
         // compute normal matrix for teapot
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
     }
@@ -211,8 +308,6 @@ void processMovement() {
     if (pressedKeys[GLFW_KEY_A]) {
         myCamera.move(gps::MOVE_LEFT, cameraSpeed);
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
         // compute normal matrix for teapot
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
     }
@@ -220,8 +315,6 @@ void processMovement() {
     if (pressedKeys[GLFW_KEY_D]) {
         myCamera.move(gps::MOVE_RIGHT, cameraSpeed);
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
         // compute normal matrix for teapot
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
     }
@@ -252,29 +345,21 @@ void processMovement() {
     if (pressedKeys[GLFW_KEY_LEFT]) {
         myCamera.rotate(0.0f, 0.0f, -1.0f);
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
     }
     if (pressedKeys[GLFW_KEY_RIGHT]) {
         myCamera.rotate(0.0f, 0.0f, 1.0f);
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
     }
 
     if (pressedKeys[GLFW_KEY_UP]) {
         myCamera.move(gps::MOVE_UP, cameraSpeed);
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
         // compute normal matrix for teapot
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
     }
     if (pressedKeys[GLFW_KEY_DOWN]) {
         myCamera.move(gps::MOVE_DOWN, cameraSpeed);
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
         // compute normal matrix for teapot
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
     }
@@ -290,23 +375,19 @@ void processMovement() {
     }
     if (pressedKeys[GLFW_KEY_N]) {
         //on second light
-        myBasicShader.useShaderProgram();
-        glUniform1i(lightLoc, 1);
+        frameUniforms.light.secondLight = 1;
     }
     if (pressedKeys[GLFW_KEY_M]) {
         //off second light
-        myBasicShader.useShaderProgram();
-        glUniform1i(lightLoc, 0);
+        frameUniforms.light.secondLight = 0;
     }
     if (pressedKeys[GLFW_KEY_F]) {
         //on fog
-        myBasicShader.useShaderProgram();
-        glUniform1i(fogLoc, 1);
+        frameUniforms.light.fog = 1;
     }
     if (pressedKeys[GLFW_KEY_G]) {
         //off fog
-        myBasicShader.useShaderProgram();
-        glUniform1i(fogLoc, 0);
+        frameUniforms.light.fog = 0;
     }
 }
 
@@ -316,7 +397,12 @@ void initOpenGLWindow() {
     glfwGetFramebufferSize(myWindow.getWindow(), &framebufferWidth, &framebufferHeight);
     WindowDimensions dim = { framebufferWidth, framebufferHeight };
     myWindow.setWindowDimensions(dim);
-    glViewport(0, 0, (float)myWindow.getWindowDimensions().width, (float)myWindow.getWindowDimensions().height);
+    glState.viewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+    // 0 for a framebuffer without multisampling
+    glGetIntegerv(GL_SAMPLES, &framebufferSamples);
+    if (framebufferSamples < 1) {
+        framebufferSamples = 1;
+    }
 }
 
 void setWindowCallbacks() {
@@ -327,17 +413,29 @@ void setWindowCallbacks() {
 
 void initOpenGLState() {
     glClearColor(0.7f, 0.7f, 0.7f, 1.0f);
-    glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
-    glEnable(GL_FRAMEBUFFER_SRGB);
-    glEnable(GL_DEPTH_TEST); // enable depth-testing
-    glDepthFunc(GL_LESS); // depth-testing interprets a smaller value as "closer"
-    glEnable(GL_CULL_FACE); // cull face
-    glCullFace(GL_BACK); // cull back face
+    glState.viewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+    glState.setEnabled(GL_FRAMEBUFFER_SRGB, true);
+    glState.setEnabled(GL_DEPTH_TEST, true); // enable depth-testing
+    glState.depthFunc(GL_LESS); // depth-testing interprets a smaller value as "closer"
+    glState.setEnabled(GL_CULL_FACE, true); // cull face
+    glState.cullFace(GL_BACK); // cull back face
     glFrontFace(GL_CCW); // GL_CCW for counter clock-wise
 }
 
 void initModels() {
-    ground.LoadModel("models/first_scene/proj.obj");
+    // the scene's objects share a few dozen materials, draw one mesh per material
+    gps::LoadOptions sceneOptions;
+    sceneOptions.batchByMaterial = true;
+    // half the vertex memory and bandwidth, the load prints the quantization error
+    sceneOptions.vertexFormat = gps::VERTEX_QUANTIZED;
+    // R picks the triangle under the screen center
+    sceneOptions.buildTriangleBvh = true;
+    // its walls and floors hide the meshes and meshlets behind them
+    sceneOptions.selectOccluders = true;
+    // its meshes share the arena's buffers, so a pass draws them with a few multi-draws
+    sceneOptions.useGeometryArena = true;
+    // the scene streams in over the first frames, see ground.Update in the render loop
+    ground.LoadModelAsync("models/first_scene/proj.obj", sceneOptions);
     lightCube.LoadModel("models/cube/cube.obj");
     screenQuad.LoadModel("models/quad/quad.obj");
 }
@@ -351,6 +449,11 @@ void initShaders() {
     screenQuadShader.useShaderProgram();
     depthMapShader.loadShader("shaders/shadowMap.vert", "shaders/shadowMap.frag");
     depthMapShader.useShaderProgram();
+
+    // the blocks keep their binding points for the program's lifetime
+    gps::BindUniformBlocks(myBasicShader);
+    gps::BindUniformBlocks(lightShader);
+    gps::BindUniformBlocks(depthMapShader);
 }
 
 void initUniforms() {
@@ -358,122 +461,205 @@ void initUniforms() {
 
     // create model matrix for teapot
     model = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
-    modelLoc = glGetUniformLocation(myBasicShader.shaderProgram, "model");
 
     // get view matrix for current camera
     view = myCamera.getViewMatrix();
-    viewLoc = glGetUniformLocation(myBasicShader.shaderProgram, "view");
-    // send view matrix to shader
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 
     // compute normal matrix for teapot
     normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    normalMatrixLoc = glGetUniformLocation(myBasicShader.shaderProgram, "normalMatrix");
 
     // create projection matrix
     projection = glm::perspective(glm::radians(45.0f),
         (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height,
         0.1f, 20.0f);
-    projectionLoc = glGetUniformLocation(myBasicShader.shaderProgram, "projection");
-    // send projection matrix to shader
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
     lightDir = glm::vec3(0.0f, 1.0f, 1.0f);
-    lightDirLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightDir");
-    // send light dir to shader
-    glUniform3fv(lightDirLoc, 1, glm::value_ptr(lightDir));
-
     lightColor = glm::vec3(1.0f, 1.0f, 1.0f); 
-    lightColorLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightColor");
-    // send light color to shader
-    glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
 
-    lightShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    punctLight = glm::vec3(11.3923f, 0.687753f, -17.3235f);
+    punctLightColor = glm::vec3(1.0f, 0.5f, 0.2f); //portocaliu
 
-    myBasicShader.useShaderProgram();
-    fogLoc = glGetUniformLocation(myBasicShader.shaderProgram, "fog");
+    // view, projection and light direction are written each frame by updateFrameUniforms, fog and second light by the keys
+    frameUniforms.create();
+    frameUniforms.light.fog = 0;
+    frameUniforms.light.secondLight = 0;
+
+    // the buffer texture keeps its own unit, bound once
+    objectBuffer.create(OBJECT_BUFFER_CAPACITY);
+    glState.bindTexture(OBJECT_BUFFER_TEXTURE_UNIT, GL_TEXTURE_BUFFER, objectBuffer.getTexture());
+    myBasicShader.setUniform(myBasicShader.getUniformId("objectConstants"), OBJECT_BUFFER_TEXTURE_UNIT);
+    depthMapShader.useShaderProgram();
+    depthMapShader.setUniform(depthMapShader.getUniformId("objectConstants"), OBJECT_BUFFER_TEXTURE_UNIT);
 
+    // the same for the draw records, which every upload respecifies in place
+    gps::GeometryArena::GetShared().bindRecordTexture(DRAW_RECORD_TEXTURE_UNIT);
+    depthMapShader.setUniform(depthMapShader.getUniformId("drawRecords"), DRAW_RECORD_TEXTURE_UNIT);
     myBasicShader.useShaderProgram();
-    punctLight = glm::vec3(11.3923f, 0.687753f, -17.3235f);
-    punctLightLoc = glGetUniformLocation(myBasicShader.shaderProgram, "punctLight");
-    glUniform3fv(punctLightLoc, 1, glm::value_ptr(punctLight));
-    punctLightColor = glm::vec3(1.0f, 0.5f, 0.2f); //portocaliu
-    punctLightColorLoc = glGetUniformLocation(myBasicShader.shaderProgram, "punctLightColor");
-    glUniform3fv(punctLightColorLoc, 1, glm::value_ptr(punctLightColor));
-    lightLoc = glGetUniformLocation(myBasicShader.shaderProgram, "secondLight");
+    myBasicShader.setUniform(myBasicShader.getUniformId("drawRecords"), DRAW_RECORD_TEXTURE_UNIT);
+
+    cascadeId = depthMapShader.getUniformId("cascade");
+    shadowMapId = myBasicShader.getUniformId("shadowMap");
+    depthMapId = screenQuadShader.getUniformId("depthMap");
+    depthMapLayerId = screenQuadShader.getUniformId("layer");
+    lightModelId = lightShader.getUniformId("model");
 }
 
 void initFBO() {
-    glGenFramebuffers(1, &shadowMapFBO);
-
     glGenTextures(1, &depthMapTexture);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glState.bindTexture(GL_TEXTURE_2D_ARRAY, depthMapTexture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT, SHADOW_CASCADE_SIZE, SHADOW_CASCADE_SIZE, SHADOW_CASCADE_COUNT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+
+    glGenFramebuffers(SHADOW_CASCADE_COUNT, shadowMapFBOs);
+    for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+        glState.bindFramebuffer(GL_FRAMEBUFFER, shadowMapFBOs[i]);
 
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMapTexture, 0);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthMapTexture, 0, i);
 
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
 
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-        std::cerr << "ERROR: Framebuffer is not complete!" << std::endl;
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "ERROR: Framebuffer is not complete!" << std::endl;
+        }
     }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-glm::mat4 computeLightSpaceTrMatrix() {
-    glm::mat4 lightProjection = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, 1.0f, 15.0f);
+glm::mat4 getNanosuitModel() {
+    return glm::rotate(glm::mat4(1.0f), glm::radians(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+}
 
-    glm::vec3 lightPosition = 1.0f * lightDir;
-    glm::vec3 lightTarget = glm::vec3(0.0f);
-    glm::vec3 lightUp = glm::vec3(0.0f, 1.0f, 0.0f);
+// Culling and levels of detail of a model drawn from the camera, or into a shadow cascade. In the depth pass both follow
+// the cascade's light box, so a cascade depends on nothing but its box and the casters and can be cached. The box is
+// extended back towards the light there: casters in front of its near plane still shadow what is inside, the depth
+// pass clamps them to the near plane instead of clipping them.
+gps::DrawContext makeDrawContext(glm::mat4 objectModel, const gps::ShadowCascade* cascade) {
+    if (cascade == NULL) {
+        gps::DrawContext context = gps::MakeDrawContext(objectModel, view, projection, framebufferWidth, framebufferHeight);
+        context.sampleCount = framebufferSamples;
+        context.occlusion = &occlusionBuffer;
+        context.stats = &cameraPassStats;
+        return context;
+    }
 
-    glm::mat4 lightView = glm::lookAt(lightPosition, lightTarget, lightUp);
+    gps::DrawContext context = gps::MakeDrawContext(objectModel, cascade->view, cascade->projection, SHADOW_CASCADE_SIZE, SHADOW_CASCADE_SIZE);
+    context.frustumPlanes[4] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    // the meshlet facing test assumes a perspective camera
+    context.cullClusters = false;
+    context.stats = &shadowPassStats;
+    return context;
+}
 
-    glm::mat4 lightSpaceMatrix = lightProjection * lightView;
-    return lightSpaceMatrix;
+// Writes the model and normal matrices of every object for both passes, before the first draw of the frame
+void updateObjectConstants() {
+    objectBuffer.beginFrame();
+    glm::mat4 nanosuitModel = getNanosuitModel();
+    nanosuitObject = objectBuffer.add(nanosuitModel, glm::mat3(glm::inverseTranspose(view * nanosuitModel)));
+    glm::mat4 groundModel = getGroundModel();
+    groundObject = objectBuffer.add(groundModel, glm::mat3(glm::inverseTranspose(view * groundModel)));
+    objectBuffer.finishWriting();
 }
 
+// Queues the meshes of a model that pass culling. cascade is NULL for the camera pass; objectIndex is where
+// updateObjectConstants put the object's matrices.
+void submitModel(gps::Model3D& object, int objectIndex, glm::mat4 objectModel, gps::Shader& shader, const gps::ShadowCascade* cascade, unsigned pass) {
 
-void drawObjects(gps::Shader shader, bool depthPass) {
+    if (objectIndex < 0) {
+        return;
+    }
+    object.Submit(renderQueue, pass, gps::RENDER_OPAQUE, shader, makeDrawContext(objectModel, cascade), objectIndex);
+}
 
-    shader.useShaderProgram();
+// Draws what was submitted since the last call
+void drawQueued() {
+    renderQueue.sort();
+    renderQueue.execute();
+    renderQueue.clear();
+}
 
+void drawObjects(gps::Shader& shader) {
 
-    model = glm::rotate(glm::mat4(1.0f), glm::radians(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+    submitModel(nanosuit, nanosuitObject, getNanosuitModel(), shader, NULL, CAMERA_PASS);
+    submitModel(ground, groundObject, getGroundModel(), shader, NULL, CAMERA_PASS);
+    drawQueued();
+}
 
-    // do not send the normal matrix if we are rendering in the depth map
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    }
+// The scene never moves, so it is drawn into a cascade only when the cascade's box, the light or its meshes change.
+// The nanosuit is a dynamic caster: once loaded, it is drawn every frame over a copy of the cached scene.
+void renderShadowMaps() {
 
+    bool dynamicCasters = nanosuit.getMeshCount() > 0;
 
-    nanosuit.Draw(shader);
+    depthMapShader.useShaderProgram();
+    glState.viewport(0, 0, SHADOW_CASCADE_SIZE, SHADOW_CASCADE_SIZE);
+    // casters between the light and a cascade's near plane, kept by makeDrawContext, land at depth 0
+    glState.setEnabled(GL_DEPTH_CLAMP, true);
+    shadowPassStats = gps::DrawStats();
+
+    for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+        const gps::ShadowCascade& cascade = shadowCascades[i];
+        gps::ShadowCache& cache = shadowCaches[i];
+
+        cache.beginFrame();
+        cache.track(cascade.viewProjection);
+        cache.track(getGroundModel());
+        cache.track(ground.getMeshCount());
+        cache.track((size_t)dynamicCasters);
+
+        // shadowMap.vert takes the cascade's matrix from the ShadowData block
+        depthMapShader.setUniform(cascadeId, i);
+
+        if (!cache.isStaticLayerValid()) {
+            glState.bindFramebuffer(GL_FRAMEBUFFER, dynamicCasters ? cache.getStaticLayerFramebuffer(SHADOW_CASCADE_SIZE, SHADOW_CASCADE_SIZE) : shadowMapFBOs[i]);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            submitModel(ground, groundObject, getGroundModel(), depthMapShader, &cascade, CAMERA_PASS + 1 + i);
+            drawQueued();
+            cache.staticLayerDrawn();
+        }
 
-    model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.0f, 0.0f));
-    model = glm::scale(model, glm::vec3(0.5f));
+        if (dynamicCasters) {
+            cache.copyStaticLayer(shadowMapFBOs[i]);
+            submitModel(nanosuit, nanosuitObject, getNanosuitModel(), depthMapShader, &cascade, CAMERA_PASS + 1 + i);
+            drawQueued();
+        }
+    }
 
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+    glState.setEnabled(GL_DEPTH_CLAMP, false);
+    glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-    // do not send the normal matrix if we are rendering in the depth map
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+// Fits the cascades to the camera and writes the frame's camera, light and cascade data for every shader at once.
+// basic.frag picks a cascade by the fragment's distance along the view axis.
+void updateFrameUniforms() {
+    view = myCamera.getViewMatrix();
+    gps::FitShadowCascades(view, projection, SHADOW_DISTANCE, lightDir, SHADOW_CASCADE_SIZE, SHADOW_CASCADE_COUNT, SHADOW_SPLIT_LAMBDA, shadowCascades);
+
+    frameUniforms.frame.view = view;
+    frameUniforms.frame.projection = projection;
+
+    lightRotation = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
+    frameUniforms.light.lightDir = glm::inverseTranspose(glm::mat3(view * lightRotation)) * lightDir;
+    frameUniforms.light.lightColor = lightColor;
+    frameUniforms.light.punctLight = punctLight;
+    frameUniforms.light.punctLightColor = punctLightColor;
+
+    gps::ShadowData& shadow = frameUniforms.shadow;
+    for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+        shadow.cascadeMatrices[i] = shadowCascades[i].viewProjection;
+        shadow.cascadeSplits[i] = shadowCascades[i].splitDistance;
+        shadow.cascadeTexelSizes[i] = shadowCascades[i].texelSize;
     }
+    shadow.cascadeCount = SHADOW_CASCADE_COUNT;
 
-    ground.Draw(shader);
+    frameUniforms.upload();
 }
 
 
@@ -488,84 +674,104 @@ void renderScene() {
 
     }
 
-    glm::mat4 lightSpaceMatrix = computeLightSpaceTrMatrix();
-
-    depthMapShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram, "lightSpaceTrMatrix"),
-        1,
-        GL_FALSE,
-        glm::value_ptr(computeLightSpaceTrMatrix()));
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glClear(GL_DEPTH_BUFFER_BIT);
-    drawObjects(depthMapShader, true);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // the cascades follow the camera
+    updateFrameUniforms();
+    updateObjectConstants();
+    renderShadowMaps();
 
     if (showDepthMap) {
-        glViewport(0, 0, framebufferWidth, framebufferHeight);
+        glState.viewport(0, 0, framebufferWidth, framebufferHeight);
 
         glClear(GL_COLOR_BUFFER_BIT);
 
         screenQuadShader.useShaderProgram();
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-        glUniform1i(glGetUniformLocation(screenQuadShader.shaderProgram, "depthMap"), 0);
-        glDisable(GL_DEPTH_TEST);
+        glState.bindTexture(0, GL_TEXTURE_2D_ARRAY, depthMapTexture);
+        screenQuadShader.setUniform(depthMapId, 0);
+        // the nearest cascade
+        screenQuadShader.setUniform(depthMapLayerId, 0);
+        glState.setEnabled(GL_DEPTH_TEST, false);
         screenQuad.Draw(screenQuadShader);
-        glEnable(GL_DEPTH_TEST);
+        glState.setEnabled(GL_DEPTH_TEST, true);
     }
     else {
 
-        glViewport(0, 0, framebufferWidth, framebufferHeight);
+        glState.viewport(0, 0, framebufferWidth, framebufferHeight);
 
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         myBasicShader.useShaderProgram();
 
-        view = myCamera.getViewMatrix();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-
-        lightRotation = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
-        glUniform3fv(lightDirLoc, 1, glm::value_ptr(glm::inverseTranspose(glm::mat3(view * lightRotation)) * lightDir));
+        occlusionBuffer.clear();
+        ground.RenderOccluders(occlusionBuffer, projection * view * getGroundModel());
+        occlusionBuffer.rasterize();
 
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "shadowMap"), 3);
+        glState.bindTexture(3, GL_TEXTURE_2D_ARRAY, depthMapTexture);
+        myBasicShader.setUniform(shadowMapId, 3);
 
-        glUniformMatrix4fv(glGetUniformLocation(myBasicShader.shaderProgram, "lightSpaceTrMatrix"),
-            1,
-            GL_FALSE,
-            glm::value_ptr(computeLightSpaceTrMatrix()));
-
-        drawObjects(myBasicShader, false);
+        cameraPassStats = gps::DrawStats();
+        drawObjects(myBasicShader);
 
 
         lightShader.useShaderProgram();
 
-        glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-
         model = lightRotation;
         model = glm::translate(model, 1.0f * lightDir);
         model = glm::scale(model, glm::vec3(0.01f, 0.01f, 0.01f));
-        glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+        lightShader.setUniform(lightModelId, model);
 
         lightCube.Draw(lightShader);
     }
 
+    // the object constants' slot is free again once these draws complete
+    objectBuffer.endFrame();
 }
 
 
 void cleanup() {
-    glDeleteTextures(1, &depthMapTexture);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glDeleteFramebuffers(1, &shadowMapFBO);
+    // the totals, for runs nobody presses T in
+    printDrawStats();
+    glState.deleteTextures(1, &depthMapTexture);
+    glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
+    glState.deleteFramebuffers(SHADOW_CASCADE_COUNT, shadowMapFBOs);
+    for (int i = 0; i < gps::SHADOW_MAX_CASCADES; i++) {
+        shadowCaches[i].destroy();
+    }
+    frameUniforms.destroy();
+    objectBuffer.destroy();
+    gps::GeometryArena::GetShared().destroy();
     myWindow.Delete();
     //cleanup code for your own data
 }
 
 int main(int argc, const char* argv[]) {
 
+    // command line benchmarks and tools run without a window
+    if (argc > 2 && std::string(argv[1]) == "--bench-load") {
+        return gps::RunLoadBenchmark(argv[2]);
+    }
+    if (argc > 2 && std::string(argv[1]) == "--bench-optimize") {
+        return gps::RunOptimizeBenchmark(argv[2]);
+    }
+    if (argc > 2 && std::string(argv[1]) == "--bench-lod") {
+        return gps::RunLodBenchmark(argv[2]);
+    }
+    if (argc > 2 && std::string(argv[1]) == "--bench-clusters") {
+        return gps::RunClusterBenchmark(argv[2]);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-culling") {
+        return gps::RunCullingBenchmark();
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-occlusion") {
+        return gps::RunOcclusionBenchmark();
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-sort") {
+        return gps::RunSortBenchmark();
+    }
+    if (argc > 2 && std::string(argv[1]) == "--cook-textures") {
+        return gps::CookTextures(argv[2]);
+    }
+
     try {
         initOpenGLWindow();
     }
@@ -585,6 +791,8 @@ int main(int argc, const char* argv[]) {
     // application loop
     while (!glfwWindowShouldClose(myWindow.getWindow())) {
         processMovement();
+        // upload the parts of the scene that finished loading, a few ms per frame
+        ground.Update(4.0);
         renderScene();
 
         glfwPollEvents();